@@ -6,6 +6,10 @@
 #include "filesys/filesys.h"
 #include "filesys/free-map.h"
 #include "threads/malloc.h"
+#include "threads/scratch.h"
+#include "threads/shrinker.h"
+#include "threads/slab.h"
+#include "threads/synch.h"
 
 /* Identifies an inode. */
 #define INODE_MAGIC 0x494e4f44
@@ -29,6 +33,7 @@ bytes_to_sectors (off_t size) {
 /* In-memory inode. */
 struct inode {
 	struct list_elem elem;              /* Element in inode list. */
+	struct list_elem unused_elem;       /* Element in unused inode list. */
 	disk_sector_t sector;               /* Sector number of disk location. */
 	int open_cnt;                       /* Number of openers. */
 	bool removed;                       /* True if deleted, false otherwise. */
@@ -49,14 +54,37 @@ byte_to_sector (const struct inode *inode, off_t pos) {
 		return -1;
 }
 
-/* List of open inodes, so that opening a single inode twice
- * returns the same `struct inode'. */
+/* List of in-memory inodes, so that opening a single inode twice
+ * returns the same `struct inode'.
+ *
+ * An inode whose last opener closes it stays in memory, on the
+ * unused list as well, so that opening it again does not have to
+ * read it from disk.  Unused inodes are freed, oldest first, by
+ * the "inode" shrinker when memory runs low.  Removed inodes are
+ * never kept. */
 static struct list open_inodes;
+static struct list unused_inodes;
+static size_t unused_cnt;
+
+/* Protects the lists above and the inodes' open counts. */
+static struct lock inode_lock;
+
+/* Cache that in-memory inodes are allocated from. */
+static struct kmem_cache *inode_cache;
+
+static shrinker_count_func inode_shrink_count;
+static shrinker_scan_func inode_shrink_scan;
 
 /* Initializes the inode module. */
 void
 inode_init (void) {
 	list_init (&open_inodes);
+	list_init (&unused_inodes);
+	lock_init (&inode_lock);
+	inode_cache = kmem_cache_create ("inode", sizeof (struct inode), 0, NULL,
+			MEM_INODE);
+	ASSERT (inode_cache != NULL);
+	register_shrinker ("inode", inode_shrink_count, inode_shrink_scan);
 }
 
 /* Initializes an inode with LENGTH bytes of data and
@@ -102,22 +130,33 @@ inode_create (disk_sector_t sector, off_t length) {
 struct inode *
 inode_open (disk_sector_t sector) {
 	struct list_elem *e;
-	struct inode *inode;
+	struct inode *inode, *new;
 
-	/* Check whether this inode is already open. */
+	/* Allocate memory first: the allocation may run the inode
+	 * shrinker, which must find the inode lock free. */
+	new = kmem_cache_alloc (inode_cache);
+	lock_acquire (&inode_lock);
+
+	/* Check whether this inode is already in memory. */
 	for (e = list_begin (&open_inodes); e != list_end (&open_inodes);
 			e = list_next (e)) {
 		inode = list_entry (e, struct inode, elem);
 		if (inode->sector == sector) {
-			inode_reopen (inode);
+			if (inode->open_cnt++ == 0) {
+				list_remove (&inode->unused_elem);
+				unused_cnt--;
+			}
+			lock_release (&inode_lock);
+			kmem_cache_free (inode_cache, new);
 			return inode; 
 		}
 	}
 
-	/* Allocate memory. */
-	inode = malloc (sizeof *inode);
-	if (inode == NULL)
+	inode = new;
+	if (inode == NULL) {
+		lock_release (&inode_lock);
 		return NULL;
+	}
 
 	/* Initialize. */
 	list_push_front (&open_inodes, &inode->elem);
@@ -126,14 +165,18 @@ inode_open (disk_sector_t sector) {
 	inode->deny_write_cnt = 0;
 	inode->removed = false;
 	disk_read (filesys_disk, inode->sector, &inode->data);
+	lock_release (&inode_lock);
 	return inode;
 }
 
 /* Reopens and returns INODE. */
 struct inode *
 inode_reopen (struct inode *inode) {
-	if (inode != NULL)
+	if (inode != NULL) {
+		lock_acquire (&inode_lock);
 		inode->open_cnt++;
+		lock_release (&inode_lock);
+	}
 	return inode;
 }
 
@@ -144,28 +187,69 @@ inode_get_inumber (const struct inode *inode) {
 }
 
 /* Closes INODE and writes it to disk.
- * If this was the last reference to INODE, frees its memory.
- * If INODE was also a removed inode, frees its blocks. */
+ * If this was the last reference to INODE, puts it on the unused
+ * list, or, if INODE was a removed inode, frees its blocks and
+ * its memory. */
 void
 inode_close (struct inode *inode) {
 	/* Ignore null pointer. */
 	if (inode == NULL)
 		return;
 
-	/* Release resources if this was the last opener. */
-	if (--inode->open_cnt == 0) {
-		/* Remove from inode list and release lock. */
-		list_remove (&inode->elem);
+	lock_acquire (&inode_lock);
+	if (--inode->open_cnt > 0) {
+		lock_release (&inode_lock);
+		return;
+	}
 
-		/* Deallocate blocks if removed. */
-		if (inode->removed) {
-			free_map_release (inode->sector, 1);
-			free_map_release (inode->data.start,
-					bytes_to_sectors (inode->data.length)); 
-		}
+	/* Last opener.  Keep it around unless removed. */
+	if (!inode->removed) {
+		list_push_back (&unused_inodes, &inode->unused_elem);
+		unused_cnt++;
+		lock_release (&inode_lock);
+		return;
+	}
+	list_remove (&inode->elem);
+	lock_release (&inode_lock);
+
+	free_map_release (inode->sector, 1);
+	free_map_release (inode->data.start,
+			bytes_to_sectors (inode->data.length)); 
+	kmem_cache_free (inode_cache, inode);
+}
+
+/* Shrinker count function: the number of unused inodes. */
+static size_t
+inode_shrink_count (void) {
+	return unused_cnt;
+}
+
+/* Shrinker scan function: frees up to NR_TO_SCAN unused inodes,
+ * oldest first.  Gives up if the inode lock or the inode cache's
+ * lock is taken, by this thread too, for the shrinker may run inside
+ * any allocation. */
+static size_t
+inode_shrink_scan (size_t nr_to_scan) {
+	size_t freed = 0;
 
-		free (inode); 
+	if (lock_held_by_current_thread (&inode_lock)
+			|| !lock_try_acquire (&inode_lock))
+		return 0;
+	while (freed < nr_to_scan && !list_empty (&unused_inodes)) {
+		struct inode *inode = list_entry (list_pop_front (&unused_inodes),
+				struct inode, unused_elem);
+		struct list_elem *next = list_remove (&inode->elem);
+
+		if (!kmem_cache_try_free (inode_cache, inode)) {
+			list_insert (next, &inode->elem);
+			list_push_front (&unused_inodes, &inode->unused_elem);
+			break;
+		}
+		unused_cnt--;
+		freed++;
 	}
+	lock_release (&inode_lock);
+	return freed;
 }
 
 /* Marks INODE to be deleted when it is closed by the last caller who
@@ -184,6 +268,7 @@ inode_read_at (struct inode *inode, void *buffer_, off_t size, off_t offset) {
 	uint8_t *buffer = buffer_;
 	off_t bytes_read = 0;
 	uint8_t *bounce = NULL;
+	void *mark = scratch_mark ();
 
 	while (size > 0) {
 		/* Disk sector to read, starting byte offset within sector. */
@@ -207,7 +292,7 @@ inode_read_at (struct inode *inode, void *buffer_, off_t size, off_t offset) {
 			/* Read sector into bounce buffer, then partially copy
 			 * into caller's buffer. */
 			if (bounce == NULL) {
-				bounce = malloc (DISK_SECTOR_SIZE);
+				bounce = scratch_alloc (DISK_SECTOR_SIZE);
 				if (bounce == NULL)
 					break;
 			}
@@ -220,7 +305,7 @@ inode_read_at (struct inode *inode, void *buffer_, off_t size, off_t offset) {
 		offset += chunk_size;
 		bytes_read += chunk_size;
 	}
-	free (bounce);
+	scratch_release (mark);
 
 	return bytes_read;
 }
@@ -236,6 +321,7 @@ inode_write_at (struct inode *inode, const void *buffer_, off_t size,
 	const uint8_t *buffer = buffer_;
 	off_t bytes_written = 0;
 	uint8_t *bounce = NULL;
+	void *mark = scratch_mark ();
 
 	if (inode->deny_write_cnt)
 		return 0;
@@ -261,7 +347,7 @@ inode_write_at (struct inode *inode, const void *buffer_, off_t size,
 		} else {
 			/* We need a bounce buffer. */
 			if (bounce == NULL) {
-				bounce = malloc (DISK_SECTOR_SIZE);
+				bounce = scratch_alloc (DISK_SECTOR_SIZE);
 				if (bounce == NULL)
 					break;
 			}
@@ -282,7 +368,7 @@ inode_write_at (struct inode *inode, const void *buffer_, off_t size,
 		offset += chunk_size;
 		bytes_written += chunk_size;
 	}
-	free (bounce);
+	scratch_release (mark);
 
 	return bytes_written;
 }
@@ -0,0 +1,93 @@
+#ifndef __LIB_KERNEL_RBTREE_H
+#define __LIB_KERNEL_RBTREE_H
+
+/* Red-black tree.
+ *
+ * A balanced binary search tree for ordered data that a sorted
+ * list would make O(n) to maintain: sleep queues, address
+ * ranges, free extents and the like.  Insertion, deletion and
+ * lower_bound searches take O(log n) time.
+ *
+ * Like the list and hash table, the tree does no dynamic
+ * allocation.  Each structure that can be in a tree embeds a
+ * struct rb_node member, and rb_entry() converts a pointer to
+ * that member back to the outer structure.  Elements that
+ * compare equal are allowed; they are kept in insertion order.
+ *
+ * Augmented trees.  A tree can keep per-node data that summarizes
+ * a node's whole subtree, such as the largest end address of any
+ * interval below it, which lets an interval query skip subtrees
+ * that cannot overlap.  Pass an rb_augment_func to rb_init(); the
+ * tree calls it on every node whose subtree changes, children
+ * before parents.  If the data a node contributes changes while
+ * it is in the tree, call rb_augment_path() on it.  See rbtree.c
+ * for an example. */
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/* Tree node. */
+struct rb_node {
+	struct rb_node *parent;     /* Parent, or null for the root. */
+	struct rb_node *left;       /* Left child, or null. */
+	struct rb_node *right;      /* Right child, or null. */
+	bool red;                   /* Red or black. */
+};
+
+/* Converts pointer to tree node RB_NODE into a pointer to the
+ * structure that RB_NODE is embedded inside.  Supply the name of
+ * the outer structure STRUCT and the member name MEMBER of the
+ * tree node. */
+#define rb_entry(RB_NODE, STRUCT, MEMBER)                       \
+	((STRUCT *) ((uint8_t *) &(RB_NODE)->parent             \
+		- offsetof (STRUCT, MEMBER.parent)))
+
+/* Compares the value of two tree nodes A and B, given auxiliary
+ * data AUX.  Returns true if A is less than B, or false if A is
+ * greater than or equal to B. */
+typedef bool rb_less_func (const struct rb_node *a,
+		const struct rb_node *b,
+		void *aux);
+
+/* Recomputes the augmented data of NODE from NODE itself and its
+ * children, which are already up to date, given auxiliary data
+ * AUX. */
+typedef void rb_augment_func (struct rb_node *node, void *aux);
+
+/* Performs some operation on tree node N, given auxiliary data
+ * AUX. */
+typedef void rb_action_func (struct rb_node *n, void *aux);
+
+/* Red-black tree. */
+struct rb_tree {
+	struct rb_node *root;       /* Root node, or null if empty. */
+	size_t node_cnt;            /* Number of nodes in tree. */
+	rb_less_func *less;         /* Comparison function. */
+	rb_augment_func *augment;   /* Augmentation function, or null. */
+	void *aux;                  /* Auxiliary data for `less' and `augment'. */
+};
+
+/* Basic life cycle. */
+void rb_init (struct rb_tree *, rb_less_func *, rb_augment_func *, void *aux);
+void rb_clear (struct rb_tree *, rb_action_func *);
+
+/* Search, insertion, deletion. */
+void rb_insert (struct rb_tree *, struct rb_node *);
+void rb_erase (struct rb_tree *, struct rb_node *);
+struct rb_node *rb_find (struct rb_tree *, const struct rb_node *);
+struct rb_node *rb_lower_bound (struct rb_tree *, const struct rb_node *);
+struct rb_node *rb_upper_bound (struct rb_tree *, const struct rb_node *);
+void rb_augment_path (struct rb_tree *, struct rb_node *);
+
+/* Traversal. */
+struct rb_node *rb_first (struct rb_tree *);
+struct rb_node *rb_last (struct rb_tree *);
+struct rb_node *rb_next (struct rb_node *);
+struct rb_node *rb_prev (struct rb_node *);
+
+/* Information. */
+size_t rb_size (struct rb_tree *);
+bool rb_empty (struct rb_tree *);
+
+#endif /* lib/kernel/rbtree.h */
@@ -0,0 +1,48 @@
+#ifndef THREADS_MEMACCT_H
+#define THREADS_MEMACCT_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include "threads/thread.h"
+
+/* Subsystems that kernel memory is charged to.  See memacct.c. */
+enum mem_tag {
+	MEM_MISC,                   /* malloc() and untagged pages. */
+	MEM_THREAD,                 /* Thread structures and stacks. */
+	MEM_FDT,                    /* File descriptor tables. */
+	MEM_FILE,                   /* Open files. */
+	MEM_INODE,                  /* In-memory inodes. */
+	MEM_DIR,                    /* Open directories. */
+	MEM_VM,                     /* User frames and page tables. */
+	MEM_DISK,                   /* Disk sector buffers. */
+	MEM_SCRATCH,                /* Per-thread scratch arenas. */
+	MEM_TAG_CNT
+};
+
+/* Memory charged to one tag. */
+struct mem_usage {
+	long long bytes;            /* Bytes in objects now. */
+	long long peak_bytes;       /* High-water mark of BYTES. */
+	long long pages;            /* Pages now. */
+	long long peak_pages;       /* High-water mark of PAGES. */
+	long long allocs;           /* Number of allocations ever. */
+};
+
+/* -memleak: Record allocation sites and list what a thread still
+   holds when it exits? */
+extern bool memacct_trace;
+
+void memacct_init (void);
+void memacct_alloc (enum mem_tag, const void *ptr, size_t bytes,
+		size_t pages, const void *site);
+void memacct_free (enum mem_tag, const void *ptr, size_t bytes,
+		size_t pages);
+void memacct_set_owner (const void *ptr, tid_t owner);
+void memacct_set_site (const void *ptr, const void *site);
+void memacct_move (const void *old, const void *new);
+void memacct_usage (enum mem_tag, struct mem_usage *);
+const char *memacct_tag_name (enum mem_tag);
+void memacct_exit (void);
+void memacct_print_stats (void);
+
+#endif /* threads/memacct.h */
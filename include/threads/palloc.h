@@ -1,6 +1,7 @@
 #ifndef THREADS_PALLOC_H
 #define THREADS_PALLOC_H
 
+#include <stdbool.h>
 #include <stdint.h>
 #include <stddef.h>
 
@@ -8,16 +9,46 @@
 enum palloc_flags {
 	PAL_ASSERT = 001,           /* Panic on failure. */
 	PAL_ZERO = 002,             /* Zero page contents. */
-	PAL_USER = 004              /* User page. */
+	PAL_USER = 004,             /* User page. */
+	PAL_NOTRACK = 010           /* Count, but do not record for -memleak. */
 };
 
+/* Charges the pages to memory accounting tag TAG (an enum mem_tag,
+   see memacct.h) when OR'd into the flags.  Untagged pages are
+   charged to MEM_MISC. */
+#define PAL_TAG(TAG) ((enum palloc_flags) ((TAG) << 8))
+#define PAL_TAG_OF(FLAGS) (((FLAGS) >> 8) & 0xff)
+
+/* Per-thread cache of free single pages, one for each pool.
+   See the comment on page magazines in palloc.c. */
+#define PAL_MAG_SIZE 8              /* Pages held by a full magazine. */
+#define PAL_MAG_BATCH 4             /* Pages moved per refill or drain. */
+struct palloc_magazine {
+	size_t cnt;                     /* Number of cached pages. */
+	void *pages[PAL_MAG_SIZE];      /* Cached pages, used as a stack. */
+};
+
+/* Moves the contents of used page KPAGE to free page NEW_KPAGE
+   and repoints everything that refers to KPAGE, returning true,
+   or returns false if KPAGE cannot be moved right now.  See the
+   comment on compaction in palloc.c. */
+typedef bool palloc_migrate_func (void *kpage, void *new_kpage);
+
 /* Maximum number of pages to put in user pool. */
 extern size_t user_page_limit;
 
 uint64_t palloc_init (void);
 void *palloc_get_page (enum palloc_flags);
 void *palloc_get_multiple (enum palloc_flags, size_t page_cnt);
+void *palloc_get_aligned (enum palloc_flags, size_t page_cnt, size_t align);
 void palloc_free_page (void *);
 void palloc_free_multiple (void *, size_t page_cnt);
+void palloc_magazine_drain (void);
+size_t palloc_free_count (enum palloc_flags);
+bool palloc_zero_idle (void);
+void palloc_set_migrate (enum palloc_flags, palloc_migrate_func *);
+size_t palloc_compact (enum palloc_flags);
+void palloc_compactd_start (void);
+void palloc_print_stats (void);
 
 #endif /* threads/palloc.h */
@@ -0,0 +1,22 @@
+#ifndef THREADS_SCRATCH_H
+#define THREADS_SCRATCH_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* Per-thread scratch arena.  See scratch.c for details. */
+struct scratch_chunk;
+struct scratch {
+	struct scratch_chunk *chunk;    /* Current chunk, or null. */
+	uint8_t *top;                   /* Next free byte in CHUNK. */
+	uint8_t *end;                   /* End of CHUNK. */
+};
+
+void *scratch_alloc (size_t size) __attribute__ ((malloc));
+void *scratch_mark (void);
+void scratch_release (void *mark);
+void scratch_reset (void);
+void scratch_destroy (void);
+void scratch_print_stats (void);
+
+#endif /* threads/scratch.h */
@@ -0,0 +1,21 @@
+#ifndef THREADS_SHRINKER_H
+#define THREADS_SHRINKER_H
+
+#include <stddef.h>
+
+/* Returns the number of objects a cache could give back right
+   now.  Must be cheap: it is called on every shrink. */
+typedef size_t shrinker_count_func (void);
+
+/* Frees up to NR_TO_SCAN objects and returns the number freed.
+   Called from inside the page allocator, possibly while the
+   allocating thread holds arbitrary locks, so it must not block:
+   it may only lock_try_acquire() and give up if that fails. */
+typedef size_t shrinker_scan_func (size_t nr_to_scan);
+
+void register_shrinker (const char *name, shrinker_count_func *,
+		shrinker_scan_func *);
+size_t shrink_caches (void);
+void shrinker_print_stats (void);
+
+#endif /* threads/shrinker.h */
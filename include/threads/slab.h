@@ -0,0 +1,27 @@
+#ifndef THREADS_SLAB_H
+#define THREADS_SLAB_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include "threads/memacct.h"
+
+/* Object cache.  See slab.c for details. */
+struct kmem_cache;
+
+/* Constructor run once on each object when its slab is created. */
+typedef void kmem_ctor_func (void *obj);
+
+void kmem_cache_init (void);
+struct kmem_cache *kmem_cache_create (const char *name, size_t size,
+		size_t align, kmem_ctor_func *ctor, enum mem_tag tag);
+void kmem_cache_destroy (struct kmem_cache *);
+void *kmem_cache_alloc (struct kmem_cache *) __attribute__ ((malloc));
+void kmem_cache_free (struct kmem_cache *, void *obj);
+bool kmem_cache_try_free (struct kmem_cache *, void *obj);
+size_t kmem_cache_size (const struct kmem_cache *);
+size_t kmem_cache_shrink (struct kmem_cache *);
+
+struct kmem_cache *kmem_cache_of (void *obj);
+void kmem_cache_print_stats (void);
+
+#endif /* threads/slab.h */
@@ -7,6 +7,8 @@
 #include "threads/interrupt.h"
 #include "threads/fp-ops.h"
 #include "threads/synch.h"
+#include "threads/palloc.h"
+#include "threads/scratch.h"
 #ifdef VM
 #include "vm/vm.h"
 #endif
@@ -129,6 +131,12 @@ struct thread {
 	struct semaphore sema_wait;			/* semaphore for wait */
 	struct intr_frame copied_if;		/* copied intr frame */
 
+	/* Owned by threads/palloc.c. */
+	struct palloc_magazine page_mags[2];	/* Free page caches, kernel/user. */
+
+	/* Owned by threads/scratch.c. */
+	struct scratch scratch;				/* Scratch arena for temporaries. */
+
 #ifdef USERPROG
 	/* Owned by userprog/process.c. */
 	uint64_t *pml4;                     /* Page map level 4 */
@@ -136,6 +144,7 @@ struct thread {
 #ifdef VM
 	/* Table for whole virtual memory owned by thread. */
 	struct supplemental_page_table spt;
+	void *user_rsp;                     /* User rsp at syscall entry. */
 #endif
 
 	/* Owned by thread.c. */
@@ -157,6 +166,10 @@ void thread_print_stats (void);
 typedef void thread_func (void *aux);
 tid_t thread_create (const char *name, int priority, thread_func *, void *);
 
+/* Performs some operation on thread t, given auxiliary data AUX. */
+typedef void thread_action_func (struct thread *t, void *aux);
+void thread_foreach (thread_action_func *, void *);
+
 void thread_block (void);
 void thread_unblock (struct thread *);
 
@@ -34,6 +34,17 @@
 /* Kernel virtual address start */
 #define KERN_BASE LOADER_KERN_BASE
 
+/* The vmalloc area, where vmalloc() maps scattered physical pages
+ * so that they look contiguous.  It lies far above the direct map
+ * but in the same PML4 slot as KERN_BASE, so the page tables behind
+ * it are shared by every pml4 copied from base_pml4. */
+#define VMALLOC_START 0xc000000000
+#define VMALLOC_END   (VMALLOC_START + 0x10000000)	/* 256 MB. */
+
+/* Returns true if VADDR lies in the vmalloc area. */
+#define is_vmalloc_vaddr(vaddr) \
+	((uint64_t) (vaddr) >= VMALLOC_START && (uint64_t) (vaddr) < VMALLOC_END)
+
 /* User stack start */
 #define USER_STACK 0x47480000
 
@@ -0,0 +1,16 @@
+#ifndef THREADS_VMALLOC_H
+#define THREADS_VMALLOC_H
+
+#include <stddef.h>
+
+void vmalloc_init (void);
+void *vmalloc (size_t) __attribute__ ((malloc));
+void vfree (void *);
+
+void *kvmalloc (size_t) __attribute__ ((malloc));
+void *kvcalloc (size_t, size_t) __attribute__ ((malloc));
+void kvfree (void *);
+
+void vmalloc_print_stats (void);
+
+#endif /* threads/vmalloc.h */
@@ -1,13 +1,21 @@
 #ifndef VM_ANON_H
 #define VM_ANON_H
+#include <stddef.h>
+#include <stdint.h>
 #include "vm/vm.h"
 struct page;
 enum vm_type;
 
+/* Most pages that can refer to one swap slot. */
+#define SWAP_REF_MAX UINT8_MAX
+
 struct anon_page {
+	size_t slot;           /* Swap slot holding the page, or SIZE_MAX. */
 };
 
 void vm_anon_init (void);
+void vm_anon_print_stats (void);
 bool anon_initializer (struct page *page, enum vm_type type, void *kva);
+bool anon_swap_dup (struct page *page);
 
 #endif
@@ -7,6 +7,20 @@ struct page;
 enum vm_type;
 
 struct file_page {
+	struct file *file;     /* Mapped file; its area's handle. */
+	off_t ofs;             /* Offset in FILE of the page. */
+	size_t read_bytes;     /* Bytes of the page backed by FILE. */
+};
+
+/* Where the contents of a lazily loaded page come from: READ_BYTES
+ * bytes of FILE starting at OFS, followed by zeros.  A null FILE
+ * means the running process's executable.  Passed, malloc()'d, as
+ * the aux of a page's initializer; the page owns it until the
+ * initializer runs. */
+struct load_info {
+	struct file *file;
+	off_t ofs;
+	size_t read_bytes;
 };
 
 void vm_file_init (void);
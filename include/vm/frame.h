@@ -0,0 +1,62 @@
+#ifndef VM_FRAME_H
+#define VM_FRAME_H
+#include <list.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "filesys/off_t.h"
+
+struct frame;
+struct inode;
+struct page;
+
+/* The evictable frames, as an eviction policy keeps them: in up to
+ * EVICT_QUEUES queues whose meaning is the policy's. */
+#define EVICT_QUEUES 2
+
+struct evict_queues {
+	struct list queue[EVICT_QUEUES];
+	size_t cnt[EVICT_QUEUES];    /* Number of frames in each queue. */
+	struct list_elem *hand;      /* CLOCK: next frame to look at. */
+	unsigned long seq;           /* 2Q: evictions from A1in so far. */
+};
+
+/* An eviction policy.  A frame is passed to INSERT when it becomes
+ * evictable and leaves the policy's queues through REMOVE or as the
+ * frame VICTIM returns.  VICTIM returns a null pointer only if the
+ * queues are empty.  See evict.c. */
+struct evict_policy {
+	const char *name;
+	void (*insert) (struct evict_queues *, struct frame *);
+	void (*remove) (struct evict_queues *, struct frame *);
+	struct frame *(*victim) (struct evict_queues *);
+};
+
+extern const struct evict_policy evict_clock;
+extern const struct evict_policy evict_2q;
+extern const struct evict_policy evict_lru;
+
+void evict_queues_init (struct evict_queues *);
+
+/* The frame table. */
+void frame_table_init (void);
+bool frame_set_policy (const char *name);
+const char *frame_policy_name (void);
+size_t frame_table_size (void);
+
+void frame_table_add (struct frame *);
+void frame_table_remove (struct frame *);
+struct page *frame_page (struct frame *);
+void frame_link (struct frame *, struct page *, uint64_t *pml4);
+size_t frame_unlink (struct frame *, struct page *);
+void frame_unpin (struct frame *);
+struct frame *frame_pin_victim (void);
+struct frame *frame_pin_page (struct page *);
+bool frame_wait_page (struct page *);
+void frame_evicted (struct frame *);
+void frame_index_text (struct frame *, struct inode *, off_t ofs,
+		size_t read_bytes);
+struct frame *frame_pin_text (struct inode *, off_t ofs, size_t read_bytes);
+size_t frame_text_size (void);
+
+#endif /* vm/frame.h */
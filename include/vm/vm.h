@@ -1,7 +1,10 @@
 #ifndef VM_VM_H
 #define VM_VM_H
+#include <list.h>
+#include <rhash.h>
 #include <stdbool.h>
 #include "threads/palloc.h"
+#include "threads/pte.h"
 
 enum vm_type {
 	/* page not initialized */
@@ -27,6 +30,8 @@ enum vm_type {
 #include "vm/uninit.h"
 #include "vm/anon.h"
 #include "vm/file.h"
+#include "vm/vma.h"
+#include "vm/frame.h"
 #ifdef EFILESYS
 #include "filesys/page_cache.h"
 #endif
@@ -36,6 +41,13 @@ struct thread;
 
 #define VM_TYPE(type) ((type) & 7)
 
+/* Largest the user stack may grow to. */
+#define STACK_MAX (1 << 20)
+
+/* Transparent huge pages: one PDE maps HPAGE_SIZE bytes. */
+#define HPAGE_SIZE PDE_PGSIZE
+#define HPAGE_PAGES (HPAGE_SIZE / PGSIZE)
+
 /* The representation of "page".
  * This is kind of "parent class", which has four "child class"es, which are
  * uninit_page, file_page, anon_page, and page cache (project4).
@@ -46,6 +58,10 @@ struct page {
 	struct frame *frame;   /* Back reference for frame */
 
 	/* Your implementation */
+	bool writable;         /* May the user process write to it? */
+	unsigned long ghost;   /* 2Q: when last evicted from A1in, or 0. */
+	uint64_t *pml4;        /* Page table that maps it, while resident. */
+	struct list_elem frame_elem;  /* In FRAME's list of pages. */
 
 	/* Per-type data are binded into the union.
 	 * Each function automatically detects the current union */
@@ -59,10 +75,25 @@ struct page {
 	};
 };
 
-/* The representation of "frame" */
+/* The representation of "frame".  See frame.c. */
 struct frame {
 	void *kva;
-	struct page *page;
+	struct list pages;           /* Pages it holds, one per process. */
+	size_t page_cnt;             /* Length of PAGES: more than 1 if shared. */
+
+	bool pinned;                 /* Taken off the policy's queues? */
+	struct rhash_elem kva_elem;  /* In the frame table, by KVA. */
+
+	/* Executable text it holds, if in the text index. */
+	struct rhash_elem text_elem; /* In the text index. */
+	struct inode *inode;         /* Executable, or null if not indexed. */
+	off_t ofs;                   /* Offset of the page in it. */
+	size_t read_bytes;           /* Bytes of the page read from there. */
+
+	/* Owned by the eviction policy. */
+	struct list_elem elem;       /* In one of its queues. */
+	uint8_t queue;               /* Which one. */
+	uint8_t age;                 /* Aging counter. */
 };
 
 /* The function table for page operations.
@@ -81,12 +112,28 @@ struct page_operations {
 #define destroy(page) \
 	if ((page)->operations->destroy) (page)->operations->destroy (page)
 
-/* Representation of current process's memory space.
- * We don't want to force you to obey any specific design for this struct.
- * All designs up to you for this. */
+/* Representation of current process's memory space: the areas it
+ * may use (see vma.h) and the pages it has in them.
+ *
+ * The pages are in a radix tree keyed by user virtual address with
+ * the same shape as the x86-64 page table: four levels of
+ * SPT_FANOUT-entry nodes, indexed by the PML4, PDPE, PDX and PTX
+ * fields of the address, whose leaves point to struct pages.  See
+ * vm.c. */
+#define SPT_LEVELS 4
+#define SPT_FANOUT 512
+
 struct supplemental_page_table {
+	void **root;           /* Top-level node, or null if empty. */
+	size_t page_cnt;       /* Number of pages in the table. */
+	size_t node_cnt;       /* Number of nodes, at one page each. */
+	struct vma_tree vmas;  /* Areas of the address space. */
 };
 
+/* Performs some operation on PAGE, given auxiliary data AUX.
+ * Returns false to stop an iteration early. */
+typedef bool spt_action_func (struct page *page, void *aux);
+
 #include "threads/thread.h"
 void supplemental_page_table_init (struct supplemental_page_table *spt);
 bool supplemental_page_table_copy (struct supplemental_page_table *dst,
@@ -96,6 +143,8 @@ struct page *spt_find_page (struct supplemental_page_table *spt,
 		void *va);
 bool spt_insert_page (struct supplemental_page_table *spt, struct page *page);
 void spt_remove_page (struct supplemental_page_table *spt, struct page *page);
+bool spt_for_each (struct supplemental_page_table *spt,
+		spt_action_func *action, void *aux);
 
 void vm_init (void);
 bool vm_try_handle_fault (struct intr_frame *f, void *addr, bool user,
@@ -109,4 +158,12 @@ void vm_dealloc_page (struct page *page);
 bool vm_claim_page (void *va);
 enum vm_type page_get_type (struct page *page);
 
+/* Pages in a fault-around window, see vm.c. */
+extern size_t vm_fault_around;
+
+void *vm_get_huge_frame (void);
+bool vm_map_huge_page (void *upage, void *kpage, bool writable);
+bool vm_split_huge_page (void *uaddr);
+void vm_print_stats (void);
+
 #endif  /* VM_VM_H */
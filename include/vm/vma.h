@@ -0,0 +1,46 @@
+#ifndef VM_VMA_H
+#define VM_VMA_H
+#include <rbtree.h>
+#include <stdbool.h>
+#include "filesys/off_t.h"
+
+struct file;
+
+/* What a virtual memory area holds. */
+enum vma_type {
+	VMA_SEGMENT,           /* Part of the executable's image. */
+	VMA_STACK,             /* The user stack, grown on demand. */
+	VMA_MMAP,              /* A file mapped with mmap(). */
+};
+
+/* A virtual memory area: a page-aligned range [start, end) of user
+ * address space with uniform permissions and backing. */
+struct vma {
+	struct rb_node node;   /* Element in a vma_tree. */
+	void *start;           /* First address. */
+	void *end;             /* One past the last address. */
+	enum vma_type type;
+	bool writable;
+
+	/* VMA_MMAP only. */
+	struct file *file;     /* Mapped file, reopened for this area. */
+	off_t offset;          /* Offset in FILE of START. */
+	size_t length;         /* Bytes of FILE mapped. */
+};
+
+/* A process's areas, which never overlap, ordered by address. */
+struct vma_tree {
+	struct rb_tree tree;
+};
+
+void vma_tree_init (struct vma_tree *);
+bool vma_tree_copy (struct vma_tree *dst, struct vma_tree *src);
+void vma_tree_kill (struct vma_tree *);
+
+struct vma *vma_create (struct vma_tree *, void *start, void *end,
+		enum vma_type, bool writable);
+void vma_destroy (struct vma_tree *, struct vma *);
+struct vma *vma_find (struct vma_tree *, const void *addr);
+bool vma_overlaps (struct vma_tree *, const void *start, const void *end);
+
+#endif /* vm/vma.h */
@@ -4,6 +4,7 @@
 #include <round.h>
 #include <stdio.h>
 #include "threads/malloc.h"
+#include "threads/vmalloc.h"
 #ifdef FILESYS
 #include "filesys/file.h"
 #endif
@@ -62,6 +63,73 @@ last_mask (const struct bitmap *b) {
 	int last_bits = b->bit_cnt % ELEM_BITS;
 	return last_bits ? ((elem_type) 1 << last_bits) - 1 : (elem_type) -1;
 }
+
+/* Multiple-bit operations work an element at a time.  A range of
+   bits covers a partial element at either end and whole elements
+   in between; range_mask() gives the bits of the range that fall
+   in one element. */
+
+/* Returns an elem_type with the bits of the element at ELEM_IDX
+   that lie in [START, END) turned on. */
+static inline elem_type
+range_mask (size_t elem_idx, size_t start, size_t end) {
+	size_t first = elem_idx * ELEM_BITS;
+	elem_type mask = (elem_type) -1;
+
+	if (start > first)
+		mask &= (elem_type) -1 << (start - first);
+	if (end < first + ELEM_BITS)
+		mask &= ((elem_type) 1 << (end - first)) - 1;
+	return mask;
+}
+
+/* Returns the number of bits set in X.  (__builtin_popcountl()
+   would need libgcc, which the kernel does not link.) */
+static inline unsigned
+popcount (elem_type x) {
+	x = x - ((x >> 1) & 0x5555555555555555UL);
+	x = (x & 0x3333333333333333UL) + ((x >> 2) & 0x3333333333333333UL);
+	x = (x + (x >> 4)) & 0x0f0f0f0f0f0f0f0fUL;
+	return (x * 0x0101010101010101UL) >> 56;
+}
+
+/* Returns the index of the lowest bit set in X, which must be
+   nonzero. */
+static inline unsigned
+lowest_bit (elem_type x) {
+	return __builtin_ctzl (x);
+}
+
+/* Returns the element at ELEM_IDX in B, inverted unless VALUE is
+   true, so that the bits set to VALUE are the ones turned on. */
+static inline elem_type
+elem_value (const struct bitmap *b, size_t elem_idx, bool value) {
+	return value ? b->bits[elem_idx] : ~b->bits[elem_idx];
+}
+
+/* Returns the index of the first bit in B at or after START that
+   is set to VALUE, or B's size if there is none. */
+static size_t
+find_next (const struct bitmap *b, size_t start, bool value) {
+	size_t idx = elem_idx (start);
+	size_t end_idx = elem_cnt (b->bit_cnt);
+	elem_type e;
+	size_t bit;
+
+	if (start >= b->bit_cnt)
+		return b->bit_cnt;
+	e = elem_value (b, idx, value) & range_mask (idx, start, b->bit_cnt);
+	while (e == 0) {
+		if (++idx >= end_idx)
+			return b->bit_cnt;
+		e = elem_value (b, idx, value);
+	}
+
+	/* Padding bits past the end of B may turn up in the last
+	   element. */
+	bit = idx * ELEM_BITS + lowest_bit (e);
+	return bit < b->bit_cnt ? bit : b->bit_cnt;
+}
 
 /* Creation and destruction. */
 
@@ -74,7 +142,7 @@ bitmap_create (size_t bit_cnt) {
 	struct bitmap *b = malloc (sizeof *b);
 	if (b != NULL) {
 		b->bit_cnt = bit_cnt;
-		b->bits = malloc (byte_cnt (bit_cnt));
+		b->bits = kvmalloc (byte_cnt (bit_cnt));
 		if (b->bits != NULL || bit_cnt == 0) {
 			bitmap_set_all (b, false);
 			return b;
@@ -112,7 +180,7 @@ bitmap_buf_size (size_t bit_cnt) {
 void
 bitmap_destroy (struct bitmap *b) {
 	if (b != NULL) {
-		free (b->bits);
+		kvfree (b->bits);
 		free (b);
 	}
 }
@@ -194,33 +262,46 @@ bitmap_set_all (struct bitmap *b, bool value) {
 	bitmap_set_multiple (b, 0, bitmap_size (b), value);
 }
 
-/* Sets the CNT bits starting at START in B to VALUE. */
+/* Sets the CNT bits starting at START in B to VALUE.  Each
+   element is updated atomically, like a single bit. */
 void
 bitmap_set_multiple (struct bitmap *b, size_t start, size_t cnt, bool value) {
-	size_t i;
+	size_t end = start + cnt;
+	size_t idx;
 
 	ASSERT (b != NULL);
 	ASSERT (start <= b->bit_cnt);
 	ASSERT (start + cnt <= b->bit_cnt);
 
-	for (i = 0; i < cnt; i++)
-		bitmap_set (b, start + i, value);
+	if (cnt == 0)
+		return;
+	for (idx = elem_idx (start); idx <= elem_idx (end - 1); idx++) {
+		elem_type mask = range_mask (idx, start, end);
+
+		if (value)
+			asm ("lock orq %1, %0" : "=m" (b->bits[idx]) : "r" (mask) : "cc");
+		else
+			asm ("lock andq %1, %0" : "=m" (b->bits[idx]) : "r" (~mask) : "cc");
+	}
 }
 
 /* Returns the number of bits in B between START and START + CNT,
    exclusive, that are set to VALUE. */
 size_t
 bitmap_count (const struct bitmap *b, size_t start, size_t cnt, bool value) {
-	size_t i, value_cnt;
+	size_t end = start + cnt;
+	size_t idx, value_cnt;
 
 	ASSERT (b != NULL);
 	ASSERT (start <= b->bit_cnt);
 	ASSERT (start + cnt <= b->bit_cnt);
 
 	value_cnt = 0;
-	for (i = 0; i < cnt; i++)
-		if (bitmap_test (b, start + i) == value)
-			value_cnt++;
+	if (cnt == 0)
+		return 0;
+	for (idx = elem_idx (start); idx <= elem_idx (end - 1); idx++)
+		value_cnt += popcount (elem_value (b, idx, value)
+				& range_mask (idx, start, end));
 	return value_cnt;
 }
 
@@ -228,14 +309,17 @@ bitmap_count (const struct bitmap *b, size_t start, size_t cnt, bool value) {
    exclusive, are set to VALUE, and false otherwise. */
 bool
 bitmap_contains (const struct bitmap *b, size_t start, size_t cnt, bool value) {
-	size_t i;
+	size_t end = start + cnt;
+	size_t idx;
 
 	ASSERT (b != NULL);
 	ASSERT (start <= b->bit_cnt);
 	ASSERT (start + cnt <= b->bit_cnt);
 
-	for (i = 0; i < cnt; i++)
-		if (bitmap_test (b, start + i) == value)
+	if (cnt == 0)
+		return false;
+	for (idx = elem_idx (start); idx <= elem_idx (end - 1); idx++)
+		if (elem_value (b, idx, value) & range_mask (idx, start, end))
 			return true;
 	return false;
 }
@@ -266,18 +350,35 @@ bitmap_all (const struct bitmap *b, size_t start, size_t cnt) {
 /* Finds and returns the starting index of the first group of CNT
    consecutive bits in B at or after START that are all set to
    VALUE.
-   If there is no such group, returns BITMAP_ERROR. */
+   If there is no such group, returns BITMAP_ERROR.
+
+   Hops from run to run: finds the next bit set to VALUE, then the
+   next bit after it that is not, and stops if the run between them
+   is long enough.  Both searches skip whole elements at a time, so
+   the cost grows with the number of elements and runs, not with
+   the number of bits times CNT. */
 size_t
 bitmap_scan (const struct bitmap *b, size_t start, size_t cnt, bool value) {
 	ASSERT (b != NULL);
 	ASSERT (start <= b->bit_cnt);
 
-	if (cnt <= b->bit_cnt) {
-		size_t last = b->bit_cnt - cnt;
-		size_t i;
-		for (i = start; i <= last; i++)
-			if (!bitmap_contains (b, i, cnt, !value))
-				return i;
+	if (cnt > b->bit_cnt)
+		return BITMAP_ERROR;
+	if (cnt == 0)
+		return start;
+
+	while (start + cnt <= b->bit_cnt) {
+		size_t run_start = find_next (b, start, value);
+		size_t run_end;
+
+		if (run_start + cnt > b->bit_cnt)
+			break;
+		if (cnt == 1)
+			return run_start;
+		run_end = find_next (b, run_start + 1, !value);
+		if (run_end - run_start >= cnt)
+			return run_start;
+		start = run_end;
 	}
 	return BITMAP_ERROR;
 }
@@ -0,0 +1,486 @@
+/* Red-black tree.
+
+   See rbtree.h for basic information.
+
+   A red-black tree is a binary search tree whose nodes are
+   colored so that no red node has a red child and every path
+   from a node down to a missing child passes through the same
+   number of black nodes.  Together these keep the longest path
+   at most twice the shortest, so the height is O(log n).
+   Insertion and deletion repair the coloring with at most three
+   rotations plus O(log n) recolorings, following Cormen et al.,
+   _Introduction to Algorithms_, chapter 13.  Missing children
+   are null pointers, not a shared sentinel, so nodes in
+   different trees never touch common memory.
+
+   Augmentation.  A rotation changes the subtrees of only the two
+   nodes rotated, so rotate_left() and rotate_right() recompute
+   just those two, lower one first.  Linking in or unlinking a
+   node changes the subtree of every ancestor of the change, so
+   rb_insert() and rb_erase() recompute that path up to the root
+   before rebalancing.  Each costs O(log n) calls to the
+   augmentation function.
+
+   For example, an interval tree ordered by start address can
+   find any interval overlapping [START, END):
+
+     struct range {
+       struct rb_node node;
+       uintptr_t start, end;
+       uintptr_t max_end;       // Largest END in this subtree.
+     };
+
+     static void
+     range_augment (struct rb_node *n, void *aux UNUSED) {
+       struct range *r = rb_entry (n, struct range, node);
+       r->max_end = r->end;
+       if (n->left != NULL)
+         r->max_end = MAX (r->max_end, MAX_END (n->left));
+       if (n->right != NULL)
+         r->max_end = MAX (r->max_end, MAX_END (n->right));
+     }
+
+   and a query descends left whenever the left subtree's max_end
+   is above START, otherwise checks the node itself and goes
+   right, giving up once a node starts at or after END.  The test
+   in tests/internal/rbtree.c does exactly this. */
+
+#include "rbtree.h"
+#include "../debug.h"
+
+static void set_child (struct rb_tree *, struct rb_node *parent,
+		struct rb_node *old, struct rb_node *new);
+static void rotate_left (struct rb_tree *, struct rb_node *);
+static void rotate_right (struct rb_tree *, struct rb_node *);
+static void insert_fixup (struct rb_tree *, struct rb_node *);
+static void erase_fixup (struct rb_tree *, struct rb_node *,
+		struct rb_node *parent);
+static struct rb_node *leftmost (struct rb_node *);
+static struct rb_node *rightmost (struct rb_node *);
+
+/* Initializes TREE as an empty tree that compares nodes using
+   LESS and, if AUGMENT is non-null, maintains augmented data
+   using AUGMENT, given auxiliary data AUX. */
+void
+rb_init (struct rb_tree *tree,
+		rb_less_func *less, rb_augment_func *augment, void *aux) {
+	ASSERT (tree != NULL);
+	ASSERT (less != NULL);
+
+	tree->root = NULL;
+	tree->node_cnt = 0;
+	tree->less = less;
+	tree->augment = augment;
+	tree->aux = aux;
+}
+
+/* Removes all the nodes from TREE.
+
+   If DESTRUCTOR is non-null, then it is called for each node in
+   the tree, children before parents, after the node has been
+   unlinked.  DESTRUCTOR may, if appropriate, deallocate the
+   memory used by the node.  Modifying TREE in DESTRUCTOR yields
+   undefined behavior.  Takes O(n) time and no extra memory. */
+void
+rb_clear (struct rb_tree *tree, rb_action_func *destructor) {
+	struct rb_node *n = tree->root;
+
+	tree->root = NULL;
+	tree->node_cnt = 0;
+	if (destructor == NULL)
+		return;
+
+	while (n != NULL) {
+		if (n->left != NULL)
+			n = n->left;
+		else if (n->right != NULL)
+			n = n->right;
+		else {
+			struct rb_node *parent = n->parent;
+
+			if (parent != NULL) {
+				if (parent->left == n)
+					parent->left = NULL;
+				else
+					parent->right = NULL;
+			}
+			destructor (n, tree->aux);
+			n = parent;
+		}
+	}
+}
+
+/* Inserts NODE into TREE.  If nodes equal to NODE are already in
+   the tree, NODE goes after all of them. */
+void
+rb_insert (struct rb_tree *tree, struct rb_node *node) {
+	struct rb_node *parent = NULL;
+	struct rb_node **link = &tree->root;
+
+	ASSERT (node != NULL);
+
+	while (*link != NULL) {
+		parent = *link;
+		if (tree->less (node, parent, tree->aux))
+			link = &parent->left;
+		else
+			link = &parent->right;
+	}
+
+	node->parent = parent;
+	node->left = node->right = NULL;
+	node->red = true;
+	*link = node;
+	tree->node_cnt++;
+
+	rb_augment_path (tree, node);
+	insert_fixup (tree, node);
+}
+
+/* Removes NODE, which must be in TREE, from TREE. */
+void
+rb_erase (struct rb_tree *tree, struct rb_node *node) {
+	struct rb_node *child, *parent;
+	bool removed_red;
+
+	ASSERT (node != NULL);
+	ASSERT (tree->node_cnt > 0);
+
+	if (node->left == NULL || node->right == NULL) {
+		/* At most one child: splice NODE out. */
+		child = node->left != NULL ? node->left : node->right;
+		parent = node->parent;
+		removed_red = node->red;
+		set_child (tree, parent, node, child);
+		if (child != NULL)
+			child->parent = parent;
+	} else {
+		/* Two children: move NODE's successor, which has no left
+		   child, into NODE's place. */
+		struct rb_node *next = leftmost (node->right);
+
+		removed_red = next->red;
+		child = next->right;
+		if (next->parent == node)
+			parent = next;
+		else {
+			parent = next->parent;
+			parent->left = child;
+			if (child != NULL)
+				child->parent = parent;
+			next->right = node->right;
+			next->right->parent = next;
+		}
+		next->left = node->left;
+		next->left->parent = next;
+		next->parent = node->parent;
+		next->red = node->red;
+		set_child (tree, node->parent, node, next);
+	}
+	tree->node_cnt--;
+
+	rb_augment_path (tree, parent);
+	if (!removed_red)
+		erase_fixup (tree, child, parent);
+}
+
+/* Returns a node in TREE equal to KEY, or a null pointer if no
+   equal node exists.  If there are several, returns the first. */
+struct rb_node *
+rb_find (struct rb_tree *tree, const struct rb_node *key) {
+	struct rb_node *n = rb_lower_bound (tree, key);
+
+	if (n != NULL && !tree->less (key, n, tree->aux))
+		return n;
+	return NULL;
+}
+
+/* Returns the first node in TREE that is not less than KEY, or a
+   null pointer if every node is less than KEY. */
+struct rb_node *
+rb_lower_bound (struct rb_tree *tree, const struct rb_node *key) {
+	struct rb_node *result = NULL;
+	struct rb_node *n = tree->root;
+
+	while (n != NULL)
+		if (tree->less (n, key, tree->aux))
+			n = n->right;
+		else {
+			result = n;
+			n = n->left;
+		}
+	return result;
+}
+
+/* Returns the first node in TREE that is greater than KEY, or a
+   null pointer if no node is greater than KEY. */
+struct rb_node *
+rb_upper_bound (struct rb_tree *tree, const struct rb_node *key) {
+	struct rb_node *result = NULL;
+	struct rb_node *n = tree->root;
+
+	while (n != NULL)
+		if (tree->less (key, n, tree->aux)) {
+			result = n;
+			n = n->left;
+		} else
+			n = n->right;
+	return result;
+}
+
+/* Recomputes the augmented data of NODE, which is in TREE, and of
+   each of its ancestors.  Does nothing if TREE is not augmented
+   or NODE is null.  Call it after changing, in place, the data
+   that NODE contributes to its subtree. */
+void
+rb_augment_path (struct rb_tree *tree, struct rb_node *node) {
+	if (tree->augment == NULL)
+		return;
+	for (; node != NULL; node = node->parent)
+		tree->augment (node, tree->aux);
+}
+
+/* Returns the least node in TREE, or a null pointer if TREE is
+   empty. */
+struct rb_node *
+rb_first (struct rb_tree *tree) {
+	return tree->root != NULL ? leftmost (tree->root) : NULL;
+}
+
+/* Returns the greatest node in TREE, or a null pointer if TREE is
+   empty. */
+struct rb_node *
+rb_last (struct rb_tree *tree) {
+	return tree->root != NULL ? rightmost (tree->root) : NULL;
+}
+
+/* Returns the node following N in its tree, or a null pointer if
+   N is the last node. */
+struct rb_node *
+rb_next (struct rb_node *n) {
+	ASSERT (n != NULL);
+
+	if (n->right != NULL)
+		return leftmost (n->right);
+	while (n->parent != NULL && n == n->parent->right)
+		n = n->parent;
+	return n->parent;
+}
+
+/* Returns the node preceding N in its tree, or a null pointer if
+   N is the first node. */
+struct rb_node *
+rb_prev (struct rb_node *n) {
+	ASSERT (n != NULL);
+
+	if (n->left != NULL)
+		return rightmost (n->left);
+	while (n->parent != NULL && n == n->parent->left)
+		n = n->parent;
+	return n->parent;
+}
+
+/* Returns the number of nodes in TREE. */
+size_t
+rb_size (struct rb_tree *tree) {
+	return tree->node_cnt;
+}
+
+/* Returns true if TREE contains no nodes, false otherwise. */
+bool
+rb_empty (struct rb_tree *tree) {
+	return tree->root == NULL;
+}
+
+/* Makes NEW take OLD's place as a child of PARENT, or as the root
+   of TREE if PARENT is null.  Does not update NEW->parent. */
+static void
+set_child (struct rb_tree *tree, struct rb_node *parent,
+		struct rb_node *old, struct rb_node *new) {
+	if (parent == NULL)
+		tree->root = new;
+	else if (parent->left == old)
+		parent->left = new;
+	else
+		parent->right = new;
+}
+
+/* Rotates X's right child Y up into X's place, making X Y's left
+   child. */
+static void
+rotate_left (struct rb_tree *tree, struct rb_node *x) {
+	struct rb_node *y = x->right;
+
+	x->right = y->left;
+	if (y->left != NULL)
+		y->left->parent = x;
+	y->parent = x->parent;
+	set_child (tree, x->parent, x, y);
+	y->left = x;
+	x->parent = y;
+
+	if (tree->augment != NULL) {
+		tree->augment (x, tree->aux);
+		tree->augment (y, tree->aux);
+	}
+}
+
+/* Rotates X's left child Y up into X's place, making X Y's right
+   child. */
+static void
+rotate_right (struct rb_tree *tree, struct rb_node *x) {
+	struct rb_node *y = x->left;
+
+	x->left = y->right;
+	if (y->right != NULL)
+		y->right->parent = x;
+	y->parent = x->parent;
+	set_child (tree, x->parent, x, y);
+	y->right = x;
+	x->parent = y;
+
+	if (tree->augment != NULL) {
+		tree->augment (x, tree->aux);
+		tree->augment (y, tree->aux);
+	}
+}
+
+/* Restores the red-black properties after red node N has been
+   linked into TREE. */
+static void
+insert_fixup (struct rb_tree *tree, struct rb_node *n) {
+	struct rb_node *parent;
+
+	while ((parent = n->parent) != NULL && parent->red) {
+		/* A red node is never the root, so GRANDPARENT exists. */
+		struct rb_node *grandparent = parent->parent;
+
+		if (parent == grandparent->left) {
+			struct rb_node *uncle = grandparent->right;
+
+			if (uncle != NULL && uncle->red) {
+				parent->red = uncle->red = false;
+				grandparent->red = true;
+				n = grandparent;
+				continue;
+			}
+			if (n == parent->right) {
+				rotate_left (tree, parent);
+				n = parent;
+				parent = n->parent;
+			}
+			parent->red = false;
+			grandparent->red = true;
+			rotate_right (tree, grandparent);
+		} else {
+			struct rb_node *uncle = grandparent->left;
+
+			if (uncle != NULL && uncle->red) {
+				parent->red = uncle->red = false;
+				grandparent->red = true;
+				n = grandparent;
+				continue;
+			}
+			if (n == parent->left) {
+				rotate_right (tree, parent);
+				n = parent;
+				parent = n->parent;
+			}
+			parent->red = false;
+			grandparent->red = true;
+			rotate_left (tree, grandparent);
+		}
+	}
+	tree->root->red = false;
+}
+
+/* Returns true if N is a red node, false if it is black or
+   null. */
+static inline bool
+is_red (const struct rb_node *n) {
+	return n != NULL && n->red;
+}
+
+/* Restores the red-black properties after a black node has been
+   removed from TREE.  X, which may be null, is the child of
+   PARENT that took the removed node's place and is one black node
+   short on every path through it. */
+static void
+erase_fixup (struct rb_tree *tree, struct rb_node *x,
+		struct rb_node *parent) {
+	while (x != tree->root && !is_red (x)) {
+		/* X is one black short, so its sibling W has at least one
+		   black node below PARENT and cannot be null. */
+		if (x == parent->left) {
+			struct rb_node *w = parent->right;
+
+			if (w->red) {
+				w->red = false;
+				parent->red = true;
+				rotate_left (tree, parent);
+				w = parent->right;
+			}
+			if (!is_red (w->left) && !is_red (w->right)) {
+				w->red = true;
+				x = parent;
+				parent = x->parent;
+			} else {
+				if (!is_red (w->right)) {
+					w->left->red = false;
+					w->red = true;
+					rotate_right (tree, w);
+					w = parent->right;
+				}
+				w->red = parent->red;
+				parent->red = false;
+				w->right->red = false;
+				rotate_left (tree, parent);
+				x = tree->root;
+			}
+		} else {
+			struct rb_node *w = parent->left;
+
+			if (w->red) {
+				w->red = false;
+				parent->red = true;
+				rotate_right (tree, parent);
+				w = parent->left;
+			}
+			if (!is_red (w->left) && !is_red (w->right)) {
+				w->red = true;
+				x = parent;
+				parent = x->parent;
+			} else {
+				if (!is_red (w->left)) {
+					w->right->red = false;
+					w->red = true;
+					rotate_left (tree, w);
+					w = parent->left;
+				}
+				w->red = parent->red;
+				parent->red = false;
+				w->left->red = false;
+				rotate_right (tree, parent);
+				x = tree->root;
+			}
+		}
+	}
+	if (x != NULL)
+		x->red = false;
+}
+
+/* Returns the least node in the subtree rooted at N. */
+static struct rb_node *
+leftmost (struct rb_node *n) {
+	while (n->left != NULL)
+		n = n->left;
+	return n;
+}
+
+/* Returns the greatest node in the subtree rooted at N. */
+static struct rb_node *
+rightmost (struct rb_node *n) {
+	while (n->right != NULL)
+		n = n->right;
+	return n;
+}
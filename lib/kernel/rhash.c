@@ -0,0 +1,431 @@
+/* Robin Hood hash table.
+
+   See rhash.h for basic information.
+
+   The table is an array of pointers to elements, searched by
+   linear probing.  An element's "probe distance" is how far past
+   its home slot (its hash modulo the array size) it sits.  On
+   insertion, an element that has probed further than the one
+   occupying a slot takes the slot and the displaced element
+   continues probing instead: the rich give to the poor.  This
+   keeps probe distances short and even, so the table stays fast
+   at high load, and a lookup can stop as soon as it meets an
+   element closer to home than the key would be.  Deletion shifts
+   the following elements of the cluster back a slot instead of
+   leaving a tombstone.
+
+   Each element caches its hash value, so probing compares hashes
+   first and calls the comparison function only on a match, and
+   moving an element never calls the hash function.
+
+   When the table is more than MAX_LOAD full, a new array of twice
+   the size is allocated and insertions go there.  The old array
+   is drained a cluster at a time, at least DRAIN_SLOTS slots per
+   insertion or deletion, and lookups search both arrays until it
+   is empty.  A cluster is a run of full slots between empty ones,
+   and no element's probe sequence crosses an empty slot, so
+   draining whole clusters leaves the rest of the old array
+   searchable.  Draining takes at most 1/DRAIN_SLOTS as many
+   operations as the old array has slots, so the new array is
+   still under half full when the old one is gone, well before it
+   needs to grow in turn. */
+
+#include "rhash.h"
+#include "../debug.h"
+#include "threads/vmalloc.h"
+
+/* Size of a new table. */
+#define MIN_SLOTS 8
+
+/* Grow when more than MAX_LOAD_NUM/MAX_LOAD_DEN of slots are full. */
+#define MAX_LOAD_NUM 7
+#define MAX_LOAD_DEN 8
+
+/* Slots of the old array drained per insertion or deletion. */
+#define DRAIN_SLOTS 16
+
+/* Returned by find_slot() when the element is absent. */
+#define NO_SLOT ((size_t) -1)
+
+static size_t find_slot (struct rhash *, struct rhash_elem **slots,
+		size_t slot_cnt, const struct rhash_elem *, uint64_t hash);
+static void insert_slot (struct rhash_elem **slots, size_t slot_cnt,
+		struct rhash_elem *);
+static void delete_slot (struct rhash_elem **slots, size_t slot_cnt,
+		size_t idx);
+static void drain (struct rhash *, size_t slot_cnt);
+static void maybe_grow (struct rhash *);
+
+/* Initializes hash table H to compute hash values using HASH and
+   compare hash elements using LESS, given auxiliary data AUX.
+   Returns true if successful, false if memory is not
+   available. */
+bool
+rhash_init (struct rhash *h,
+		rhash_hash_func *hash, rhash_less_func *less, void *aux) {
+	h->elem_cnt = 0;
+	h->slot_cnt = MIN_SLOTS;
+	h->slots = kvcalloc (h->slot_cnt, sizeof *h->slots);
+	h->old_slot_cnt = 0;
+	h->old_slots = NULL;
+	h->old_idx = h->old_left = 0;
+	h->hash = hash;
+	h->less = less;
+	h->aux = aux;
+	return h->slots != NULL;
+}
+
+/* Removes all the elements from H.
+
+   If DESTRUCTOR is non-null, then it is called for each element
+   in the hash.  DESTRUCTOR may, if appropriate, deallocate the
+   memory used by the hash element.  However, modifying hash
+   table H while rhash_clear() is running, using any of the
+   functions rhash_clear(), rhash_destroy(), rhash_insert(),
+   rhash_replace(), or rhash_delete(), yields undefined behavior,
+   whether done in DESTRUCTOR or elsewhere. */
+void
+rhash_clear (struct rhash *h, rhash_action_func *destructor) {
+	size_t i;
+
+	if (destructor != NULL)
+		rhash_apply (h, destructor);
+
+	for (i = 0; i < h->slot_cnt; i++)
+		h->slots[i] = NULL;
+	kvfree (h->old_slots);
+	h->old_slots = NULL;
+	h->old_slot_cnt = h->old_idx = h->old_left = 0;
+	h->elem_cnt = 0;
+}
+
+/* Destroys hash table H.
+
+   If DESTRUCTOR is non-null, then it is first called for each
+   element in the hash, with the same restrictions as in
+   rhash_clear(). */
+void
+rhash_destroy (struct rhash *h, rhash_action_func *destructor) {
+	if (destructor != NULL)
+		rhash_apply (h, destructor);
+	kvfree (h->old_slots);
+	kvfree (h->slots);
+}
+
+/* Inserts NEW into hash table H and returns a null pointer, if
+   no equal element is already in the table.
+   If an equal element is already in the table, returns it
+   without inserting NEW.
+
+   Panics if the table is full and cannot grow for lack of
+   memory. */
+struct rhash_elem *
+rhash_insert (struct rhash *h, struct rhash_elem *new) {
+	struct rhash_elem *old = rhash_find (h, new);
+
+	if (old == NULL) {
+		maybe_grow (h);
+		insert_slot (h->slots, h->slot_cnt, new);
+		h->elem_cnt++;
+		drain (h, DRAIN_SLOTS);
+	}
+	return old;
+}
+
+/* Inserts NEW into hash table H, replacing any equal element
+   already in the table, which is returned. */
+struct rhash_elem *
+rhash_replace (struct rhash *h, struct rhash_elem *new) {
+	struct rhash_elem *old = rhash_delete (h, new);
+
+	rhash_insert (h, new);
+	return old;
+}
+
+/* Finds and returns an element equal to E in hash table H, or a
+   null pointer if no equal element exists in the table.  Stores
+   E's hash value in E. */
+struct rhash_elem *
+rhash_find (struct rhash *h, struct rhash_elem *e) {
+	size_t idx;
+
+	e->hash = h->hash (e, h->aux);
+	idx = find_slot (h, h->slots, h->slot_cnt, e, e->hash);
+	if (idx != NO_SLOT)
+		return h->slots[idx];
+	if (h->old_slots != NULL) {
+		idx = find_slot (h, h->old_slots, h->old_slot_cnt, e, e->hash);
+		if (idx != NO_SLOT)
+			return h->old_slots[idx];
+	}
+	return NULL;
+}
+
+/* Finds, removes, and returns an element equal to E in hash
+   table H.  Returns a null pointer if no equal element existed
+   in the table.
+
+   If the elements of the hash table are dynamically allocated,
+   or own resources that are, then it is the caller's
+   responsibility to deallocate them. */
+struct rhash_elem *
+rhash_delete (struct rhash *h, struct rhash_elem *e) {
+	struct rhash_elem *found = NULL;
+	size_t idx;
+
+	e->hash = h->hash (e, h->aux);
+	idx = find_slot (h, h->slots, h->slot_cnt, e, e->hash);
+	if (idx != NO_SLOT) {
+		found = h->slots[idx];
+		delete_slot (h->slots, h->slot_cnt, idx);
+	} else if (h->old_slots != NULL) {
+		idx = find_slot (h, h->old_slots, h->old_slot_cnt, e, e->hash);
+		if (idx != NO_SLOT) {
+			found = h->old_slots[idx];
+			delete_slot (h->old_slots, h->old_slot_cnt, idx);
+		}
+	}
+
+	if (found != NULL) {
+		h->elem_cnt--;
+		drain (h, DRAIN_SLOTS);
+	}
+	return found;
+}
+
+/* Calls ACTION for each element in hash table H in arbitrary
+   order.
+   Modifying hash table H while rhash_apply() is running, using
+   any of the functions rhash_clear(), rhash_destroy(),
+   rhash_insert(), rhash_replace(), or rhash_delete(), yields
+   undefined behavior, whether done from ACTION or elsewhere. */
+void
+rhash_apply (struct rhash *h, rhash_action_func *action) {
+	struct rhash_iterator i;
+
+	ASSERT (action != NULL);
+
+	rhash_first (&i, h);
+	while (rhash_next (&i))
+		action (rhash_cur (&i), h->aux);
+}
+
+/* Initializes I for iterating hash table H.
+
+   Iteration idiom:
+
+   struct rhash_iterator i;
+
+   rhash_first (&i, h);
+   while (rhash_next (&i))
+   {
+   struct foo *f = rhash_entry (rhash_cur (&i), struct foo, elem);
+   ...do something with f...
+   }
+
+   Modifying hash table H during iteration, using any of the
+   functions rhash_clear(), rhash_destroy(), rhash_insert(),
+   rhash_replace(), or rhash_delete(), invalidates all
+   iterators. */
+void
+rhash_first (struct rhash_iterator *i, struct rhash *h) {
+	ASSERT (i != NULL);
+	ASSERT (h != NULL);
+
+	i->hash = h;
+	i->in_old = false;
+	i->idx = (size_t) -1;
+	i->elem = NULL;
+}
+
+/* Advances I to the next element in the hash table and returns
+   it.  Returns a null pointer if no elements are left.  Elements
+   are returned in arbitrary order. */
+struct rhash_elem *
+rhash_next (struct rhash_iterator *i) {
+	struct rhash *h;
+
+	ASSERT (i != NULL);
+
+	h = i->hash;
+	for (;;) {
+		struct rhash_elem **slots = i->in_old ? h->old_slots : h->slots;
+		size_t slot_cnt = i->in_old ? h->old_slot_cnt : h->slot_cnt;
+
+		while (++i->idx < slot_cnt)
+			if (slots[i->idx] != NULL)
+				return i->elem = slots[i->idx];
+
+		if (i->in_old || h->old_slots == NULL)
+			return i->elem = NULL;
+		i->in_old = true;
+		i->idx = (size_t) -1;
+	}
+}
+
+/* Returns the current element in the hash table iteration, or a
+   null pointer at the end of the table.  Undefined behavior
+   after calling rhash_first() but before rhash_next(). */
+struct rhash_elem *
+rhash_cur (struct rhash_iterator *i) {
+	return i->elem;
+}
+
+/* Returns the number of elements in H. */
+size_t
+rhash_size (struct rhash *h) {
+	return h->elem_cnt;
+}
+
+/* Returns true if H contains no elements, false otherwise. */
+bool
+rhash_empty (struct rhash *h) {
+	return h->elem_cnt == 0;
+}
+
+/* Returns how far E, in slot IDX of an array whose size minus 1
+   is MASK, is from its home slot. */
+static inline size_t
+probe_dist (const struct rhash_elem *e, size_t idx, size_t mask) {
+	return (idx - (e->hash & mask)) & mask;
+}
+
+/* Searches the SLOT_CNT-slot array SLOTS of H for an element
+   equal to E, whose hash value is HASH.  Returns its slot, or
+   NO_SLOT if there is none. */
+static size_t
+find_slot (struct rhash *h, struct rhash_elem **slots, size_t slot_cnt,
+		const struct rhash_elem *e, uint64_t hash) {
+	size_t mask = slot_cnt - 1;
+	size_t idx = hash & mask;
+	size_t dist;
+
+	for (dist = 0; dist < slot_cnt; dist++, idx = (idx + 1) & mask) {
+		struct rhash_elem *s = slots[idx];
+
+		/* E would have displaced an element closer to home. */
+		if (s == NULL || probe_dist (s, idx, mask) < dist)
+			break;
+		if (s->hash == hash && !h->less (s, e, h->aux)
+				&& !h->less (e, s, h->aux))
+			return idx;
+	}
+	return NO_SLOT;
+}
+
+/* Inserts E, whose hash value is cached, into the SLOT_CNT-slot
+   array SLOTS, which must have an empty slot. */
+static void
+insert_slot (struct rhash_elem **slots, size_t slot_cnt,
+		struct rhash_elem *e) {
+	size_t mask = slot_cnt - 1;
+	size_t idx = e->hash & mask;
+	size_t dist = 0;
+
+	for (;; idx = (idx + 1) & mask, dist++) {
+		struct rhash_elem *s = slots[idx];
+		size_t s_dist;
+
+		if (s == NULL) {
+			slots[idx] = e;
+			return;
+		}
+		s_dist = probe_dist (s, idx, mask);
+		if (s_dist < dist) {
+			/* Take from the rich: E settles here, S moves on. */
+			slots[idx] = e;
+			e = s;
+			dist = s_dist;
+		}
+	}
+}
+
+/* Empties slot IDX of the SLOT_CNT-slot array SLOTS, shifting
+   the rest of its cluster back one slot. */
+static void
+delete_slot (struct rhash_elem **slots, size_t slot_cnt, size_t idx) {
+	size_t mask = slot_cnt - 1;
+
+	for (;;) {
+		size_t next = (idx + 1) & mask;
+		struct rhash_elem *s = slots[next];
+
+		if (s == NULL || probe_dist (s, next, mask) == 0) {
+			slots[idx] = NULL;
+			return;
+		}
+		slots[idx] = s;
+		idx = next;
+	}
+}
+
+/* Moves the elements in at least SLOT_CNT slots of H's old array,
+   if any, to its current array, finishing the last cluster it
+   starts on.  Frees the old array once it is empty. */
+static void
+drain (struct rhash *h, size_t slot_cnt) {
+	size_t mask = h->old_slot_cnt - 1;
+
+	if (h->old_slots == NULL)
+		return;
+
+	while (h->old_left > 0) {
+		struct rhash_elem *e = h->old_slots[h->old_idx];
+
+		/* Only stop between clusters. */
+		if (e == NULL && slot_cnt == 0)
+			break;
+		if (e != NULL) {
+			insert_slot (h->slots, h->slot_cnt, e);
+			h->old_slots[h->old_idx] = NULL;
+		}
+		h->old_idx = (h->old_idx + 1) & mask;
+		h->old_left--;
+		if (slot_cnt > 0)
+			slot_cnt--;
+	}
+
+	if (h->old_left == 0) {
+		kvfree (h->old_slots);
+		h->old_slots = NULL;
+		h->old_slot_cnt = 0;
+	}
+}
+
+/* Starts moving H to an array twice the size if one more
+   element would make it too full.  If there is no room for one
+   more element and memory for a new array is not available,
+   panics. */
+static void
+maybe_grow (struct rhash *h) {
+	struct rhash_elem **slots;
+	size_t i;
+
+	if ((h->elem_cnt + 1) * MAX_LOAD_DEN <= h->slot_cnt * MAX_LOAD_NUM)
+		return;
+
+	/* Growing again before the last growth is done is not expected,
+	   but is harmless: finish the last one first. */
+	if (h->old_slots != NULL)
+		drain (h, h->old_left);
+
+	slots = kvcalloc (h->slot_cnt * 2, sizeof *slots);
+	if (slots == NULL) {
+		/* The table still works, only slower, until it is full. */
+		if (h->elem_cnt + 1 > h->slot_cnt)
+			PANIC ("rhash: out of memory");
+		return;
+	}
+
+	h->old_slots = h->slots;
+	h->old_slot_cnt = h->slot_cnt;
+	h->slots = slots;
+	h->slot_cnt *= 2;
+
+	/* Start draining at an empty slot, so that clusters are never
+	   split.  One exists because the table was not full. */
+	for (i = 0; h->old_slots[i] != NULL; i++)
+		continue;
+	h->old_idx = i;
+	h->old_left = h->old_slot_cnt;
+}
@@ -1,5 +1,83 @@
 #include <string.h>
 #include <debug.h>
+#include <stdint.h>
+
+/* The block functions below, and strlen(), work a 64-bit word at
+   a time instead of a byte at a time once a block is big enough.
+   x86-64 handles unaligned words in hardware, but stores are
+   still aligned first because a store that straddles a cache
+   line costs double.  Searches test a whole word for the byte
+   they look for with the usual bit trick (see HAS_ZERO).
+
+   Copies and fills of REP_MIN bytes or more use `rep movsb' and
+   `rep stosb', which processors with "fast strings" execute a
+   cache line at a time, faster than any loop we could write.
+
+   There are no SIMD versions: kernel and user programs are both
+   built with -mno-sse, and the kernel does not save SSE state
+   across context switches, so no code may assume the XMM
+   registers are its own. */
+
+/* A machine word that may be accessed at any alignment and may
+   alias any other type. */
+typedef uint64_t word_t __attribute__ ((may_alias, aligned (1)));
+#define WORD sizeof (word_t)
+
+/* Every byte 0x01, and every byte 0x80. */
+#define ONES 0x0101010101010101ULL
+#define HIGHS 0x8080808080808080ULL
+
+/* Nonzero if some byte of word W is zero.  The lowest set bit is
+   in the first zero byte; bits above it may be spurious. */
+#define HAS_ZERO(W) (((W) - ONES) & ~(W) & HIGHS)
+
+/* Smallest block worth a `rep movsb' or `rep stosb'. */
+#define REP_MIN 256
+
+/* Returns the index of the first zero byte in W, which must have
+   one. */
+static inline size_t
+first_zero_byte (uint64_t w) {
+	return __builtin_ctzll (HAS_ZERO (w)) / 8;
+}
+
+/* Copies SIZE bytes from SRC to DST in ascending order, which is
+   safe even if they overlap with DST below SRC. */
+static void
+copy_forward (unsigned char *dst, const unsigned char *src, size_t size) {
+	if (size >= REP_MIN) {
+		asm volatile ("rep movsb"
+				: "+D" (dst), "+S" (src), "+c" (size) : : "memory");
+		return;
+	}
+	if (size >= WORD) {
+		for (; (uintptr_t) dst % WORD != 0; size--)
+			*dst++ = *src++;
+		for (; size >= WORD; size -= WORD, dst += WORD, src += WORD)
+			*(word_t *) dst = *(const word_t *) src;
+	}
+	while (size-- > 0)
+		*dst++ = *src++;
+}
+
+/* Copies SIZE bytes from SRC to DST in descending order, which is
+   safe even if they overlap with DST above SRC. */
+static void
+copy_backward (unsigned char *dst, const unsigned char *src, size_t size) {
+	dst += size;
+	src += size;
+	if (size >= WORD) {
+		for (; (uintptr_t) dst % WORD != 0; size--)
+			*--dst = *--src;
+		for (; size >= WORD; size -= WORD) {
+			dst -= WORD;
+			src -= WORD;
+			*(word_t *) dst = *(const word_t *) src;
+		}
+	}
+	while (size-- > 0)
+		*--dst = *--src;
+}
 
 /* Copies SIZE bytes from SRC to DST, which must not overlap.
    Returns DST. */
@@ -11,8 +89,7 @@ memcpy (void *dst_, const void *src_, size_t size) {
 	ASSERT (dst != NULL || size == 0);
 	ASSERT (src != NULL || size == 0);
 
-	while (size-- > 0)
-		*dst++ = *src++;
+	copy_forward (dst, src, size);
 
 	return dst_;
 }
@@ -27,17 +104,12 @@ memmove (void *dst_, const void *src_, size_t size) {
 	ASSERT (dst != NULL || size == 0);
 	ASSERT (src != NULL || size == 0);
 
-	if (dst < src) {
-		while (size-- > 0)
-			*dst++ = *src++;
-	} else {
-		dst += size;
-		src += size;
-		while (size-- > 0)
-			*--dst = *--src;
-	}
+	if (dst < src)
+		copy_forward (dst, src, size);
+	else
+		copy_backward (dst, src, size);
 
-	return dst;
+	return dst_;
 }
 
 /* Find the first differing byte in the two blocks of SIZE bytes
@@ -52,6 +124,10 @@ memcmp (const void *a_, const void *b_, size_t size) {
 	ASSERT (a != NULL || size == 0);
 	ASSERT (b != NULL || size == 0);
 
+	/* Skip equal words, then find the differing byte. */
+	for (; size >= WORD; size -= WORD, a += WORD, b += WORD)
+		if (*(const word_t *) a != *(const word_t *) b)
+			break;
 	for (; size-- > 0; a++, b++)
 		if (*a != *b)
 			return *a > *b ? +1 : -1;
@@ -86,9 +162,14 @@ void *
 memchr (const void *block_, int ch_, size_t size) {
 	const unsigned char *block = block_;
 	unsigned char ch = ch_;
+	uint64_t pattern = ch * ONES;
 
 	ASSERT (block != NULL || size == 0);
 
+	/* Skip words without CH, then find it in the word that has it. */
+	for (; size >= WORD; size -= WORD, block += WORD)
+		if (HAS_ZERO (*(const word_t *) block ^ pattern))
+			break;
 	for (; size-- > 0; block++)
 		if (*block == ch)
 			return (void *) block;
@@ -260,6 +341,19 @@ memset (void *dst_, int value, size_t size) {
 
 	ASSERT (dst != NULL || size == 0);
 
+	if (size >= REP_MIN) {
+		asm volatile ("rep stosb"
+				: "+D" (dst), "+c" (size) : "a" (value) : "memory");
+		return dst_;
+	}
+	if (size >= WORD) {
+		uint64_t pattern = (unsigned char) value * ONES;
+
+		for (; (uintptr_t) dst % WORD != 0; size--)
+			*dst++ = value;
+		for (; size >= WORD; size -= WORD, dst += WORD)
+			*(word_t *) dst = pattern;
+	}
 	while (size-- > 0)
 		*dst++ = value;
 
@@ -270,12 +364,21 @@ memset (void *dst_, int value, size_t size) {
 size_t
 strlen (const char *string) {
 	const char *p;
+	uint64_t w;
 
 	ASSERT (string);
 
-	for (p = string; *p != '\0'; p++)
-		continue;
-	return p - string;
+	/* Reach a word boundary.  From there on, whole words can be
+	   read safely: an aligned word never crosses into another
+	   page, so reading past the terminator cannot fault. */
+	for (p = string; (uintptr_t) p % WORD != 0; p++)
+		if (*p == '\0')
+			return p - string;
+	for (;; p += WORD) {
+		w = *(const word_t *) p;
+		if (HAS_ZERO (w))
+			return p - string + first_zero_byte (w);
+	}
 }
 
 /* If STRING is less than MAXLEN characters in length, returns
@@ -0,0 +1,330 @@
+/* Test program for lib/kernel/rbtree.c.
+
+   Inserts and erases nodes in random order, checking the
+   red-black invariants, ordering, lower and upper bounds, and
+   augmented interval queries against brute force after every
+   step.
+
+   This is not a test we will run on your submitted projects.
+   It is here for completeness.
+*/
+
+#undef NDEBUG
+#include <debug.h>
+#include <rbtree.h>
+#include <random.h>
+#include <stdio.h>
+#include "threads/test.h"
+
+/* Maximum number of nodes in a tree that we will test. */
+#define MAX_SIZE 256
+
+/* Values and interval lengths are drawn from [0, RANGE). */
+#define RANGE 64
+
+/* A tree node holding interval [VALUE, END). */
+struct value
+  {
+    struct rb_node node;        /* Tree node. */
+    int value;                  /* Start of interval; tree key. */
+    int end;                    /* End of interval. */
+    int max_end;                /* Largest END in this subtree. */
+    bool in_tree;               /* Currently in the tree? */
+  };
+
+static void shuffle (struct value *[], size_t);
+static bool value_less (const struct rb_node *, const struct rb_node *,
+                        void *);
+static void value_augment (struct rb_node *, void *);
+static int verify_subtree (const struct rb_node *, const struct rb_node *);
+static void verify_tree (struct rb_tree *, struct value[], int size);
+static void verify_bounds (struct rb_tree *, struct value[], int size);
+static void verify_overlaps (struct rb_tree *, struct value[], int size);
+static int count_before (struct rb_tree *, struct rb_node *);
+static int count_overlaps (const struct rb_node *, int start, int end);
+static void count_node (struct rb_node *, void *);
+
+/* Test the red-black tree implementation. */
+void
+test (void)
+{
+  int size;
+
+  printf ("testing various size trees:");
+  for (size = 0; size <= MAX_SIZE; size = size * 2 + 1)
+    {
+      int repeat;
+
+      printf (" %d", size);
+      for (repeat = 0; repeat < 10; repeat++)
+        {
+          static struct value values[MAX_SIZE];
+          static struct value *order[MAX_SIZE];
+          struct rb_tree tree;
+          int i, cleared;
+
+          /* Random intervals, with plenty of equal keys. */
+          for (i = 0; i < size; i++)
+            {
+              values[i].value = random_ulong () % RANGE;
+              values[i].end = values[i].value + random_ulong () % RANGE;
+              values[i].in_tree = false;
+              order[i] = &values[i];
+            }
+          rb_init (&tree, value_less, value_augment, NULL);
+          verify_tree (&tree, values, size);
+
+          /* Insert in random order. */
+          shuffle (order, size);
+          for (i = 0; i < size; i++)
+            {
+              rb_insert (&tree, &order[i]->node);
+              order[i]->in_tree = true;
+              verify_tree (&tree, values, size);
+            }
+          verify_bounds (&tree, values, size);
+          verify_overlaps (&tree, values, size);
+
+          /* Change some intervals in place and fix up. */
+          for (i = 0; i < size; i += 3)
+            {
+              values[i].end = values[i].value + random_ulong () % RANGE;
+              rb_augment_path (&tree, &values[i].node);
+            }
+          verify_tree (&tree, values, size);
+          verify_overlaps (&tree, values, size);
+
+          /* Erase half in random order, then reinsert them. */
+          shuffle (order, size);
+          for (i = 0; i < size / 2; i++)
+            {
+              rb_erase (&tree, &order[i]->node);
+              order[i]->in_tree = false;
+              verify_tree (&tree, values, size);
+            }
+          verify_bounds (&tree, values, size);
+          verify_overlaps (&tree, values, size);
+          for (i = 0; i < size / 2; i++)
+            {
+              rb_insert (&tree, &order[i]->node);
+              order[i]->in_tree = true;
+            }
+          verify_tree (&tree, values, size);
+
+          /* Erase everything in random order. */
+          shuffle (order, size);
+          for (i = 0; i < size; i++)
+            {
+              rb_erase (&tree, &order[i]->node);
+              order[i]->in_tree = false;
+              verify_tree (&tree, values, size);
+            }
+          ASSERT (rb_empty (&tree));
+
+          /* Clearing visits every node once. */
+          for (i = 0; i < size; i++)
+            rb_insert (&tree, &values[i].node);
+          cleared = 0;
+          tree.aux = &cleared;
+          rb_clear (&tree, count_node);
+          ASSERT (cleared == size);
+          ASSERT (rb_empty (&tree) && rb_size (&tree) == 0);
+        }
+    }
+
+  printf (" done\n");
+  printf ("rbtree: PASS\n");
+}
+
+/* Shuffles the CNT elements in ARRAY into random order. */
+static void
+shuffle (struct value **array, size_t cnt)
+{
+  size_t i;
+
+  for (i = 0; i < cnt; i++)
+    {
+      size_t j = i + random_ulong () % (cnt - i);
+      struct value *t = array[j];
+      array[j] = array[i];
+      array[i] = t;
+    }
+}
+
+/* Returns true if value A is less than value B, false
+   otherwise. */
+static bool
+value_less (const struct rb_node *a_, const struct rb_node *b_,
+            void *aux UNUSED)
+{
+  const struct value *a = rb_entry (a_, struct value, node);
+  const struct value *b = rb_entry (b_, struct value, node);
+
+  return a->value < b->value;
+}
+
+/* Recomputes N's max_end from N and its children. */
+static void
+value_augment (struct rb_node *n, void *aux UNUSED)
+{
+  struct value *v = rb_entry (n, struct value, node);
+
+  v->max_end = v->end;
+  if (n->left != NULL
+      && rb_entry (n->left, struct value, node)->max_end > v->max_end)
+    v->max_end = rb_entry (n->left, struct value, node)->max_end;
+  if (n->right != NULL
+      && rb_entry (n->right, struct value, node)->max_end > v->max_end)
+    v->max_end = rb_entry (n->right, struct value, node)->max_end;
+}
+
+/* Verifies the subtree rooted at N, whose parent is PARENT:
+   parent links, no red node with a red child, and augmented
+   data.  Returns the subtree's black height. */
+static int
+verify_subtree (const struct rb_node *n, const struct rb_node *parent)
+{
+  const struct value *v;
+  int max_end, left, right;
+
+  if (n == NULL)
+    return 1;
+  ASSERT (n->parent == parent);
+  ASSERT (!n->red || parent == NULL || !parent->red);
+
+  v = rb_entry (n, struct value, node);
+  max_end = v->end;
+  if (n->left != NULL
+      && rb_entry (n->left, struct value, node)->max_end > max_end)
+    max_end = rb_entry (n->left, struct value, node)->max_end;
+  if (n->right != NULL
+      && rb_entry (n->right, struct value, node)->max_end > max_end)
+    max_end = rb_entry (n->right, struct value, node)->max_end;
+  ASSERT (v->max_end == max_end);
+
+  left = verify_subtree (n->left, n);
+  right = verify_subtree (n->right, n);
+  ASSERT (left == right);
+  return left + !n->red;
+}
+
+/* Verifies that TREE holds exactly the values among the SIZE in
+   VALUES that are marked in_tree, in order both ways. */
+static void
+verify_tree (struct rb_tree *tree, struct value values[], int size)
+{
+  struct rb_node *n, *prev;
+  int i, cnt;
+
+  ASSERT (tree->root == NULL || !tree->root->red);
+  verify_subtree (tree->root, NULL);
+
+  for (i = cnt = 0; i < size; i++)
+    cnt += values[i].in_tree;
+  ASSERT (rb_size (tree) == (size_t) cnt);
+  ASSERT (rb_empty (tree) == (cnt == 0));
+
+  for (i = 0, prev = NULL, n = rb_first (tree); n != NULL;
+       i++, prev = n, n = rb_next (n))
+    {
+      ASSERT (rb_entry (n, struct value, node)->in_tree);
+      ASSERT (prev == NULL || !value_less (n, prev, NULL));
+      ASSERT (rb_prev (n) == prev);
+    }
+  ASSERT (i == cnt);
+  ASSERT (rb_last (tree) == prev);
+}
+
+/* Verifies rb_find(), rb_lower_bound() and rb_upper_bound() for
+   every key in [-1, RANGE]. */
+static void
+verify_bounds (struct rb_tree *tree, struct value values[], int size)
+{
+  struct value key;
+  int k;
+
+  for (k = -1; k <= RANGE; k++)
+    {
+      struct rb_node *lower, *upper, *found;
+      int i, lower_cnt = 0, upper_cnt = 0;
+
+      key.value = k;
+      lower = rb_lower_bound (tree, &key.node);
+      upper = rb_upper_bound (tree, &key.node);
+      found = rb_find (tree, &key.node);
+
+      for (i = 0; i < size; i++)
+        if (values[i].in_tree)
+          {
+            lower_cnt += values[i].value < k;
+            upper_cnt += values[i].value <= k;
+          }
+
+      ASSERT (count_before (tree, lower) == lower_cnt);
+      ASSERT (count_before (tree, upper) == upper_cnt);
+      ASSERT ((found != NULL) == (upper_cnt > lower_cnt));
+      ASSERT (found == NULL || found == lower);
+    }
+}
+
+/* Returns the number of nodes that precede N in TREE, or the
+   size of TREE if N is null. */
+static int
+count_before (struct rb_tree *tree, struct rb_node *n)
+{
+  int cnt;
+
+  if (n == NULL)
+    return rb_size (tree);
+  for (cnt = 0; (n = rb_prev (n)) != NULL; cnt++)
+    continue;
+  return cnt;
+}
+
+/* Counts the intervals in TREE that overlap [START, END), using
+   max_end to prune subtrees. */
+static int
+count_overlaps (const struct rb_node *n, int start, int end)
+{
+  const struct value *v;
+  int cnt = 0;
+
+  if (n == NULL || rb_entry (n, struct value, node)->max_end <= start)
+    return 0;
+  v = rb_entry (n, struct value, node);
+  cnt += count_overlaps (n->left, start, end);
+  if (v->value < end)
+    {
+      cnt += v->value < v->end && start < v->end;
+      cnt += count_overlaps (n->right, start, end);
+    }
+  return cnt;
+}
+
+/* Verifies interval queries against brute force. */
+static void
+verify_overlaps (struct rb_tree *tree, struct value values[], int size)
+{
+  int start;
+
+  for (start = 0; start < RANGE * 2; start += 5)
+    {
+      int end = start + random_ulong () % RANGE + 1;
+      int i, cnt = 0;
+
+      for (i = 0; i < size; i++)
+        if (values[i].in_tree && values[i].value < values[i].end
+            && values[i].value < end && start < values[i].end)
+          cnt++;
+      ASSERT (count_overlaps (tree->root, start, end) == cnt);
+    }
+}
+
+/* Destructor for rb_clear(): counts nodes in *AUX. */
+static void
+count_node (struct rb_node *n UNUSED, void *aux)
+{
+  int *cnt = aux;
+
+  (*cnt)++;
+}
@@ -0,0 +1,98 @@
+/* Times bitmap_count() and bitmap_scan() on a 1M-bit bitmap
+   filled at random to several ratios, and, for comparison, the
+   same scans done a bit at a time with bitmap_test(), the way
+   bitmap_scan() used to work.  Each scan starts at bit 0 and
+   looks for unset bits, the way palloc and the free map do.
+
+   This is a benchmark, not a pass/fail test, though it fails if
+   the two ways of scanning disagree.  Run it with
+   `pintos -- -threads-tests run bitmap-bench'. */
+
+#include <bitmap.h>
+#include <random.h>
+#include <stdint.h>
+#include <stdio.h>
+#include "tests/threads/tests.h"
+#include "intrinsic.h"
+
+/* Bits in the bitmap. */
+#define BITS (1024 * 1024)
+
+/* Times each word-at-a-time operation is repeated. */
+#define REPEAT 10
+
+static size_t slow_scan (const struct bitmap *, size_t cnt);
+
+void
+test_bitmap_bench (void) 
+{
+  static const unsigned fills[] = {0, 500, 900, 990, 999};
+  static const size_t cnts[] = {1, 8, 64};
+  struct bitmap *b;
+  size_t i, j, k;
+
+  b = bitmap_create (BITS);
+  ASSERT (b != NULL);
+  random_init (0);
+
+  msg ("%d-bit bitmap, cycles per call, scans for unset bits", BITS);
+  for (i = 0; i < sizeof fills / sizeof *fills; i++) 
+    {
+      uint64_t start, cycles;
+      size_t set_cnt = 0;
+
+      for (j = 0; j < BITS; j++)
+        bitmap_set (b, j, random_ulong () % 1000 < fills[i]);
+
+      start = rdtsc ();
+      for (k = 0; k < REPEAT; k++)
+        set_cnt = bitmap_count (b, 0, BITS, true);
+      cycles = (rdtsc () - start) / REPEAT;
+      msg ("fill %u/1000: count %llu (%zu bits set)",
+           fills[i], cycles, set_cnt);
+
+      for (j = 0; j < sizeof cnts / sizeof *cnts; j++) 
+        {
+          uint64_t slow_cycles;
+          size_t idx = 0, slow_idx;
+
+          start = rdtsc ();
+          for (k = 0; k < REPEAT; k++)
+            idx = bitmap_scan (b, 0, cnts[j], false);
+          cycles = (rdtsc () - start) / REPEAT;
+
+          start = rdtsc ();
+          slow_idx = slow_scan (b, cnts[j]);
+          slow_cycles = rdtsc () - start;
+
+          if (idx != slow_idx)
+            fail ("scan for %zu unset bits found %zu, expected %zu",
+                  cnts[j], idx, slow_idx);
+          msg ("fill %u/1000: scan %2zu: %llu, bit at a time: %llu (%s %zu)",
+               fills[i], cnts[j], cycles, slow_cycles,
+               idx != BITMAP_ERROR ? "found at" : "not found",
+               idx != BITMAP_ERROR ? idx : 0);
+        }
+    }
+
+  bitmap_destroy (b);
+  pass ();
+}
+
+/* Returns the first run of CNT unset bits in B, testing one bit
+   at a time from every starting position. */
+static size_t
+slow_scan (const struct bitmap *b, size_t cnt) 
+{
+  size_t i, j;
+
+  for (i = 0; i + cnt <= bitmap_size (b); i++) 
+    {
+      for (j = 0; j < cnt; j++)
+        if (bitmap_test (b, i + j))
+          break;
+      if (j == cnt)
+        return i;
+    }
+  return BITMAP_ERROR;
+}
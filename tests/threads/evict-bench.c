@@ -0,0 +1,547 @@
+/* Compares the eviction policies in vm/evict.c on page reference
+   traces modeled on the swap-* and page-merge-* tests in
+   tests/vm, scaled down to a memory of FRAMES frames.  Each trace
+   is replayed against each policy, with accessed bits kept in a
+   real page table the way the MMU would keep them, and the
+   number of major faults, faults on pages that had been evicted,
+   is reported.
+
+   Every data reference also touches the running process's code
+   and stack pages, as real programs do, and processes that run
+   in parallel in a test take turns in slices of SLICE references.
+
+   The real workloads report the same counts for the policy in use
+   at power off; run them with `-evict=POLICY' to compare.
+
+   This is a benchmark, not a pass/fail test.  It needs a VM
+   kernel; run it with `pintos -- -threads-tests run evict-bench'. */
+
+#ifdef VM
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include "tests/threads/tests.h"
+#include "threads/malloc.h"
+#include "threads/mmu.h"
+#include "threads/palloc.h"
+#include "threads/vaddr.h"
+#include "threads/vmalloc.h"
+#include "vm/vm.h"
+
+/* Memory size, in frames. */
+#define FRAMES 128
+
+/* Limits on a trace. */
+#define MAX_PAGES 1024
+#define MAX_REFS 65536
+
+/* References a process makes before the next one runs. */
+#define SLICE 16
+
+#define SPACE_BASE ((uint8_t *) 0x10000000)
+
+/* A page reference trace. */
+struct trace
+  {
+    uint16_t *refs;             /* Referenced page numbers. */
+    size_t ref_cnt;
+    size_t ref_max;             /* Room in REFS. */
+    size_t page_cnt;            /* Pages numbered so far. */
+  };
+
+/* A process in a trace: its code and stack pages. */
+struct proc
+  {
+    uint16_t code, stack;
+  };
+
+/* Replay state. */
+struct sim
+  {
+    const struct evict_policy *policy;
+    struct evict_queues queues;
+    uint64_t *pml4;
+    void *kpage;                /* Backs every mapping. */
+    struct page *pages;         /* MAX_PAGES pages. */
+    bool seen[MAX_PAGES];       /* Has page been resident? */
+    struct frame frames[FRAMES];
+    size_t frame_cnt;           /* Frames handed out so far. */
+    long long faults, majors;
+  };
+
+static const struct evict_policy *const policies[] =
+  { &evict_clock, &evict_2q, &evict_lru };
+#define POLICY_CNT (sizeof policies / sizeof *policies)
+
+static void swap_anon (struct trace *);
+static void swap_iter (struct trace *);
+static void swap_fork (struct trace *);
+static void page_merge_seq (struct trace *);
+static void page_merge_par (struct trace *);
+static void page_merge_stk (struct trace *);
+static void page_merge_mm (struct trace *);
+
+static const struct workload
+  {
+    const char *name;
+    void (*build) (struct trace *);
+  }
+workloads[] =
+  {
+    {"swap-anon", swap_anon},
+    {"swap-iter", swap_iter},
+    {"swap-fork", swap_fork},
+    {"page-merge-seq", page_merge_seq},
+    {"page-merge-par", page_merge_par},
+    {"page-merge-stk", page_merge_stk},
+    {"page-merge-mm", page_merge_mm},
+  };
+
+static void trace_init (struct trace *);
+static void replay (struct sim *, const struct trace *);
+
+void
+test_evict_bench (void)
+{
+  static struct sim sim;
+  struct trace t;
+  size_t w, p;
+
+  sim.pages = kvcalloc (MAX_PAGES, sizeof *sim.pages);
+  sim.kpage = palloc_get_page (0);
+  t.refs = kvcalloc (MAX_REFS, sizeof *t.refs);
+  if (sim.pages == NULL || sim.kpage == NULL || t.refs == NULL)
+    fail ("out of memory");
+
+  msg ("%d frames; major faults per policy", FRAMES);
+  msg ("workload        pages   refs  faults   clock      2q     lru");
+  for (w = 0; w < sizeof workloads / sizeof *workloads; w++)
+    {
+      long long majors[POLICY_CNT];
+      long long faults = 0;
+
+      trace_init (&t);
+      workloads[w].build (&t);
+      for (p = 0; p < POLICY_CNT; p++)
+        {
+          sim.policy = policies[p];
+          replay (&sim, &t);
+          majors[p] = sim.majors;
+          if (p > 0 && sim.faults - sim.majors != faults)
+            fail ("%s: first-touch faults differ", workloads[w].name);
+          faults = sim.faults - sim.majors;
+        }
+      msg ("%-14s %6zu %6zu %7lld %7lld %7lld %7lld", workloads[w].name,
+           t.page_cnt, t.ref_cnt, faults, majors[0], majors[1], majors[2]);
+    }
+
+  kvfree (t.refs);
+  palloc_free_page (sim.kpage);
+  kvfree (sim.pages);
+  pass ();
+}
+
+/* Trace construction. */
+
+static void
+trace_init (struct trace *t)
+{
+  t->ref_cnt = 0;
+  t->ref_max = MAX_REFS;
+  t->page_cnt = 0;
+}
+
+/* Numbers CNT new pages in T and returns the first. */
+static uint16_t
+new_pages (struct trace *t, size_t cnt)
+{
+  uint16_t first = t->page_cnt;
+
+  t->page_cnt += cnt;
+  if (t->page_cnt > MAX_PAGES)
+    fail ("trace has too many pages");
+  return first;
+}
+
+/* Returns a new process in T. */
+static struct proc
+new_proc (struct trace *t)
+{
+  struct proc p;
+
+  p.code = new_pages (t, 1);
+  p.stack = new_pages (t, 1);
+  return p;
+}
+
+/* Appends a reference to PAGE to T. */
+static void
+add_ref (struct trace *t, uint16_t page)
+{
+  if (t->ref_cnt >= t->ref_max)
+    fail ("trace is too long");
+  t->refs[t->ref_cnt++] = page;
+}
+
+/* Appends a reference by process P to PAGE to T. */
+static void
+ref (struct trace *t, const struct proc *p, uint16_t page)
+{
+  add_ref (t, p->code);
+  add_ref (t, p->stack);
+  add_ref (t, page);
+}
+
+/* Appends references by P to CNT pages from FIRST up to T. */
+static void
+scan (struct trace *t, const struct proc *p, uint16_t first, size_t cnt)
+{
+  size_t i;
+
+  for (i = 0; i < cnt; i++)
+    ref (t, p, first + i);
+}
+
+/* Appends the references quick sort by P over CNT pages from FIRST
+   makes to T: a partitioning pass over the range, then the same
+   for each half. */
+static void
+qsort_pages (struct trace *t, const struct proc *p, uint16_t first,
+             size_t cnt)
+{
+  scan (t, p, first, cnt);
+  if (cnt > 1)
+    {
+      qsort_pages (t, p, first, cnt / 2);
+      qsort_pages (t, p, first + cnt / 2, cnt - cnt / 2);
+    }
+}
+
+/* Appends CNT traces from KIDS to T, interleaved in slices of SLICE
+   references, as processes running in parallel would be. */
+static void
+interleave (struct trace *t, struct trace kids[], size_t cnt)
+{
+  size_t pos, k;
+  bool more = true;
+
+  for (pos = 0; more; pos += SLICE)
+    {
+      more = false;
+      for (k = 0; k < cnt; k++)
+        {
+          size_t i;
+
+          for (i = pos; i < pos + SLICE && i < kids[k].ref_cnt; i++)
+            add_ref (t, kids[k].refs[i]);
+          more |= i < kids[k].ref_cnt;
+        }
+    }
+}
+
+/* Builds in KIDS[I], for each of CNT children of T, the trace BUILD
+   makes for child I, numbering pages in T.  Frees KIDS' reference
+   arrays with kids_done(). */
+static void
+kids_build (struct trace *t, struct trace kids[], size_t cnt,
+            void (*build) (struct trace *, size_t i, void *aux), void *aux)
+{
+  size_t i;
+
+  for (i = 0; i < cnt; i++)
+    {
+      kids[i].refs = kvcalloc (MAX_REFS / cnt, sizeof *kids[i].refs);
+      if (kids[i].refs == NULL)
+        fail ("out of memory");
+      kids[i].ref_cnt = 0;
+      kids[i].ref_max = MAX_REFS / cnt;
+      kids[i].page_cnt = t->page_cnt;
+      build (&kids[i], i, aux);
+      t->page_cnt = kids[i].page_cnt;
+    }
+}
+
+static void
+kids_done (struct trace kids[], size_t cnt)
+{
+  size_t i;
+
+  for (i = 0; i < cnt; i++)
+    kvfree (kids[i].refs);
+}
+
+/* Workloads. */
+
+/* swap-anon: writes, then reads, an array 2.5 times the size of
+   memory, a page at a time. */
+static void
+swap_anon (struct trace *t)
+{
+  struct proc p = new_proc (t);
+  size_t n = FRAMES * 5 / 2;
+  uint16_t buf = new_pages (t, n);
+
+  scan (t, &p, buf, n);
+  scan (t, &p, buf, n);
+}
+
+/* swap-iter: like swap-anon, with a small mapped file checked
+   before and after the second pass. */
+static void
+swap_iter (struct trace *t)
+{
+  struct proc p = new_proc (t);
+  size_t n = FRAMES * 5 / 2;
+  uint16_t buf = new_pages (t, n);
+  uint16_t file = new_pages (t, 4);
+
+  scan (t, &p, buf, n);
+  scan (t, &p, file, 4);
+  scan (t, &p, buf, n);
+  scan (t, &p, file, 4);
+}
+
+/* swap-fork: children that each write, then read, an array of a
+   quarter of memory, all at once. */
+#define FORK_KIDS 8
+
+static void
+swap_fork_kid (struct trace *t, size_t i UNUSED, void *aux UNUSED)
+{
+  struct proc p = new_proc (t);
+  uint16_t buf = new_pages (t, FRAMES / 4);
+
+  scan (t, &p, buf, FRAMES / 4);
+  scan (t, &p, buf, FRAMES / 4);
+}
+
+static void
+swap_fork (struct trace *t)
+{
+  struct trace kids[FORK_KIDS];
+
+  kids_build (t, kids, FORK_KIDS, swap_fork_kid, NULL);
+  interleave (t, kids, FORK_KIDS);
+  kids_done (kids, FORK_KIDS);
+}
+
+/* page-merge-*: fill BUF1 of CHUNK_CNT chunks, have a child sort
+   each chunk through a file, merge the sorted chunks into BUF2 and
+   verify it.  The merge consumes all chunks at about the same
+   rate, so for each page of BUF2 it references the current page
+   of every chunk. */
+struct merge
+  {
+    struct proc parent;
+    uint16_t buf1, buf2, hist;
+    size_t chunk_cnt, chunk_pages;
+    enum { COUNTING, QSORT, QSORT_MM } sort;
+  };
+
+/* Child I sorting chunk I of M. */
+static void
+merge_kid (struct trace *t, size_t i UNUSED, void *m_)
+{
+  struct merge *m = m_;
+  struct proc p = new_proc (t);
+  uint16_t buf = new_pages (t, m->chunk_pages);
+  uint16_t hist;
+  size_t j;
+
+  switch (m->sort)
+    {
+    case COUNTING:
+      /* Read the file into BUF, count bytes, write them back
+         sorted, write BUF to the file. */
+      hist = new_pages (t, 1);
+      scan (t, &p, buf, m->chunk_pages);
+      for (j = 0; j < m->chunk_pages; j++)
+        {
+          ref (t, &p, buf + j);
+          ref (t, &p, hist);
+        }
+      for (j = 0; j < m->chunk_pages; j++)
+        {
+          ref (t, &p, hist);
+          ref (t, &p, buf + j);
+        }
+      scan (t, &p, buf, m->chunk_pages);
+      break;
+
+    case QSORT:
+      /* The same with quick sort, on the stack. */
+      scan (t, &p, buf, m->chunk_pages);
+      qsort_pages (t, &p, buf, m->chunk_pages);
+      scan (t, &p, buf, m->chunk_pages);
+      break;
+
+    case QSORT_MM:
+      /* Quick sort in the mapped file. */
+      qsort_pages (t, &p, buf, m->chunk_pages);
+      break;
+    }
+}
+
+static void
+page_merge (struct trace *t, struct merge *m, bool parallel)
+{
+  size_t data_pages = m->chunk_cnt * m->chunk_pages;
+  size_t c, o;
+
+  m->parent = new_proc (t);
+  m->buf1 = new_pages (t, data_pages);
+  m->buf2 = new_pages (t, data_pages);
+  m->hist = new_pages (t, 1);
+
+  /* Init. */
+  for (o = 0; o < data_pages; o++)
+    {
+      ref (t, &m->parent, m->buf1 + o);
+      ref (t, &m->parent, m->hist);
+    }
+
+  /* Sort chunks. */
+  if (parallel)
+    {
+      struct trace kids[16];
+
+      ASSERT (m->chunk_cnt <= 16);
+      scan (t, &m->parent, m->buf1, data_pages);
+      kids_build (t, kids, m->chunk_cnt, merge_kid, m);
+      interleave (t, kids, m->chunk_cnt);
+      kids_done (kids, m->chunk_cnt);
+      scan (t, &m->parent, m->buf1, data_pages);
+    }
+  else
+    for (c = 0; c < m->chunk_cnt; c++)
+      {
+        uint16_t chunk = m->buf1 + c * m->chunk_pages;
+
+        scan (t, &m->parent, chunk, m->chunk_pages);
+        merge_kid (t, c, m);
+        scan (t, &m->parent, chunk, m->chunk_pages);
+      }
+
+  /* Merge. */
+  for (o = 0; o < data_pages; o++)
+    {
+      for (c = 0; c < m->chunk_cnt; c++)
+        ref (t, &m->parent,
+             m->buf1 + c * m->chunk_pages + o / m->chunk_cnt);
+      ref (t, &m->parent, m->buf2 + o);
+    }
+
+  /* Verify. */
+  for (o = 0; o < data_pages; o++)
+    {
+      ref (t, &m->parent, m->hist);
+      ref (t, &m->parent, m->buf2 + o);
+    }
+}
+
+static void
+page_merge_seq (struct trace *t)
+{
+  struct merge m = { .chunk_cnt = 16, .chunk_pages = 8, .sort = COUNTING };
+  page_merge (t, &m, false);
+}
+
+static void
+page_merge_par (struct trace *t)
+{
+  struct merge m = { .chunk_cnt = 8, .chunk_pages = 16, .sort = COUNTING };
+  page_merge (t, &m, true);
+}
+
+static void
+page_merge_stk (struct trace *t)
+{
+  struct merge m = { .chunk_cnt = 8, .chunk_pages = 16, .sort = QSORT };
+  page_merge (t, &m, true);
+}
+
+static void
+page_merge_mm (struct trace *t)
+{
+  struct merge m = { .chunk_cnt = 8, .chunk_pages = 16, .sort = QSORT_MM };
+  page_merge (t, &m, true);
+}
+
+/* Replay. */
+
+/* References page N in S, faulting it in if it is not resident. */
+static void
+touch (struct sim *s, uint16_t n)
+{
+  struct page *page = &s->pages[n];
+  struct frame *frame;
+
+  if (page->frame != NULL)
+    {
+      pml4_set_accessed (s->pml4, page->va, true);
+      return;
+    }
+
+  s->faults++;
+  if (s->seen[n])
+    s->majors++;
+  s->seen[n] = true;
+
+  if (s->frame_cnt < FRAMES)
+    {
+      frame = &s->frames[s->frame_cnt++];
+      list_init (&frame->pages);
+    }
+  else
+    {
+      struct page *victim;
+
+      frame = s->policy->victim (&s->queues);
+      if (frame == NULL)
+        fail ("%s found no victim", s->policy->name);
+      victim = frame_page (frame);
+      pml4_clear_page (s->pml4, victim->va);
+      list_remove (&victim->frame_elem);
+      victim->frame = NULL;
+    }
+
+  list_push_back (&frame->pages, &page->frame_elem);
+  frame->page_cnt = 1;
+  frame->queue = 0;
+  frame->age = 0;
+  page->frame = frame;
+  page->pml4 = s->pml4;
+  if (!pml4_set_page (s->pml4, page->va, s->kpage, true))
+    fail ("out of memory");
+  pml4_set_accessed (s->pml4, page->va, true);
+  s->policy->insert (&s->queues, frame);
+}
+
+/* Replays T against S's policy from an empty memory. */
+static void
+replay (struct sim *s, const struct trace *t)
+{
+  size_t i;
+
+  s->pml4 = pml4_create ();
+  if (s->pml4 == NULL)
+    fail ("out of memory");
+  evict_queues_init (&s->queues);
+  memset (s->pages, 0, t->page_cnt * sizeof *s->pages);
+  for (i = 0; i < t->page_cnt; i++)
+    {
+      s->pages[i].va = SPACE_BASE + i * PGSIZE;
+      s->seen[i] = false;
+    }
+  s->frame_cnt = 0;
+  s->faults = s->majors = 0;
+
+  for (i = 0; i < t->ref_cnt; i++)
+    touch (s, t->refs[i]);
+
+  for (i = 0; i < t->page_cnt; i++)
+    if (s->pages[i].frame != NULL)
+      pml4_clear_page (s->pml4, s->pages[i].va);
+  pml4_destroy (s->pml4);
+}
+#endif /* VM */
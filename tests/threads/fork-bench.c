@@ -0,0 +1,181 @@
+/* Measures how the cost of copying an address space for fork()
+   depends on the parent's resident set.  The parent, this thread,
+   maps MAP_PAGES anonymous pages and touches RSS of them; a child
+   thread then copies its supplemental page table the way
+   __do_fork() does, with resident pages shared copy-on-write.
+   For each RSS, reports the cycles the copy took, per fork and
+   per mapped page, next to the cycles that copying the resident
+   pages' contents alone would take.
+
+   Since the copy shares frames instead of copying them, its cost
+   follows the number of mapped pages, not the number of resident
+   ones.
+
+   This is a benchmark, not a pass/fail test, though it fails if
+   the copy does.  It needs a VM kernel; run it with
+   `pintos -- -threads-tests run fork-bench'. */
+
+#ifdef VM
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include "tests/threads/tests.h"
+#include "threads/mmu.h"
+#include "threads/palloc.h"
+#include "threads/thread.h"
+#include "threads/vaddr.h"
+#include "userprog/process.h"
+#include "vm/vm.h"
+#include "intrinsic.h"
+
+/* Pages the parent maps. */
+#define MAP_PAGES 512
+
+/* Forks timed at each resident set size. */
+#define ROUNDS 4
+
+#define SPACE_BASE ((uint8_t *) 0x10000000)
+
+/* Resident set sizes to measure, in pages. */
+static const size_t rss_sizes[] = { 0, 64, 128, 256, 512 };
+
+/* One fork, as the child sees it. */
+struct fork_run
+  {
+    bool ok;                    /* Did the copy succeed? */
+    uint64_t cycles;            /* Cycles the copy took. */
+  };
+
+static void parent_setup (size_t rss);
+static void parent_teardown (void);
+static uint64_t fork_once (void);
+static uint64_t eager_copy (size_t rss);
+
+void
+test_fork_bench (void)
+{
+  size_t i;
+  int round;
+
+  msg ("%d pages mapped; cycles per fork", MAP_PAGES);
+  msg ("resident      fork  per page  copying resident pages");
+  for (i = 0; i < sizeof rss_sizes / sizeof *rss_sizes; i++)
+    {
+      size_t rss = rss_sizes[i];
+      uint64_t fork_cycles = 0, copy_cycles;
+
+      parent_setup (rss);
+      for (round = 0; round < ROUNDS; round++)
+        fork_cycles += fork_once ();
+      fork_cycles /= ROUNDS;
+      copy_cycles = eager_copy (rss);
+      parent_teardown ();
+
+      msg ("%8zu %9llu %9llu %23llu", rss, fork_cycles,
+           fork_cycles / MAP_PAGES, copy_cycles);
+    }
+  pass ();
+}
+
+/* Gives the current thread an address space of MAP_PAGES
+   anonymous pages, the first RSS of them resident. */
+static void
+parent_setup (size_t rss)
+{
+  struct thread *cur = thread_current ();
+  size_t i;
+
+  cur->pml4 = pml4_create ();
+  if (cur->pml4 == NULL)
+    fail ("out of memory");
+  supplemental_page_table_init (&cur->spt);
+  if (vma_create (&cur->spt.vmas, SPACE_BASE, SPACE_BASE + MAP_PAGES * PGSIZE,
+                  VMA_SEGMENT, true) == NULL)
+    fail ("out of memory");
+  for (i = 0; i < MAP_PAGES; i++)
+    {
+      void *va = SPACE_BASE + i * PGSIZE;
+
+      if (!vm_alloc_page (VM_ANON, va, true))
+        fail ("out of memory");
+      if (i < rss && !vm_claim_page (va))
+        fail ("cannot claim page %zu", i);
+    }
+}
+
+/* Frees the current thread's address space. */
+static void
+parent_teardown (void)
+{
+  struct thread *cur = thread_current ();
+  uint64_t *pml4 = cur->pml4;
+
+  supplemental_page_table_kill (&cur->spt);
+  cur->pml4 = NULL;
+  pml4_activate (NULL);
+  pml4_destroy (pml4);
+}
+
+/* Child thread: copies its parent's address space and reports
+   how long that took.  Exiting frees the copy. */
+static void
+fork_child (void *run_)
+{
+  struct fork_run *run = run_;
+  struct thread *cur = thread_current ();
+  uint64_t start;
+
+  cur->pml4 = pml4_create ();
+  supplemental_page_table_init (&cur->spt);
+  start = rdtsc ();
+  run->ok = (cur->pml4 != NULL
+             && supplemental_page_table_copy (&cur->spt,
+                                              &cur->parent_process->spt));
+  run->cycles = rdtsc () - start;
+}
+
+/* Forks a child thread off the current one and returns the
+   cycles its address space copy took.  Waits for the child to
+   exit, so that the copy is gone before the next fork. */
+static uint64_t
+fork_once (void)
+{
+  struct fork_run run;
+  tid_t tid;
+
+  tid = thread_create ("fork-bench", PRI_DEFAULT, fork_child, &run);
+  if (tid == TID_ERROR)
+    fail ("cannot create child");
+  process_wait (tid);
+  if (!run.ok)
+    fail ("address space copy failed");
+  return run.cycles;
+}
+
+/* Returns the cycles that copying the contents of the current
+   thread's first RSS pages takes, which a fork without
+   copy-on-write would spend on top of the table copy. */
+static uint64_t
+eager_copy (size_t rss)
+{
+  struct supplemental_page_table *spt = &thread_current ()->spt;
+  void *buf = palloc_get_page (0);
+  uint64_t start;
+  size_t i;
+
+  if (buf == NULL)
+    fail ("out of memory");
+  start = rdtsc ();
+  for (i = 0; i < rss; i++)
+    {
+      struct page *page = spt_find_page (spt, SPACE_BASE + i * PGSIZE);
+
+      if (page == NULL || page->frame == NULL)
+        fail ("page %zu is not resident", i);
+      memcpy (buf, page->frame->kva, PGSIZE);
+    }
+  start = rdtsc () - start;
+  palloc_free_page (buf);
+  return start;
+}
+#endif /* VM */
@@ -0,0 +1,183 @@
+/* Compares the chained hash table (hash.h) with the Robin Hood
+   hash table (rhash.h) at 1K to 1M elements.  For each table,
+   reports the average and the worst cost of an insertion, which
+   shows the pause of a one-shot rehash, and the average cost of
+   a successful lookup and of a deletion, all in cycles.
+
+   This is a benchmark, not a pass/fail test, though it fails if a
+   table loses an element.  Run it with
+   `pintos -- -threads-tests run hash-bench'. */
+
+#include <hash.h>
+#include <rhash.h>
+#include <stdint.h>
+#include <stdio.h>
+#include "tests/threads/tests.h"
+#include "threads/vmalloc.h"
+#include "intrinsic.h"
+
+/* An element of both tables. */
+struct item 
+  {
+    int key;
+    struct hash_elem h_elem;
+    struct rhash_elem r_elem;
+  };
+
+/* Costs of one run, in cycles. */
+struct costs 
+  {
+    uint64_t insert, insert_max, find, delete;
+  };
+
+static void run_hash (struct item *, size_t cnt, struct costs *);
+static void run_rhash (struct item *, size_t cnt, struct costs *);
+
+void
+test_hash_bench (void) 
+{
+  size_t cnt;
+
+  msg ("cycles per operation: insert avg/max, find avg, delete avg");
+  for (cnt = 1024; cnt <= 1024 * 1024; cnt *= 4) 
+    {
+      struct item *items = kvcalloc (cnt, sizeof *items);
+      struct costs h, r;
+      size_t i;
+
+      if (items == NULL) 
+        {
+          msg ("%7zu elements: out of memory, skipped", cnt);
+          continue;
+        }
+      for (i = 0; i < cnt; i++)
+        items[i].key = i;
+
+      run_hash (items, cnt, &h);
+      run_rhash (items, cnt, &r);
+      msg ("%7zu elements: hash %llu/%llu, %llu, %llu; "
+           "rhash %llu/%llu, %llu, %llu", cnt,
+           h.insert, h.insert_max, h.find, h.delete,
+           r.insert, r.insert_max, r.find, r.delete);
+      kvfree (items);
+    }
+  pass ();
+}
+
+/* Returns the index of the item looked up in round I of CNT,
+   visiting items out of insertion order. */
+static size_t
+probe_order (size_t i, size_t cnt) 
+{
+  return (i * 40503) % cnt;
+}
+
+static uint64_t
+item_hash (const struct hash_elem *e, void *aux UNUSED) 
+{
+  return hash_int (hash_entry (e, struct item, h_elem)->key);
+}
+
+static bool
+item_less (const struct hash_elem *a, const struct hash_elem *b,
+           void *aux UNUSED) 
+{
+  return (hash_entry (a, struct item, h_elem)->key
+          < hash_entry (b, struct item, h_elem)->key);
+}
+
+static void
+run_hash (struct item *items, size_t cnt, struct costs *c) 
+{
+  struct hash h;
+  uint64_t start, total = 0, cycles;
+  size_t i;
+
+  if (!hash_init (&h, item_hash, item_less, NULL))
+    fail ("hash_init failed");
+
+  c->insert_max = 0;
+  for (i = 0; i < cnt; i++) 
+    {
+      start = rdtsc ();
+      hash_insert (&h, &items[i].h_elem);
+      cycles = rdtsc () - start;
+      total += cycles;
+      if (cycles > c->insert_max)
+        c->insert_max = cycles;
+    }
+  c->insert = total / cnt;
+
+  start = rdtsc ();
+  for (i = 0; i < cnt; i++) 
+    {
+      struct item *it = &items[probe_order (i, cnt)];
+      if (hash_find (&h, &it->h_elem) != &it->h_elem)
+        fail ("hash lost key %d", it->key);
+    }
+  c->find = (rdtsc () - start) / cnt;
+
+  start = rdtsc ();
+  for (i = 0; i < cnt; i++)
+    hash_delete (&h, &items[probe_order (i, cnt)].h_elem);
+  c->delete = (rdtsc () - start) / cnt;
+  if (!hash_empty (&h))
+    fail ("hash not empty after deleting everything");
+
+  hash_destroy (&h, NULL);
+}
+
+static uint64_t
+item_rhash (const struct rhash_elem *e, void *aux UNUSED) 
+{
+  return hash_int (rhash_entry (e, struct item, r_elem)->key);
+}
+
+static bool
+item_rless (const struct rhash_elem *a, const struct rhash_elem *b,
+            void *aux UNUSED) 
+{
+  return (rhash_entry (a, struct item, r_elem)->key
+          < rhash_entry (b, struct item, r_elem)->key);
+}
+
+static void
+run_rhash (struct item *items, size_t cnt, struct costs *c) 
+{
+  struct rhash h;
+  uint64_t start, total = 0, cycles;
+  size_t i;
+
+  if (!rhash_init (&h, item_rhash, item_rless, NULL))
+    fail ("rhash_init failed");
+
+  c->insert_max = 0;
+  for (i = 0; i < cnt; i++) 
+    {
+      start = rdtsc ();
+      rhash_insert (&h, &items[i].r_elem);
+      cycles = rdtsc () - start;
+      total += cycles;
+      if (cycles > c->insert_max)
+        c->insert_max = cycles;
+    }
+  c->insert = total / cnt;
+
+  start = rdtsc ();
+  for (i = 0; i < cnt; i++) 
+    {
+      struct item *it = &items[probe_order (i, cnt)];
+      if (rhash_find (&h, &it->r_elem) != &it->r_elem)
+        fail ("rhash lost key %d", it->key);
+    }
+  c->find = (rdtsc () - start) / cnt;
+
+  start = rdtsc ();
+  for (i = 0; i < cnt; i++)
+    rhash_delete (&h, &items[probe_order (i, cnt)].r_elem);
+  c->delete = (rdtsc () - start) / cnt;
+  if (!rhash_empty (&h))
+    fail ("rhash not empty after deleting everything");
+
+  rhash_destroy (&h, NULL);
+}
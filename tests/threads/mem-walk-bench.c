@@ -0,0 +1,52 @@
+/* Walks a large block of kernel memory through the direct map,
+   touching one cache line per page, so that nearly every access
+   needs a different 4 kB translation.  With the direct map built
+   from 2 MB or 1 GB pages the whole block needs a few TLB entries
+   instead of one per page.
+
+   This is a benchmark, not a pass/fail test.  Compare
+   `pintos -- -threads-tests run mem-walk-bench' against
+   `pintos -- -no-large-pages -threads-tests run mem-walk-bench'. */
+
+#include <stdint.h>
+#include <stdio.h>
+#include "tests/threads/tests.h"
+#include "threads/palloc.h"
+#include "threads/vaddr.h"
+#include "devices/timer.h"
+#include "intrinsic.h"
+
+/* Pages in the block walked. */
+#define WALK_PAGES 2048
+
+/* Times the block is walked. */
+#define PASSES 200
+
+void
+test_mem_walk_bench (void) 
+{
+  volatile uint8_t *block;
+  uint64_t start_cycles, cycles;
+  int64_t start_ticks, ticks;
+  unsigned sum = 0;
+  int pass_no, i;
+
+  block = palloc_get_multiple (PAL_USER | PAL_ASSERT, WALK_PAGES);
+
+  msg ("%d passes over %d pages, one cache line per page",
+       PASSES, WALK_PAGES);
+
+  start_ticks = timer_ticks ();
+  start_cycles = rdtsc ();
+  for (pass_no = 0; pass_no < PASSES; pass_no++)
+    for (i = 0; i < WALK_PAGES; i++)
+      sum += block[i * PGSIZE + (i % (PGSIZE / 64)) * 64];
+  cycles = rdtsc () - start_cycles;
+  ticks = timer_elapsed (start_ticks);
+
+  msg ("%lld ticks, %llu cycles, %llu cycles per access (checksum %u)",
+       ticks, cycles, cycles / ((uint64_t) PASSES * WALK_PAGES), sum);
+
+  palloc_free_multiple ((void *) block, WALK_PAGES);
+  pass ();
+}
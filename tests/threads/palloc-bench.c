@@ -0,0 +1,72 @@
+/* Measures single-page allocation throughput of the page
+   allocator, once through the per-thread page magazines
+   (palloc_get_page) and once straight from the pool bitmap
+   (palloc_get_multiple with a count of 1).
+
+   This is a benchmark, not a pass/fail test.  Run it with
+   `pintos -- -threads-tests run palloc-bench'. */
+
+#include <stdio.h>
+#include "tests/threads/tests.h"
+#include "threads/palloc.h"
+#include "devices/timer.h"
+
+/* Pages held at once by each round. */
+#define BURST 6
+
+/* Rounds of BURST allocations followed by BURST frees. */
+#define ROUNDS 20000
+
+static int64_t run_magazine (void);
+static int64_t run_pool (void);
+
+void
+test_palloc_bench (void) 
+{
+  int64_t ticks;
+
+  msg ("%d rounds of %d page allocs and frees", ROUNDS, BURST);
+
+  ticks = run_pool ();
+  msg ("pool:     %lld ticks", ticks);
+
+  ticks = run_magazine ();
+  msg ("magazine: %lld ticks", ticks);
+
+  palloc_print_stats ();
+  pass ();
+}
+
+static int64_t
+run_magazine (void) 
+{
+  void *pages[BURST];
+  int64_t start = timer_ticks ();
+  int r, i;
+
+  for (r = 0; r < ROUNDS; r++) 
+    {
+      for (i = 0; i < BURST; i++)
+        pages[i] = palloc_get_page (PAL_ASSERT);
+      for (i = 0; i < BURST; i++)
+        palloc_free_page (pages[i]);
+    }
+  return timer_elapsed (start);
+}
+
+static int64_t
+run_pool (void) 
+{
+  void *pages[BURST];
+  int64_t start = timer_ticks ();
+  int r, i;
+
+  for (r = 0; r < ROUNDS; r++) 
+    {
+      for (i = 0; i < BURST; i++)
+        pages[i] = palloc_get_multiple (PAL_ASSERT, 1);
+      for (i = 0; i < BURST; i++)
+        palloc_free_multiple (pages[i], 1);
+    }
+  return timer_elapsed (start);
+}
@@ -0,0 +1,260 @@
+/* Compares the radix-tree supplemental page table in vm/vm.c with
+   a hash-table SPT, of the kind built on lib/kernel/hash.c, on a
+   sparse 1 GB address space: one cluster of CLUSTER_PAGES pages
+   in each 2 MB of it.  For each, reports in cycles per page the
+   cost of insertion, of the lookup a page fault does for a
+   present page and for an absent one, of a walk over all pages
+   as fork and exit do, and of tearing the table down, and the
+   memory the table itself uses.
+
+   This is a benchmark, not a pass/fail test, though it fails if a
+   table loses a page.  It needs a VM kernel; run it with
+   `pintos -- -threads-tests run spt-bench'. */
+
+#ifdef VM
+#include <hash.h>
+#include <stdint.h>
+#include <stdio.h>
+#include "tests/threads/tests.h"
+#include "threads/malloc.h"
+#include "threads/vaddr.h"
+#include "threads/vmalloc.h"
+#include "vm/vm.h"
+#include "intrinsic.h"
+
+/* Address space layout. */
+#define SPACE_BASE ((uint8_t *) 0x10000000)
+#define SPACE_SIZE (1024 * 1024 * 1024)
+#define CLUSTER_STRIDE (2 * 1024 * 1024)
+#define CLUSTER_PAGES 16
+#define CLUSTER_CNT (SPACE_SIZE / CLUSTER_STRIDE)
+#define PAGE_CNT (CLUSTER_CNT * CLUSTER_PAGES)
+
+/* Lookups are repeated this many times over all pages. */
+#define ROUNDS 4
+
+/* A page in the hash SPT. */
+struct hpage
+  {
+    struct hash_elem elem;
+    struct page page;
+  };
+
+/* Costs of one run, in cycles per page, and bytes of table. */
+struct costs
+  {
+    uint64_t insert, hit, miss, walk, kill;
+    size_t bytes;
+  };
+
+static void run_radix (void **vas, struct costs *);
+static void run_hash (void **vas, struct costs *);
+
+void
+test_spt_bench (void)
+{
+  void **vas = kvcalloc (PAGE_CNT, sizeof *vas);
+  struct costs r, h;
+  size_t c, i;
+
+  if (vas == NULL)
+    fail ("out of memory");
+
+  /* Place cluster C at a pseudo-random page within its 2 MB. */
+  for (c = 0; c < CLUSTER_CNT; c++)
+    {
+      size_t slack = CLUSTER_STRIDE / PGSIZE - CLUSTER_PAGES;
+      uint8_t *start = SPACE_BASE + c * CLUSTER_STRIDE
+                       + (c * 40503 % slack) * PGSIZE;
+      for (i = 0; i < CLUSTER_PAGES; i++)
+        vas[c * CLUSTER_PAGES + i] = start + i * PGSIZE;
+    }
+
+  run_radix (vas, &r);
+  run_hash (vas, &h);
+
+  msg ("%d pages in %d clusters over 1 GB; cycles per page", PAGE_CNT,
+       CLUSTER_CNT);
+  msg ("         insert    hit   miss   walk   kill  table bytes");
+  msg ("radix  %7llu %6llu %6llu %6llu %6llu  %11zu",
+       r.insert, r.hit, r.miss, r.walk, r.kill, r.bytes);
+  msg ("hash   %7llu %6llu %6llu %6llu %6llu  %11zu",
+       h.insert, h.hit, h.miss, h.walk, h.kill, h.bytes);
+  kvfree (vas);
+  pass ();
+}
+
+/* Returns the index of the page looked up in round I, visiting
+   pages out of address order the way faults arrive. */
+static size_t
+probe_order (size_t i)
+{
+  return (i * 40503) % PAGE_CNT;
+}
+
+/* Returns an address in the gap after the cluster holding page
+   I, which no page covers. */
+static void *
+gap_addr (void **vas, size_t i)
+{
+  return (uint8_t *) vas[i - i % CLUSTER_PAGES] + CLUSTER_PAGES * PGSIZE;
+}
+
+/* Returns a new, never-loaded anonymous page at VA in P, or in a
+   fresh allocation if P is null. */
+static struct page *
+new_page (struct page *p, void *va)
+{
+  if (p == NULL && (p = malloc (sizeof *p)) == NULL)
+    fail ("out of memory");
+  uninit_new (p, va, NULL, VM_ANON, NULL, anon_initializer);
+  p->writable = true;
+  return p;
+}
+
+static bool
+count_page (struct page *page UNUSED, void *cnt_)
+{
+  size_t *cnt = cnt_;
+  (*cnt)++;
+  return true;
+}
+
+static void
+run_radix (void **vas, struct costs *c)
+{
+  struct supplemental_page_table spt;
+  uint64_t start;
+  size_t i, cnt = 0;
+  int round;
+
+  supplemental_page_table_init (&spt);
+
+  start = rdtsc ();
+  for (i = 0; i < PAGE_CNT; i++)
+    if (!spt_insert_page (&spt, new_page (NULL, vas[i])))
+      fail ("radix insert failed");
+  c->insert = (rdtsc () - start) / PAGE_CNT;
+  c->bytes = spt.node_cnt * PGSIZE;
+
+  start = rdtsc ();
+  for (round = 0; round < ROUNDS; round++)
+    for (i = 0; i < PAGE_CNT; i++)
+      {
+        void *va = vas[probe_order (i)];
+        struct page *p = spt_find_page (&spt, va);
+        if (p == NULL || p->va != va)
+          fail ("radix lost page %p", va);
+      }
+  c->hit = (rdtsc () - start) / (ROUNDS * PAGE_CNT);
+
+  start = rdtsc ();
+  for (round = 0; round < ROUNDS; round++)
+    for (i = 0; i < PAGE_CNT; i++)
+      if (spt_find_page (&spt, gap_addr (vas, probe_order (i))) != NULL)
+        fail ("radix found a page in a gap");
+  c->miss = (rdtsc () - start) / (ROUNDS * PAGE_CNT);
+
+  start = rdtsc ();
+  spt_for_each (&spt, count_page, &cnt);
+  c->walk = (rdtsc () - start) / PAGE_CNT;
+  if (cnt != PAGE_CNT)
+    fail ("radix walk saw %zu pages, not %d", cnt, PAGE_CNT);
+
+  start = rdtsc ();
+  supplemental_page_table_kill (&spt);
+  c->kill = (rdtsc () - start) / PAGE_CNT;
+  if (spt.node_cnt != 0)
+    fail ("radix kept %zu nodes after kill", spt.node_cnt);
+}
+
+static uint64_t
+hpage_hash (const struct hash_elem *e, void *aux UNUSED)
+{
+  const struct hpage *hp = hash_entry (e, struct hpage, elem);
+  return hash_bytes (&hp->page.va, sizeof hp->page.va);
+}
+
+static bool
+hpage_less (const struct hash_elem *a, const struct hash_elem *b,
+            void *aux UNUSED)
+{
+  return (hash_entry (a, struct hpage, elem)->page.va
+          < hash_entry (b, struct hpage, elem)->page.va);
+}
+
+/* Looks up VA in hash SPT H the way a fault handler would: with a
+   key page on the stack. */
+static struct page *
+hash_find_page (struct hash *h, void *va)
+{
+  struct hpage key;
+  struct hash_elem *e;
+
+  key.page.va = pg_round_down (va);
+  e = hash_find (h, &key.elem);
+  return e != NULL ? &hash_entry (e, struct hpage, elem)->page : NULL;
+}
+
+static void
+hpage_free (struct hash_elem *e, void *aux UNUSED)
+{
+  free (hash_entry (e, struct hpage, elem));
+}
+
+static void
+run_hash (void **vas, struct costs *c)
+{
+  struct hash h;
+  struct hash_iterator it;
+  uint64_t start;
+  size_t i, cnt = 0;
+  int round;
+
+  if (!hash_init (&h, hpage_hash, hpage_less, NULL))
+    fail ("hash_init failed");
+
+  start = rdtsc ();
+  for (i = 0; i < PAGE_CNT; i++)
+    {
+      struct hpage *hp = malloc (sizeof *hp);
+      if (hp == NULL)
+        fail ("out of memory");
+      new_page (&hp->page, vas[i]);
+      if (hash_insert (&h, &hp->elem) != NULL)
+        fail ("hash insert failed");
+    }
+  c->insert = (rdtsc () - start) / PAGE_CNT;
+  c->bytes = h.bucket_cnt * sizeof *h.buckets
+             + PAGE_CNT * sizeof (struct hash_elem);
+
+  start = rdtsc ();
+  for (round = 0; round < ROUNDS; round++)
+    for (i = 0; i < PAGE_CNT; i++)
+      {
+        void *va = vas[probe_order (i)];
+        struct page *p = hash_find_page (&h, va);
+        if (p == NULL || p->va != va)
+          fail ("hash lost page %p", va);
+      }
+  c->hit = (rdtsc () - start) / (ROUNDS * PAGE_CNT);
+
+  start = rdtsc ();
+  for (round = 0; round < ROUNDS; round++)
+    for (i = 0; i < PAGE_CNT; i++)
+      if (hash_find_page (&h, gap_addr (vas, probe_order (i))) != NULL)
+        fail ("hash found a page in a gap");
+  c->miss = (rdtsc () - start) / (ROUNDS * PAGE_CNT);
+
+  start = rdtsc ();
+  for (hash_first (&it, &h); hash_next (&it) != NULL; )
+    cnt++;
+  c->walk = (rdtsc () - start) / PAGE_CNT;
+  if (cnt != PAGE_CNT)
+    fail ("hash walk saw %zu pages, not %d", cnt, PAGE_CNT);
+
+  start = rdtsc ();
+  hash_destroy (&h, hpage_free);
+  c->kill = (rdtsc () - start) / PAGE_CNT;
+}
+#endif /* VM */
@@ -0,0 +1,157 @@
+/* Times memcpy(), memset(), memcmp(), memchr() and strlen() on
+   blocks from 1 byte to 64 kB, next to a byte-at-a-time copy loop
+   like the one memcpy() used to be.  Each operation is repeated
+   until about the same number of bytes has gone through it at
+   every size, and the cost is reported in cycles per call.
+
+   Before timing anything, checks the functions against byte loops
+   at every combination of source and destination alignment.
+
+   This is a benchmark, not a pass/fail test.  Run it with
+   `pintos -- -threads-tests run string-bench'. */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include "tests/threads/tests.h"
+#include "threads/palloc.h"
+#include "threads/vaddr.h"
+#include "intrinsic.h"
+
+/* Largest block timed, and pages for each buffer. */
+#define MAX_SIZE (64 * 1024)
+#define BUF_PAGES (MAX_SIZE / PGSIZE + 1)
+
+/* Bytes that go through each operation at each size. */
+#define BYTES_PER_SIZE (4 * 1024 * 1024)
+
+static uint8_t *src, *dst;
+
+static void check (void);
+static void byte_copy (uint8_t *, const uint8_t *, size_t);
+
+void
+test_string_bench (void) 
+{
+  size_t size;
+
+  src = palloc_get_multiple (PAL_ASSERT, BUF_PAGES);
+  dst = palloc_get_multiple (PAL_ASSERT, BUF_PAGES);
+  check ();
+
+  msg ("cycles per call:");
+  msg ("%6s %9s %9s %9s %9s %9s %9s",
+       "size", "bytecopy", "memcpy", "memset", "memcmp", "memchr", "strlen");
+  for (size = 1; size <= MAX_SIZE; size *= 4)
+    {
+      size_t iters = BYTES_PER_SIZE / size < 100000
+                     ? BYTES_PER_SIZE / size : 100000;
+      uint64_t cycles[6], start;
+      volatile size_t sink = 0;
+      size_t i;
+
+      memset (src, 'x', size);
+      src[size] = '\0';
+      memcpy (dst, src, size + 1);
+
+      start = rdtsc ();
+      for (i = 0; i < iters; i++)
+        byte_copy (dst, src, size);
+      cycles[0] = rdtsc () - start;
+
+      start = rdtsc ();
+      for (i = 0; i < iters; i++)
+        memcpy (dst, src, size);
+      cycles[1] = rdtsc () - start;
+
+      start = rdtsc ();
+      for (i = 0; i < iters; i++)
+        memset (dst, 'x', size);
+      cycles[2] = rdtsc () - start;
+
+      start = rdtsc ();
+      for (i = 0; i < iters; i++)
+        sink += memcmp (dst, src, size);
+      cycles[3] = rdtsc () - start;
+
+      start = rdtsc ();
+      for (i = 0; i < iters; i++)
+        sink += memchr (src, '\0', size) != NULL;
+      cycles[4] = rdtsc () - start;
+
+      start = rdtsc ();
+      for (i = 0; i < iters; i++)
+        sink += strlen ((char *) src);
+      cycles[5] = rdtsc () - start;
+
+      msg ("%6zu %9llu %9llu %9llu %9llu %9llu %9llu", size,
+           cycles[0] / iters, cycles[1] / iters, cycles[2] / iters,
+           cycles[3] / iters, cycles[4] / iters, cycles[5] / iters);
+    }
+
+  palloc_free_multiple (src, BUF_PAGES);
+  palloc_free_multiple (dst, BUF_PAGES);
+  pass ();
+}
+
+/* Copies SIZE bytes from S to D one byte at a time. */
+static void
+byte_copy (uint8_t *d, const uint8_t *s, size_t size) 
+{
+  while (size-- > 0)
+    *d++ = *s++;
+}
+
+/* Fails unless the string functions agree with byte loops for
+   sizes around every threshold they use, at every alignment. */
+static void
+check (void) 
+{
+  static const size_t sizes[] = {0, 1, 7, 8, 9, 63, 255, 256, 257, 4099};
+  size_t i, j, s_ofs, d_ofs;
+
+  for (i = 0; i < BUF_PAGES * PGSIZE; i++)
+    src[i] = i * 7 + i / 251 + 1;
+
+  for (i = 0; i < sizeof sizes / sizeof *sizes; i++)
+    for (s_ofs = 0; s_ofs < 8; s_ofs++)
+      for (d_ofs = 0; d_ofs < 8; d_ofs++) 
+        {
+          size_t size = sizes[i];
+          uint8_t *d = dst + d_ofs;
+          const uint8_t *s = src + s_ofs;
+
+          dst[d_ofs + size] = 0xaa;
+          memcpy (d, s, size);
+          for (j = 0; j < size; j++)
+            if (d[j] != s[j])
+              fail ("memcpy of %zu bytes wrong at byte %zu", size, j);
+          if (dst[d_ofs + size] != 0xaa)
+            fail ("memcpy of %zu bytes overran", size);
+          if (memcmp (d, s, size) != 0)
+            fail ("memcmp of %zu equal bytes is nonzero", size);
+          if (size > 0)
+            {
+              d[size - 1]++;
+              if (memcmp (d, s, size) <= 0)
+                fail ("memcmp of %zu bytes missed last byte", size);
+              for (j = 0; d[j] != d[size - 1]; j++)
+                continue;
+              if (memchr (d, d[size - 1], size) != d + j)
+                fail ("memchr in %zu bytes found the wrong byte", size);
+            }
+
+          memset (d, d_ofs, size);
+          for (j = 0; j < size; j++)
+            if (d[j] != d_ofs)
+              fail ("memset of %zu bytes wrong at byte %zu", size, j);
+          if (dst[d_ofs + size] != 0xaa)
+            fail ("memset of %zu bytes overran", size);
+
+          memset (d, 'x', size);
+          d[size] = '\0';
+          if (strlen ((char *) d) != size)
+            fail ("strlen of %zu-byte string wrong", size);
+        }
+  msg ("string functions agree with byte loops");
+}
@@ -38,6 +38,16 @@ static const struct test tests[] =
     {"mlfqs-nice-2", test_mlfqs_nice_2},
     {"mlfqs-nice-10", test_mlfqs_nice_10},
     {"mlfqs-block", test_mlfqs_block},
+    {"palloc-bench", test_palloc_bench},
+    {"mem-walk-bench", test_mem_walk_bench},
+    {"string-bench", test_string_bench},
+    {"bitmap-bench", test_bitmap_bench},
+    {"hash-bench", test_hash_bench},
+#ifdef VM
+    {"spt-bench", test_spt_bench},
+    {"evict-bench", test_evict_bench},
+    {"fork-bench", test_fork_bench},
+#endif
   };
 
 static const char *test_name;
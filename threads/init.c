@@ -13,13 +13,19 @@
 #include "devices/serial.h"
 #include "devices/timer.h"
 #include "devices/vga.h"
+#include "intrinsic.h"
 #include "threads/interrupt.h"
 #include "threads/io.h"
 #include "threads/loader.h"
 #include "threads/malloc.h"
+#include "threads/memacct.h"
 #include "threads/mmu.h"
 #include "threads/palloc.h"
+#include "threads/scratch.h"
+#include "threads/shrinker.h"
 #include "threads/pte.h"
+#include "threads/slab.h"
+#include "threads/vmalloc.h"
 #include "threads/thread.h"
 #ifdef USERPROG
 #include "userprog/process.h"
@@ -46,6 +52,13 @@ uint64_t *base_pml4;
 static bool format_filesys;
 #endif
 
+/* -no-large-pages: Map physical memory with 4 kB pages only? */
+static bool no_large_pages;
+
+/* Direct map statistics. */
+static size_t direct_map_cnt[3];        /* # of 4 kB, 2 MB, 1 GB pages. */
+static uint64_t direct_map_cycles;      /* TSC cycles paging_init() took. */
+
 /* -q: Power off after kernel tasks complete? */
 bool power_off_when_done;
 
@@ -53,6 +66,7 @@ bool thread_tests;
 
 static void bss_init (void);
 static void paging_init (uint64_t mem_end);
+static bool cpu_has_gb_pages (void);
 
 static char **read_command_line (void);
 static char **parse_options (char **argv);
@@ -86,6 +100,8 @@ main (void) {
 	mem_end = palloc_init ();
 	malloc_init ();
 	paging_init (mem_end);
+	vmalloc_init ();
+	memacct_init ();
 
 #ifdef USERPROG
 	tss_init ();
@@ -114,6 +130,7 @@ main (void) {
 
 #ifdef VM
 	vm_init ();
+	palloc_compactd_start ();
 #endif
 
 	printf ("Boot complete.\n");
@@ -142,29 +159,73 @@ bss_init (void) {
 
 /* Populates the page table with the kernel virtual mapping,
  * and then sets up the CPU to use the new page directory.
- * Points base_pml4 to the pml4 it creates. */
+ * Points base_pml4 to the pml4 it creates.
+ *
+ * Physical memory is mapped with the largest pages that fit:
+ * 1 GB pages where the CPU supports them, then 2 MB pages, and
+ * 4 kB pages only for the ragged end of memory and for the large
+ * pages that would overlap the kernel text, which must stay
+ * read-only.  That takes a handful of page-table pages instead of
+ * one per 2 MB of RAM, and the kernel's accesses to memory through
+ * the direct map need far fewer TLB entries. */
 static void
 paging_init (uint64_t mem_end) {
 	uint64_t *pml4, *pte;
+	uint64_t pa, size, start_cycles;
+	bool gb_pages = !no_large_pages && cpu_has_gb_pages ();
 	int perm;
+
+	start_cycles = rdtsc ();
 	pml4 = base_pml4 = palloc_get_page (PAL_ASSERT | PAL_ZERO);
 
 	extern char start, _end_kernel_text;
+	const uint64_t text_start = vtop (&start);
+	const uint64_t text_end = vtop (&_end_kernel_text);
+
 	// Maps physical address [0 ~ mem_end] to
 	//   [LOADER_KERN_BASE ~ LOADER_KERN_BASE + mem_end].
-	for (uint64_t pa = 0; pa < mem_end; pa += PGSIZE) {
+	for (pa = 0; pa < mem_end; pa += size) {
 		uint64_t va = (uint64_t) ptov(pa);
 
-		perm = PTE_P | PTE_W;
-		if ((uint64_t) &start <= va && va < (uint64_t) &_end_kernel_text)
-			perm &= ~PTE_W;
+		size = PGSIZE;
+		if (!no_large_pages)
+			for (size = gb_pages ? PDPE_PGSIZE : PDE_PGSIZE; size > PGSIZE;
+					size >>= 9)
+				if (pa % size == 0 && pa + size <= mem_end
+						&& (pa + size <= text_start || pa >= text_end))
+					break;
 
-		if ((pte = pml4e_walk (pml4, va, 1)) != NULL)
+		perm = PTE_P | PTE_W;
+		if (size == PGSIZE) {
+			if (text_start <= pa && pa < text_end)
+				perm &= ~PTE_W;
+			pte = pml4e_walk (pml4, va, 1);
+		} else {
+			perm |= PTE_PS;
+			pte = pml4e_walk_large (pml4, va, size, 1);
+		}
+
+		if (pte != NULL) {
 			*pte = pa | perm;
+			direct_map_cnt[size == PGSIZE ? 0 : size == PDE_PGSIZE ? 1 : 2]++;
+		}
 	}
 
 	// reload cr3
 	pml4_activate(0);
+	direct_map_cycles = rdtsc () - start_cycles;
+}
+
+/* Returns true if the CPU supports 1 GB pages. */
+static bool
+cpu_has_gb_pages (void) {
+	uint32_t a, b, c, d;
+
+	cpuid (0x80000000, &a, &b, &c, &d);
+	if (a < 0x80000001)
+		return false;
+	cpuid (0x80000001, &a, &b, &c, &d);
+	return (d & (1u << 26)) != 0;
 }
 
 /* Breaks the kernel command line into words and returns them as
@@ -221,11 +282,26 @@ parse_options (char **argv) {
 			random_init (atoi (value));
 		else if (!strcmp (name, "-mlfqs"))
 			thread_mlfqs = true;
+		else if (!strcmp (name, "-no-large-pages"))
+			no_large_pages = true;
+		else if (!strcmp (name, "-memleak"))
+			memacct_trace = true;
 #ifdef USERPROG
 		else if (!strcmp (name, "-ul"))
 			user_page_limit = atoi (value);
 		else if (!strcmp (name, "-threads-tests"))
 			thread_tests = true;
+#endif
+#ifdef VM
+		else if (!strcmp (name, "-evict")) {
+			if (value == NULL || !frame_set_policy (value))
+				PANIC ("unknown eviction policy `%s' (use -h for help)", value);
+		}
+		else if (!strcmp (name, "-fault-around")) {
+			if (value == NULL || atoi (value) <= 0)
+				PANIC ("bad fault-around window `%s' (use -h for help)", value);
+			vm_fault_around = atoi (value);
+		}
 #endif
 		else
 			PANIC ("unknown option `%s' (use -h for help)", name);
@@ -326,8 +402,14 @@ usage (void) {
 			"  -f                 Format file system disk during startup.\n"
 			"  -rs=SEED           Set random number seed to SEED.\n"
 			"  -mlfqs             Use multi-level feedback queue scheduler.\n"
+			"  -no-large-pages    Map physical memory with 4 kB pages only.\n"
+			"  -memleak           List memory threads still hold at exit.\n"
 #ifdef USERPROG
 			"  -ul=COUNT          Limit user memory to COUNT pages.\n"
+#endif
+#ifdef VM
+			"  -evict=POLICY      Evict pages by POLICY: clock, 2q or lru.\n"
+			"  -fault-around=N    Read up to N file pages in one page fault.\n"
 #endif
 			);
 	power_off ();
@@ -353,7 +435,19 @@ power_off (void) {
 static void
 print_stats (void) {
 	timer_print_stats ();
+	printf ("Paging: direct map uses %zu 1 GB, %zu 2 MB and %zu 4 kB pages, "
+			"built in %llu cycles\n", direct_map_cnt[2], direct_map_cnt[1],
+			direct_map_cnt[0], direct_map_cycles);
 	thread_print_stats ();
+	palloc_print_stats ();
+	shrinker_print_stats ();
+	kmem_cache_print_stats ();
+	vmalloc_print_stats ();
+	memacct_print_stats ();
+	scratch_print_stats ();
+#ifdef VM
+	vm_print_stats ();
+#endif
 #ifdef FILESYS
 	disk_print_stats ();
 #endif
@@ -1,81 +1,82 @@
 #include "threads/malloc.h"
 #include <debug.h>
-#include <list.h>
 #include <round.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <string.h>
+#include "threads/memacct.h"
 #include "threads/palloc.h"
-#include "threads/synch.h"
+#include "threads/slab.h"
 #include "threads/vaddr.h"
 
 /* A simple implementation of malloc().
 
-   The size of each request, in bytes, is rounded up to a power
-   of 2 and assigned to the "descriptor" that manages blocks of
-   that size.  The descriptor keeps a list of free blocks.  If
-   the free list is nonempty, one of its blocks is used to
-   satisfy the request.
+   Requests of up to SMALL_MAX bytes are served by one of a set of
+   "kmalloc" object caches (see slab.c).  The size classes are
+   spaced more finely than powers of 2, so that, e.g., a 544-byte
+   request costs a 768-byte object rather than a 1 kB block, and
+   the class for a request is found in O(1) through size_to_class[]
+   instead of by walking the classes.
 
-   Otherwise, a new page of memory, called an "arena", is
-   obtained from the page allocator (if none is available,
-   malloc() returns a null pointer).  The new arena is divided
-   into blocks, all of which are added to the descriptor's free
-   list.  Then we return one of the new blocks.
-
-   When we free a block, we add it to its descriptor's free list.
-   But if the arena that the block was in now has no in-use
-   blocks, we remove all of the arena's blocks from the free list
-   and give the arena back to the page allocator.
-
-   We can't handle blocks bigger than 2 kB using this scheme,
-   because they're too big to fit in a single page with a
-   descriptor.  We handle those by allocating contiguous pages
+   Larger requests are handled by allocating contiguous pages
    with the page allocator and sticking the allocation size at
-   the beginning of the allocated block's arena header. */
+   the beginning of the allocated block's header.  free() tells
+   the two apart by the magic number at the start of the page the
+   block lives in.
 
-/* Descriptor. */
-struct desc {
-	size_t block_size;          /* Size of each element in bytes. */
-	size_t blocks_per_arena;    /* Number of blocks in an arena. */
-	struct list free_list;      /* List of free blocks. */
-	struct lock lock;           /* Lock. */
+   Structures allocated in large numbers and with awkward sizes
+   should get their own cache through kmem_cache_create() instead
+   of going through malloc(). */
+
+/* Size classes.  Each must be a multiple of CLASS_STEP. */
+static const size_t class_sizes[] = {
+	16, 32, 48, 64, 96, 128, 192, 256, 384, 512, 768, 1024, 1536,
+};
+#define CLASS_CNT (sizeof class_sizes / sizeof *class_sizes)
+#define CLASS_STEP 16
+#define SMALL_MAX 1536
+
+/* Cache names, for statistics. */
+static const char *class_names[CLASS_CNT] = {
+	"kmalloc-16", "kmalloc-32", "kmalloc-48", "kmalloc-64", "kmalloc-96",
+	"kmalloc-128", "kmalloc-192", "kmalloc-256", "kmalloc-384",
+	"kmalloc-512", "kmalloc-768", "kmalloc-1024", "kmalloc-1536",
 };
 
-/* Magic number for detecting arena corruption. */
-#define ARENA_MAGIC 0x9a548eed
+/* Cache for each size class. */
+static struct kmem_cache *class_caches[CLASS_CNT];
 
-/* Arena. */
-struct arena {
-	unsigned magic;             /* Always set to ARENA_MAGIC. */
-	struct desc *desc;          /* Owning descriptor, null for big block. */
-	size_t free_cnt;            /* Free blocks; pages in big block. */
-};
+/* Maps DIV_ROUND_UP (size, CLASS_STEP) to the index of the
+   smallest class that fits SIZE bytes. */
+static uint8_t size_to_class[SMALL_MAX / CLASS_STEP + 1];
 
-/* Free block. */
-struct block {
-	struct list_elem free_elem; /* Free list element. */
-};
+/* Magic number for detecting big block corruption. */
+#define BIG_MAGIC 0x9a548eed
 
-/* Our set of descriptors. */
-static struct desc descs[10];   /* Descriptors. */
-static size_t desc_cnt;         /* Number of descriptors. */
+/* Header of a big block. */
+struct big_block {
+	unsigned magic;             /* Always set to BIG_MAGIC. */
+	size_t page_cnt;            /* Number of pages in the block. */
+};
 
-static struct arena *block_to_arena (struct block *);
-static struct block *arena_to_block (struct arena *, size_t idx);
+static void *malloc_at (size_t, const void *site);
+static struct big_block *block_to_big (void *);
 
-/* Initializes the malloc() descriptors. */
+/* Initializes the slab allocator and the malloc() size classes. */
 void
 malloc_init (void) {
-	size_t block_size;
+	size_t cls, i;
 
-	for (block_size = 16; block_size < PGSIZE / 2; block_size *= 2) {
-		struct desc *d = &descs[desc_cnt++];
-		ASSERT (desc_cnt <= sizeof descs / sizeof *descs);
-		d->block_size = block_size;
-		d->blocks_per_arena = (PGSIZE - sizeof (struct arena)) / block_size;
-		list_init (&d->free_list);
-		lock_init (&d->lock);
+	kmem_cache_init ();
+	for (cls = i = 0; i < sizeof size_to_class; i++) {
+		while (class_sizes[cls] < i * CLASS_STEP)
+			cls++;
+		size_to_class[i] = cls;
+	}
+	for (cls = 0; cls < CLASS_CNT; cls++) {
+		class_caches[cls] = kmem_cache_create (class_names[cls],
+				class_sizes[cls], CLASS_STEP, NULL, MEM_MISC);
+		ASSERT (class_caches[cls] != NULL);
 	}
 }
 
@@ -83,64 +84,42 @@ malloc_init (void) {
    Returns a null pointer if memory is not available. */
 void *
 malloc (size_t size) {
-	struct desc *d;
-	struct block *b;
-	struct arena *a;
+	return malloc_at (size, __builtin_return_address (0));
+}
+
+/* Implements malloc() on behalf of a caller at SITE, which is
+   what memory accounting records as the allocation site. */
+static void *
+malloc_at (size_t size, const void *site) {
+	struct big_block *b;
+	size_t page_cnt;
+	void *p;
 
 	/* A null pointer satisfies a request for 0 bytes. */
 	if (size == 0)
 		return NULL;
 
-	/* Find the smallest descriptor that satisfies a SIZE-byte
-	   request. */
-	for (d = descs; d < descs + desc_cnt; d++)
-		if (d->block_size >= size)
-			break;
-	if (d == descs + desc_cnt) {
-		/* SIZE is too big for any descriptor.
-		   Allocate enough pages to hold SIZE plus an arena. */
-		size_t page_cnt = DIV_ROUND_UP (size + sizeof *a, PGSIZE);
-		a = palloc_get_multiple (0, page_cnt);
-		if (a == NULL)
-			return NULL;
-
-		/* Initialize the arena to indicate a big block of PAGE_CNT
-		   pages, and return it. */
-		a->magic = ARENA_MAGIC;
-		a->desc = NULL;
-		a->free_cnt = page_cnt;
-		return a + 1;
+	if (size <= SMALL_MAX) {
+		p = kmem_cache_alloc (
+				class_caches[size_to_class[DIV_ROUND_UP (size, CLASS_STEP)]]);
+		if (p != NULL)
+			memacct_set_site (p, site);
+		return p;
 	}
 
-	lock_acquire (&d->lock);
-
-	/* If the free list is empty, create a new arena. */
-	if (list_empty (&d->free_list)) {
-		size_t i;
-
-		/* Allocate a page. */
-		a = palloc_get_page (0);
-		if (a == NULL) {
-			lock_release (&d->lock);
-			return NULL;
-		}
-
-		/* Initialize arena and add its blocks to the free list. */
-		a->magic = ARENA_MAGIC;
-		a->desc = d;
-		a->free_cnt = d->blocks_per_arena;
-		for (i = 0; i < d->blocks_per_arena; i++) {
-			struct block *b = arena_to_block (a, i);
-			list_push_back (&d->free_list, &b->free_elem);
-		}
-	}
+	/* SIZE is too big for any size class.
+	   Allocate enough pages to hold SIZE plus a header. */
+	page_cnt = DIV_ROUND_UP (size + sizeof *b, PGSIZE);
+	b = palloc_get_multiple (0, page_cnt);
+	if (b == NULL)
+		return NULL;
+	memacct_set_site (b, site);
 
-	/* Get a block from free list and return it. */
-	b = list_entry (list_pop_front (&d->free_list), struct block, free_elem);
-	a = block_to_arena (b);
-	a->free_cnt--;
-	lock_release (&d->lock);
-	return b;
+	/* Initialize the header to indicate a big block of PAGE_CNT
+	   pages, and return it. */
+	b->magic = BIG_MAGIC;
+	b->page_cnt = page_cnt;
+	return b + 1;
 }
 
 /* Allocates and return A times B bytes initialized to zeroes.
@@ -156,7 +135,7 @@ calloc (size_t a, size_t b) {
 		return NULL;
 
 	/* Allocate and zero memory. */
-	p = malloc (size);
+	p = malloc_at (size, __builtin_return_address (0));
 	if (p != NULL)
 		memset (p, 0, size);
 
@@ -166,11 +145,11 @@ calloc (size_t a, size_t b) {
 /* Returns the number of bytes allocated for BLOCK. */
 static size_t
 block_size (void *block) {
-	struct block *b = block;
-	struct arena *a = block_to_arena (b);
-	struct desc *d = a->desc;
+	struct kmem_cache *cache = kmem_cache_of (block);
 
-	return d != NULL ? d->block_size : PGSIZE * a->free_cnt - pg_ofs (block);
+	if (cache != NULL)
+		return kmem_cache_size (cache);
+	return PGSIZE * block_to_big (block)->page_cnt - pg_ofs (block);
 }
 
 /* Attempts to resize OLD_BLOCK to NEW_SIZE bytes, possibly
@@ -185,7 +164,7 @@ realloc (void *old_block, size_t new_size) {
 		free (old_block);
 		return NULL;
 	} else {
-		void *new_block = malloc (new_size);
+		void *new_block = malloc_at (new_size, __builtin_return_address (0));
 		if (old_block != NULL && new_block != NULL) {
 			size_t old_size = block_size (old_block);
 			size_t min_size = new_size < old_size ? new_size : old_size;
@@ -201,68 +180,28 @@ realloc (void *old_block, size_t new_size) {
 void
 free (void *p) {
 	if (p != NULL) {
-		struct block *b = p;
-		struct arena *a = block_to_arena (b);
-		struct desc *d = a->desc;
-
-		if (d != NULL) {
-			/* It's a normal block.  We handle it here. */
-
-#ifndef NDEBUG
-			/* Clear the block to help detect use-after-free bugs. */
-			memset (b, 0xcc, d->block_size);
-#endif
+		struct kmem_cache *cache = kmem_cache_of (p);
 
-			lock_acquire (&d->lock);
-
-			/* Add block to free list. */
-			list_push_front (&d->free_list, &b->free_elem);
-
-			/* If the arena is now entirely unused, free it. */
-			if (++a->free_cnt >= d->blocks_per_arena) {
-				size_t i;
-
-				ASSERT (a->free_cnt == d->blocks_per_arena);
-				for (i = 0; i < d->blocks_per_arena; i++) {
-					struct block *b = arena_to_block (a, i);
-					list_remove (&b->free_elem);
-				}
-				palloc_free_page (a);
-			}
-
-			lock_release (&d->lock);
+		if (cache != NULL) {
+			/* It's a small block.  Its cache handles it. */
+			kmem_cache_free (cache, p);
 		} else {
 			/* It's a big block.  Free its pages. */
-			palloc_free_multiple (a, a->free_cnt);
-			return;
+			struct big_block *b = block_to_big (p);
+			palloc_free_multiple (b, b->page_cnt);
 		}
 	}
 }
-
-/* Returns the arena that block B is inside. */
-static struct arena *
-block_to_arena (struct block *b) {
-	struct arena *a = pg_round_down (b);
 
-	/* Check that the arena is valid. */
-	ASSERT (a != NULL);
-	ASSERT (a->magic == ARENA_MAGIC);
+/* Returns the header of big block P. */
+static struct big_block *
+block_to_big (void *p) {
+	struct big_block *b = pg_round_down (p);
 
-	/* Check that the block is properly aligned for the arena. */
-	ASSERT (a->desc == NULL
-			|| (pg_ofs (b) - sizeof *a) % a->desc->block_size == 0);
-	ASSERT (a->desc != NULL || pg_ofs (b) == sizeof *a);
+	/* Check that the block is valid. */
+	ASSERT (b != NULL);
+	ASSERT (b->magic == BIG_MAGIC);
+	ASSERT (pg_ofs (p) == sizeof *b);
 
-	return a;
-}
-
-/* Returns the (IDX - 1)'th block within arena A. */
-static struct block *
-arena_to_block (struct arena *a, size_t idx) {
-	ASSERT (a != NULL);
-	ASSERT (a->magic == ARENA_MAGIC);
-	ASSERT (idx < a->desc->blocks_per_arena);
-	return (struct block *) ((uint8_t *) a
-			+ sizeof *a
-			+ idx * a->desc->block_size);
+	return b;
 }
@@ -0,0 +1,329 @@
+#include "threads/memacct.h"
+#include <debug.h>
+#include <hash.h>
+#include <stdint.h>
+#include <stdio.h>
+#include "threads/interrupt.h"
+#include "threads/vaddr.h"
+#include "threads/vmalloc.h"
+
+/* Kernel memory accounting.
+
+   Every allocation made through palloc_get_page(),
+   palloc_get_multiple(), malloc() or kmem_cache_alloc() is
+   charged to a tag naming the subsystem it serves: pages by the
+   PAL_TAG() passed in the palloc flags, objects by the tag their
+   cache was created with (kmalloc caches are MEM_MISC).  The
+   allocators credit the tag back when the memory is freed, so the
+   counters always show what each subsystem holds, and the peaks
+   show the most it ever held.  Pages that back slabs are charged
+   as pages to their cache's tag, and the objects in them as bytes.
+
+   With -memleak, each allocation is also recorded together with
+   the thread that made it and its call site (a return address
+   that the `backtrace' utility translates).  When a thread exits,
+   whatever it still owns is listed and forgotten.  Inodes and
+   thread structures outlive the thread that allocates them by
+   design, so they are not listed.
+
+   Records live in a fixed open-addressed table allocated at boot,
+   so that recording never allocates memory itself and works from
+   any context, including the page frees done by do_schedule().
+   Accounting is done with interrupts off for the same reason. */
+
+/* An allocation recorded for -memleak. */
+struct mem_record {
+	const void *ptr;            /* Start of allocation, null if empty. */
+	const void *site;           /* Caller of the allocator. */
+	size_t size;                /* Bytes allocated. */
+	tid_t owner;                /* Thread charged with it. */
+	enum mem_tag tag;           /* Tag charged. */
+};
+
+/* Number of slots in the record table.  Must be a power of 2.  At
+   most three quarters of them are used. */
+#define RECORD_SLOTS 16384
+
+bool memacct_trace;
+
+static const char *tag_names[MEM_TAG_CNT] = {
+	"misc", "thread", "fdt", "file", "inode", "dir", "vm", "disk", "scratch",
+};
+
+static struct mem_usage usage[MEM_TAG_CNT];
+
+static struct mem_record *records;  /* Record table, or null. */
+static size_t record_cnt;           /* Number of records in use. */
+static long long untracked_cnt;     /* # of allocations not recorded. */
+
+static size_t record_home (const void *ptr);
+static bool record_insert (const struct mem_record *);
+static struct mem_record *record_find (const void *ptr);
+static void record_remove (struct mem_record *);
+static bool is_owned_tag (enum mem_tag);
+
+/* Allocates the record table if -memleak was given.  Allocations
+   made before this are counted but not recorded. */
+void
+memacct_init (void) {
+	if (!memacct_trace)
+		return;
+	records = kvcalloc (RECORD_SLOTS, sizeof *records);
+	if (records == NULL)
+		PANIC ("memacct: cannot allocate record table");
+}
+
+/* Charges an allocation of BYTES bytes in objects and PAGES pages
+   to TAG.  If PTR is nonnull and -memleak is in effect, records it
+   as allocated by the running thread at SITE. */
+void
+memacct_alloc (enum mem_tag tag, const void *ptr, size_t bytes,
+		size_t pages, const void *site) {
+	struct mem_usage *u = &usage[tag];
+	enum intr_level old_level;
+
+	ASSERT (tag < MEM_TAG_CNT);
+
+	old_level = intr_disable ();
+	u->allocs++;
+	u->bytes += bytes;
+	if (u->bytes > u->peak_bytes)
+		u->peak_bytes = u->bytes;
+	u->pages += pages;
+	if (u->pages > u->peak_pages)
+		u->peak_pages = u->pages;
+
+	if (records != NULL && ptr != NULL) {
+		struct mem_record r = {
+			.ptr = ptr,
+			.site = site,
+			.size = bytes + pages * PGSIZE,
+			.owner = thread_tid (),
+			.tag = tag,
+		};
+		if (!record_insert (&r))
+			untracked_cnt++;
+	}
+	intr_set_level (old_level);
+}
+
+/* Credits TAG with BYTES bytes in objects and PAGES pages freed at
+   PTR, and forgets PTR's record, if any. */
+void
+memacct_free (enum mem_tag tag, const void *ptr, size_t bytes,
+		size_t pages) {
+	struct mem_usage *u = &usage[tag];
+	enum intr_level old_level;
+
+	ASSERT (tag < MEM_TAG_CNT);
+
+	old_level = intr_disable ();
+	u->bytes -= bytes;
+	u->pages -= pages;
+	if (records != NULL && ptr != NULL) {
+		struct mem_record *r = record_find (ptr);
+		if (r != NULL)
+			record_remove (r);
+	}
+	intr_set_level (old_level);
+}
+
+/* Charges the allocation at PTR to thread OWNER instead of the
+   thread that made it, for memory allocated on another thread's
+   behalf. */
+void
+memacct_set_owner (const void *ptr, tid_t owner) {
+	enum intr_level old_level;
+	struct mem_record *r;
+
+	if (records == NULL)
+		return;
+
+	old_level = intr_disable ();
+	r = record_find (ptr);
+	if (r != NULL)
+		r->owner = owner;
+	intr_set_level (old_level);
+}
+
+/* Records SITE as the call site of the allocation at PTR, for
+   allocators built on top of other allocators. */
+void
+memacct_set_site (const void *ptr, const void *site) {
+	enum intr_level old_level;
+	struct mem_record *r;
+
+	if (records == NULL)
+		return;
+
+	old_level = intr_disable ();
+	r = record_find (ptr);
+	if (r != NULL)
+		r->site = site;
+	intr_set_level (old_level);
+}
+
+/* Moves the record of the allocation at OLD, if any, to NEW, for
+   memory that has been migrated. */
+void
+memacct_move (const void *old, const void *new) {
+	enum intr_level old_level;
+	struct mem_record *r, rec;
+
+	if (records == NULL)
+		return;
+
+	old_level = intr_disable ();
+	r = record_find (old);
+	if (r != NULL) {
+		rec = *r;
+		record_remove (r);
+		rec.ptr = new;
+		record_insert (&rec);
+	}
+	intr_set_level (old_level);
+}
+
+/* Stores the memory currently charged to TAG in *U. */
+void
+memacct_usage (enum mem_tag tag, struct mem_usage *u) {
+	enum intr_level old_level;
+
+	ASSERT (tag < MEM_TAG_CNT);
+
+	old_level = intr_disable ();
+	*u = usage[tag];
+	intr_set_level (old_level);
+}
+
+/* Returns the name of TAG. */
+const char *
+memacct_tag_name (enum mem_tag tag) {
+	ASSERT (tag < MEM_TAG_CNT);
+	return tag_names[tag];
+}
+
+/* Called when the running thread exits.  With -memleak, prints and
+   forgets every allocation the thread still owns. */
+void
+memacct_exit (void) {
+	tid_t tid = thread_tid ();
+	size_t i = 0;
+
+	if (records == NULL)
+		return;
+
+	while (i < RECORD_SLOTS) {
+		struct mem_record r;
+		enum intr_level old_level = intr_disable ();
+
+		if (records[i].ptr == NULL || records[i].owner != tid
+				|| !is_owned_tag (records[i].tag)) {
+			intr_set_level (old_level);
+			i++;
+			continue;
+		}
+
+		/* Removing may move another record into slot I, so look at
+		   slot I again. */
+		r = records[i];
+		record_remove (&records[i]);
+		intr_set_level (old_level);
+
+		printf ("%s: leaked %zu bytes of %s at %p, allocated at %p\n",
+				thread_name (), r.size, tag_names[r.tag], r.ptr, r.site);
+	}
+}
+
+/* Prints memory accounting statistics. */
+void
+memacct_print_stats (void) {
+	int tag;
+
+	printf ("Memory: %-6s %10s %10s %7s %7s %9s\n", "tag",
+			"bytes", "peak", "pages", "peak", "allocs");
+	for (tag = 0; tag < MEM_TAG_CNT; tag++) {
+		struct mem_usage u;
+
+		memacct_usage (tag, &u);
+		printf ("Memory: %-6s %10lld %10lld %7lld %7lld %9lld\n",
+				tag_names[tag], u.bytes, u.peak_bytes, u.pages, u.peak_pages,
+				u.allocs);
+	}
+	if (records != NULL)
+		printf ("Memory: %zu allocations recorded, %lld not recorded\n",
+				record_cnt, untracked_cnt);
+}
+
+/* Returns the slot where a record for PTR would ideally go. */
+static size_t
+record_home (const void *ptr) {
+	return hash_bytes (&ptr, sizeof ptr) & (RECORD_SLOTS - 1);
+}
+
+/* Adds a copy of R to the record table.  Returns false if the
+   table is too full.  Interrupts must be off. */
+static bool
+record_insert (const struct mem_record *r) {
+	size_t i;
+
+	ASSERT (intr_get_level () == INTR_OFF);
+
+	if (record_cnt >= RECORD_SLOTS / 4 * 3)
+		return false;
+	for (i = record_home (r->ptr); records[i].ptr != NULL;
+			i = (i + 1) & (RECORD_SLOTS - 1))
+		continue;
+	records[i] = *r;
+	record_cnt++;
+	return true;
+}
+
+/* Returns the record for PTR, or a null pointer if there is none.
+   Interrupts must be off. */
+static struct mem_record *
+record_find (const void *ptr) {
+	size_t i;
+
+	for (i = record_home (ptr); records[i].ptr != NULL;
+			i = (i + 1) & (RECORD_SLOTS - 1))
+		if (records[i].ptr == ptr)
+			return &records[i];
+	return NULL;
+}
+
+/* Removes record R, shifting back the records after it that
+   would otherwise become unreachable.  Interrupts must be off. */
+static void
+record_remove (struct mem_record *r) {
+	size_t hole = r - records;
+	size_t i = hole;
+
+	ASSERT (intr_get_level () == INTR_OFF);
+
+	records[hole].ptr = NULL;
+	for (;;) {
+		size_t home;
+
+		i = (i + 1) & (RECORD_SLOTS - 1);
+		if (records[i].ptr == NULL)
+			break;
+
+		/* The record at I may fill the hole only if its home is not
+		   in the cyclic range (HOLE, I]. */
+		home = record_home (records[i].ptr);
+		if (hole < i ? home <= hole || home > i : home <= hole && home > i) {
+			records[hole] = records[i];
+			records[i].ptr = NULL;
+			hole = i;
+		}
+	}
+	record_cnt--;
+}
+
+/* Returns true if memory charged to TAG belongs to the thread
+   that allocated it, false if it is expected to outlive it. */
+static bool
+is_owned_tag (enum mem_tag tag) {
+	return tag != MEM_INODE && tag != MEM_THREAD;
+}
@@ -3,6 +3,7 @@
 #include <string.h>
 #include "threads/init.h"
 #include "threads/pte.h"
+#include "threads/memacct.h"
 #include "threads/palloc.h"
 #include "threads/thread.h"
 #include "threads/mmu.h"
@@ -22,7 +23,7 @@ pgdir_walk (uint64_t *pdp, const uint64_t va, int create) {
 		uint64_t *pte = (uint64_t *) pdp[idx];
 		if (!((uint64_t) pte & PTE_P)) {
 			if (create) {
-				uint64_t *new_page = palloc_get_page (PAL_ZERO);
+				uint64_t *new_page = palloc_get_page (PAL_ZERO | PAL_TAG (MEM_VM));
 				if (new_page)
 					pdp[idx] = vtop (new_page) | PTE_U | PTE_W | PTE_P;
 				else
@@ -30,6 +31,8 @@ pgdir_walk (uint64_t *pdp, const uint64_t va, int create) {
 			} else
 				return NULL;
 		}
+		if (pdp[idx] & PTE_PS)
+			return &pdp[idx];
 		return (uint64_t *) ptov (PTE_ADDR (pdp[idx]) + 8 * PTX (va));
 	}
 	return NULL;
@@ -52,7 +55,7 @@ pdpe_walk (uint64_t *pdpe, const uint64_t va, int create) {
 		uint64_t *pde = (uint64_t *) pdpe[idx];
 		if (!((uint64_t) pde & PTE_P)) {
 			if (create) {
-				uint64_t *new_page = palloc_get_page (PAL_ZERO);
+				uint64_t *new_page = palloc_get_page (PAL_ZERO | PAL_TAG (MEM_VM));
 				if (new_page) {
 					pdpe[idx] = vtop (new_page) | PTE_U | PTE_W | PTE_P;
 					allocated = 1;
@@ -61,6 +64,8 @@ pdpe_walk (uint64_t *pdpe, const uint64_t va, int create) {
 			} else
 				return NULL;
 		}
+		if (pdpe[idx] & PTE_PS)
+			return &pdpe[idx];
 		pte = pgdir_walk (ptov (PTE_ADDR (pdpe[idx])), va, create);
 	}
 	if (pte == NULL && allocated) {
@@ -75,7 +80,9 @@ pdpe_walk (uint64_t *pdpe, const uint64_t va, int create) {
  * If PML4E does not have a page table for VADDR, behavior depends
  * on CREATE.  If CREATE is true, then a new page table is
  * created and a pointer into it is returned.  Otherwise, a null
- * pointer is returned. */
+ * pointer is returned.
+ * If VADDR lies in a large page, the PDE or PDPE that maps it is
+ * returned instead; it has PTE_PS set. */
 uint64_t *
 pml4e_walk (uint64_t *pml4e, const uint64_t va, int create) {
 	uint64_t *pte = NULL;
@@ -85,7 +92,7 @@ pml4e_walk (uint64_t *pml4e, const uint64_t va, int create) {
 		uint64_t *pdpe = (uint64_t *) pml4e[idx];
 		if (!((uint64_t) pdpe & PTE_P)) {
 			if (create) {
-				uint64_t *new_page = palloc_get_page (PAL_ZERO);
+				uint64_t *new_page = palloc_get_page (PAL_ZERO | PAL_TAG (MEM_VM));
 				if (new_page) {
 					pml4e[idx] = vtop (new_page) | PTE_U | PTE_W | PTE_P;
 					allocated = 1;
@@ -103,13 +110,73 @@ pml4e_walk (uint64_t *pml4e, const uint64_t va, int create) {
 	return pte;
 }
 
+/* Returns the table that entry E points to, creating it if E is
+ * not present and CREATE is true.  Returns a null pointer if there
+ * is no such table, or if E maps a large page. */
+static uint64_t *
+next_table (uint64_t *e, int create) {
+	if (!(*e & PTE_P)) {
+		uint64_t *new_page;
+		if (!create || (new_page = palloc_get_page (PAL_ZERO | PAL_TAG (MEM_VM))) == NULL)
+			return NULL;
+		*e = vtop (new_page) | PTE_U | PTE_W | PTE_P;
+	} else if (*e & PTE_PS)
+		return NULL;
+	return ptov (PTE_ADDR (*e));
+}
+
+/* Returns the address of the entry in PML4 that would map VA as
+ * a large page of SIZE bytes: a PDE if SIZE is PDE_PGSIZE, a PDPE
+ * if it is PDPE_PGSIZE.  Missing tables above it are created if
+ * CREATE is true.  Returns a null pointer if they are missing and
+ * CREATE is false, if memory runs out, or if VA already lies in a
+ * larger page.  The entry itself may be in use, either as a large
+ * page or as a pointer to a lower table. */
+uint64_t *
+pml4e_walk_large (uint64_t *pml4, const uint64_t va, uint64_t size,
+		int create) {
+	uint64_t *pdp, *pd;
+
+	ASSERT (size == PDE_PGSIZE || size == PDPE_PGSIZE);
+
+	if ((pdp = next_table (&pml4[PML4 (va)], create)) == NULL)
+		return NULL;
+	if (size == PDPE_PGSIZE)
+		return &pdp[PDPE (va)];
+	if ((pd = next_table (&pdp[PDPE (va)], create)) == NULL)
+		return NULL;
+	return &pd[PDX (va)];
+}
+
+/* Returns the present leaf entry that maps VA in PML4, whatever
+ * its level: a PTE, or a PDE or PDPE with PTE_PS set.  Stores the
+ * number of bytes that entry maps in *SIZE.  Returns a null
+ * pointer if VA is not mapped. */
+uint64_t *
+pml4_lookup (uint64_t *pml4, const uint64_t va, uint64_t *size) {
+	uint64_t *table = pml4;
+	unsigned shift;
+
+	for (shift = PML4SHIFT; ; shift -= 9) {
+		uint64_t *e = &table[(va >> shift) & 0x1FF];
+
+		if (!(*e & PTE_P))
+			return NULL;
+		if (shift == PTXSHIFT || (shift != PML4SHIFT && (*e & PTE_PS))) {
+			*size = 1UL << shift;
+			return e;
+		}
+		table = ptov (PTE_ADDR (*e));
+	}
+}
+
 /* Creates a new page map level 4 (pml4) has mappings for kernel
  * virtual addresses, but none for user virtual addresses.
  * Returns the new page directory, or a null pointer if memory
  * allocation fails. */
 uint64_t *
 pml4_create (void) {
-	uint64_t *pml4 = palloc_get_page (0);
+	uint64_t *pml4 = palloc_get_page (PAL_TAG (MEM_VM));
 	if (pml4)
 		memcpy (pml4, base_pml4, PGSIZE);
 	return pml4;
@@ -132,15 +199,24 @@ pt_for_each (uint64_t *pt, pte_for_each_func *func, void *aux,
 	return true;
 }
 
+/* A PDE or PDPE with PTE_PS set is passed to FUNC as is, with the
+ * start of the large page it maps. */
 static bool
 pgdir_for_each (uint64_t *pdp, pte_for_each_func *func, void *aux,
 		unsigned pml4_index, unsigned pdp_index) {
 	for (unsigned i = 0; i < PGSIZE / sizeof(uint64_t *); i++) {
 		uint64_t *pte = ptov((uint64_t *) pdp[i]);
-		if (((uint64_t) pte) & PTE_P)
-			if (!pt_for_each ((uint64_t *) PTE_ADDR (pte), func, aux,
+		if (((uint64_t) pte) & PTE_P) {
+			if (pdp[i] & PTE_PS) {
+				void *va = (void *) (((uint64_t) pml4_index << PML4SHIFT) |
+									 ((uint64_t) pdp_index << PDPESHIFT) |
+									 ((uint64_t) i << PDXSHIFT));
+				if (!func (&pdp[i], va, aux))
+					return false;
+			} else if (!pt_for_each ((uint64_t *) PTE_ADDR (pte), func, aux,
 					pml4_index, pdp_index, i))
 				return false;
+		}
 	}
 	return true;
 }
@@ -150,10 +226,16 @@ pdp_for_each (uint64_t *pdp,
 		pte_for_each_func *func, void *aux, unsigned pml4_index) {
 	for (unsigned i = 0; i < PGSIZE / sizeof(uint64_t *); i++) {
 		uint64_t *pde = ptov((uint64_t *) pdp[i]);
-		if (((uint64_t) pde) & PTE_P)
-			if (!pgdir_for_each ((uint64_t *) PTE_ADDR (pde), func,
+		if (((uint64_t) pde) & PTE_P) {
+			if (pdp[i] & PTE_PS) {
+				void *va = (void *) (((uint64_t) pml4_index << PML4SHIFT) |
+									 ((uint64_t) i << PDPESHIFT));
+				if (!func (&pdp[i], va, aux))
+					return false;
+			} else if (!pgdir_for_each ((uint64_t *) PTE_ADDR (pde), func,
 					 aux, pml4_index, i))
 				return false;
+		}
 	}
 	return true;
 }
@@ -184,8 +266,13 @@ static void
 pgdir_destroy (uint64_t *pdp) {
 	for (unsigned i = 0; i < PGSIZE / sizeof(uint64_t *); i++) {
 		uint64_t *pte = ptov((uint64_t *) pdp[i]);
-		if (((uint64_t) pte) & PTE_P)
-			pt_destroy (PTE_ADDR (pte));
+		if (((uint64_t) pte) & PTE_P) {
+			if (pdp[i] & PTE_PS)
+				palloc_free_multiple ((void *) PTE_ADDR (pte),
+						PDE_PGSIZE / PGSIZE);
+			else
+				pt_destroy (PTE_ADDR (pte));
+		}
 	}
 	palloc_free_page ((void *) pdp);
 }
@@ -194,8 +281,13 @@ static void
 pdpe_destroy (uint64_t *pdpe) {
 	for (unsigned i = 0; i < PGSIZE / sizeof(uint64_t *); i++) {
 		uint64_t *pde = ptov((uint64_t *) pdpe[i]);
-		if (((uint64_t) pde) & PTE_P)
-			pgdir_destroy ((void *) PTE_ADDR (pde));
+		if (((uint64_t) pde) & PTE_P) {
+			if (pdpe[i] & PTE_PS)
+				palloc_free_multiple ((void *) PTE_ADDR (pde),
+						PDPE_PGSIZE / PGSIZE);
+			else
+				pgdir_destroy ((void *) PTE_ADDR (pde));
+		}
 	}
 	palloc_free_page ((void *) pdpe);
 }
@@ -229,10 +321,11 @@ void *
 pml4_get_page (uint64_t *pml4, const void *uaddr) {
 	ASSERT (is_user_vaddr (uaddr));
 
-	uint64_t *pte = pml4e_walk (pml4, (uint64_t) uaddr, 0);
+	uint64_t size;
+	uint64_t *pte = pml4_lookup (pml4, (uint64_t) uaddr, &size);
 
-	if (pte && (*pte & PTE_P))
-		return ptov (PTE_ADDR (*pte)) + pg_ofs (uaddr);
+	if (pte)
+		return ptov (PTE_ADDR (*pte)) + ((uint64_t) uaddr & (size - 1));
 	return NULL;
 }
 
@@ -253,11 +346,81 @@ pml4_set_page (uint64_t *pml4, void *upage, void *kpage, bool rw) {
 
 	uint64_t *pte = pml4e_walk (pml4, (uint64_t) upage, 1);
 
-	if (pte)
+	if (pte) {
+		ASSERT (!(*pte & PTE_PS));
 		*pte = vtop (kpage) | PTE_P | (rw ? PTE_W : 0) | PTE_U;
+	}
 	return pte != NULL;
 }
 
+/* Returns true if page table PT maps nothing. */
+static bool
+pt_is_empty (const uint64_t *pt) {
+	for (unsigned i = 0; i < PGSIZE / sizeof(uint64_t *); i++)
+		if (pt[i] & PTE_P)
+			return false;
+	return true;
+}
+
+/* Maps the 2 MB of user virtual memory starting at UPAGE to the
+ * 2 MB of physically contiguous memory at kernel virtual address
+ * KPAGE with a single large PDE.  Both must be 2 MB-aligned.
+ * Nothing in the region may be mapped yet; an empty page table
+ * left over for it is freed.
+ * Returns true if successful, false if memory allocation failed or
+ * part of the region is mapped. */
+bool
+pml4_set_huge_page (uint64_t *pml4, void *upage, void *kpage, bool rw) {
+	uint64_t *pde;
+
+	ASSERT (((uint64_t) upage & (PDE_PGSIZE - 1)) == 0);
+	ASSERT (((uint64_t) kpage & (PDE_PGSIZE - 1)) == 0);
+	ASSERT (is_user_vaddr (upage));
+	ASSERT (pml4 != base_pml4);
+
+	pde = pml4e_walk_large (pml4, (uint64_t) upage, PDE_PGSIZE, 1);
+	if (pde == NULL)
+		return false;
+	if (*pde & PTE_P) {
+		uint64_t *pt = ptov (PTE_ADDR (*pde));
+		if ((*pde & PTE_PS) || !pt_is_empty (pt))
+			return false;
+		palloc_free_page (pt);
+	}
+	*pde = vtop (kpage) | PTE_P | PTE_PS | (rw ? PTE_W : 0) | PTE_U;
+	return true;
+}
+
+/* If user virtual address UADDR lies in a large page in PML4,
+ * replaces that page by a page table of 4 kB pages that map the
+ * same memory with the same permissions and accessed/dirty bits,
+ * so that part of it can be unmapped or evicted.
+ * Returns false if memory allocation failed, true otherwise. */
+bool
+pml4_split_huge_page (uint64_t *pml4, void *uaddr) {
+	uint64_t *pde, *pt;
+	uint64_t pa, flags;
+
+	ASSERT (is_user_vaddr (uaddr));
+
+	pde = pml4e_walk_large (pml4, (uint64_t) uaddr, PDE_PGSIZE, 0);
+	if (pde == NULL || !(*pde & PTE_P) || !(*pde & PTE_PS))
+		return true;
+
+	pt = palloc_get_page (PAL_TAG (MEM_VM));
+	if (pt == NULL)
+		return false;
+	pa = PTE_ADDR (*pde);
+	flags = *pde & PTE_FLAGS & ~PTE_PS;
+	for (unsigned i = 0; i < PGSIZE / sizeof(uint64_t *); i++)
+		pt[i] = (pa + i * PGSIZE) | flags;
+	*pde = vtop (pt) | PTE_U | PTE_W | PTE_P;
+
+	if (rcr3 () == vtop (pml4))
+		invlpg ((uint64_t) uaddr & ~(PDE_PGSIZE - 1));
+	return true;
+}
+
 /* Marks user virtual page UPAGE "not present" in page
  * directory PD.  Later accesses to the page will fault.  Other
  * bits in the page table entry are preserved.
@@ -277,6 +440,47 @@ pml4_clear_page (uint64_t *pml4, void *upage) {
 	}
 }
 
+/* Maps kernel virtual page KVA, which must lie outside the direct
+ * map, to the physical frame behind kernel virtual address KPAGE in
+ * PML4.  The mapping is supervisor-only.
+ * Returns true on success, false if memory for the page table
+ * could not be obtained. */
+bool
+pml4_set_kpage (uint64_t *pml4, void *kva, void *kpage, bool rw) {
+	ASSERT (pg_ofs (kva) == 0);
+	ASSERT (pg_ofs (kpage) == 0);
+	ASSERT (is_vmalloc_vaddr (kva));
+
+	uint64_t *pte = pml4e_walk (pml4, (uint64_t) kva, 1);
+
+	if (pte) {
+		ASSERT ((*pte & PTE_P) == 0);
+		*pte = vtop (kpage) | PTE_P | (rw ? PTE_W : 0);
+	}
+	return pte != NULL;
+}
+
+/* Unmaps kernel virtual page KVA set up by pml4_set_kpage() and
+ * returns the kernel virtual address of the frame it was mapped
+ * to, or a null pointer if KVA was not mapped.  Kernel page tables
+ * are shared by all pml4s, so the TLB entry is flushed whichever
+ * pml4 is active. */
+void *
+pml4_clear_kpage (uint64_t *pml4, void *kva) {
+	ASSERT (pg_ofs (kva) == 0);
+	ASSERT (is_vmalloc_vaddr (kva));
+
+	uint64_t *pte = pml4e_walk (pml4, (uint64_t) kva, 0);
+	void *kpage;
+
+	if (pte == NULL || (*pte & PTE_P) == 0)
+		return NULL;
+	kpage = ptov (PTE_ADDR (*pte));
+	*pte = 0;
+	invlpg ((uint64_t) kva);
+	return kpage;
+}
+
 /* Returns true if the PTE for virtual page VPAGE in PML4 is dirty,
  * that is, if the page has been modified since the PTE was
  * installed.
@@ -303,6 +507,32 @@ pml4_set_dirty (uint64_t *pml4, const void *vpage, bool dirty) {
 	}
 }
 
+/* Returns true if the PTE for virtual page VPAGE in PML4 lets user
+ * code write to the page, whether or not it is present.
+ * Returns false if PML4 contains no PTE for VPAGE. */
+bool
+pml4_is_writable (uint64_t *pml4, const void *vpage) {
+	uint64_t *pte = pml4e_walk (pml4, (uint64_t) vpage, false);
+	return pte != NULL && (*pte & PTE_W) != 0;
+}
+
+/* Sets the writable bit to WRITABLE in the PTE for virtual page
+ * VPAGE in PML4, leaving the rest of the PTE, the accessed and dirty
+ * bits included, as it is. */
+void
+pml4_set_writable (uint64_t *pml4, const void *vpage, bool writable) {
+	uint64_t *pte = pml4e_walk (pml4, (uint64_t) vpage, false);
+	if (pte) {
+		if (writable)
+			*pte |= PTE_W;
+		else
+			*pte &= ~(uint64_t) PTE_W;
+
+		if (rcr3 () == vtop (pml4))
+			invlpg ((uint64_t) vpage);
+	}
+}
+
 /* Returns true if the PTE for virtual page VPAGE in PML4 has been
  * accessed recently, that is, between the time the PTE was
  * installed and the last time it was cleared.  Returns false if
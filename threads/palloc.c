@@ -8,8 +8,12 @@
 #include <stdio.h>
 #include <string.h>
 #include "threads/init.h"
+#include "threads/interrupt.h"
 #include "threads/loader.h"
+#include "threads/memacct.h"
+#include "threads/shrinker.h"
 #include "threads/synch.h"
+#include "threads/thread.h"
 #include "threads/vaddr.h"
 
 /* Page allocator.  Hands out memory in page-size (or
@@ -24,13 +28,72 @@
 
    By default, half of system RAM is given to the kernel pool and
    half to the user pool.  That should be huge overkill for the
-   kernel pool, but that's just fine for demonstration purposes. */
+   kernel pool, but that's just fine for demonstration purposes.
+
+   Single pages go through per-thread "magazines" in front of the
+   pools.  Taking a pool's lock and scanning its bitmap for every
+   page is expensive when page faults come in bursts, so each
+   thread caches up to PAL_MAG_SIZE free pages per pool.  An empty
+   magazine is refilled with PAL_MAG_BATCH pages under a single
+   lock acquisition, and a full one gives PAL_MAG_BATCH pages back.
+   A page sitting in a magazine is still marked used in its pool's
+   bitmap, so when a pool looks exhausted every magazine is flushed
+   and the scan is retried.
+
+   A magazine is only touched by its owner, with interrupts off:
+   do_schedule() frees dead threads' pages into the running
+   thread's magazine and may run at any preemption point.
+
+   When there is nothing else to do, the idle thread takes free
+   pages out of the pools, zeroes them and parks them on a per-pool
+   stack of pre-zeroed pages (see palloc_zero_idle()).  A PAL_ZERO
+   request for a single page takes one of those first and skips the
+   memset.  Pre-zeroed pages are flushed back together with the
+   magazines.
+
+   Over time a pool fragments until palloc_get_multiple() fails
+   for lack of a contiguous run although plenty of pages are free.
+   A pool whose owner can move pages around registers a migrate
+   function (palloc_set_migrate()); for the user pool that is the
+   VM frame table, which copies a frame and repoints its mapping.
+   A failed multi-page allocation then wakes the compaction
+   daemon, which, if the pool's fragmentation index is high
+   enough, moves used pages from the bottom of the pool to free
+   pages at the top so that free pages collect into one run at the
+   bottom, where palloc_get_multiple() looks first.
+
+   Each pool also keeps a count of its free pages.  When an
+   allocation takes it below the pool's low watermark, and again
+   before an allocation is given up on, the registered shrinkers
+   are asked to give back memory their caches hold (see
+   shrinker.c).  Pages in magazines and on the pre-zeroed stack
+   count as used here, so the watermark errs on the early side. */
+
+/* Number of pre-zeroed pages the idle thread keeps per pool. */
+#define ZEROED_MAX 32
+
+/* Fragmentation index, in per mille, above which a pool is
+   compacted, and most pages moved by one compaction run. */
+#define COMPACT_THRESHOLD 500
+#define COMPACT_BATCH 256
+
+/* A pool's low watermark is this fraction of its pages. */
+#define LOW_WMARK_DIV 32
 
 /* A memory pool. */
 struct pool {
 	struct lock lock;               /* Mutual exclusion. */
 	struct bitmap *used_map;        /* Bitmap of free pages. */
 	uint8_t *base;                  /* Base of pool. */
+	uint8_t *tags;                  /* Accounting tag of each used page. */
+	size_t free_cnt;                /* Pages free in USED_MAP. */
+	size_t low_wmark;               /* Shrink caches below this many. */
+
+	/* Pre-zeroed pages.  Accessed with interrupts off. */
+	void *zeroed[ZEROED_MAX];       /* Zeroed pages, used as a stack. */
+	size_t zeroed_cnt;              /* Number of zeroed pages. */
+
+	palloc_migrate_func *migrate;   /* Moves a used page, or null. */
 };
 
 /* Two pools: one for kernel data, one for user pages. */
@@ -38,10 +101,53 @@ static struct pool kernel_pool, user_pool;
 
 /* Maximum number of pages to put in user pool. */
 size_t user_page_limit = SIZE_MAX;
+
+/* Magazine statistics. */
+static long long mag_hit_cnt;   /* # of single-page allocs from a magazine. */
+static long long mag_miss_cnt;  /* # of single-page allocs from a pool. */
+static long long mag_free_cnt;  /* # of single-page frees into a magazine. */
+static long long mag_drain_cnt; /* # of batches drained back to a pool. */
+static long long mag_flush_cnt; /* # of times all magazines were flushed. */
+
+/* Pre-zeroing statistics. */
+static long long zero_hit_cnt;  /* # of PAL_ZERO pages that were pre-zeroed. */
+static long long zero_miss_cnt; /* # of PAL_ZERO pages zeroed on demand. */
+static long long zero_idle_cnt; /* # of pages zeroed by the idle thread. */
+
+/* Compaction daemon and its statistics. */
+static struct semaphore compact_sema; /* Upped to wake the daemon. */
+static bool compact_pending;          /* compact_sema already upped? */
+static long long compact_run_cnt;     /* # of compaction runs. */
+static long long compact_moved_cnt;   /* # of pages moved. */
+static long long compact_fail_cnt;    /* # of pages that refused to move. */
+static size_t compact_run_before;     /* Largest free run before last run. */
+static size_t compact_run_after;      /* Largest free run after last run. */
+
+/* Memory pressure statistics. */
+static long long wmark_cnt;           /* # of times a pool fell below low. */
+static long long reclaim_cnt;         /* # of allocations saved by shrinking. */
+
 static void
 init_pool (struct pool *p, void **bm_base, uint64_t start, uint64_t end);
 
 static bool page_from_pool (const struct pool *, void *page);
+static struct pool *pool_of_page (void *page);
+static size_t pool_take_pages (struct pool *, void **pages, size_t cnt);
+static size_t pool_scan_aligned (struct pool *, size_t cnt, size_t align);
+static void pool_adjust_free (struct pool *, long delta);
+static void pool_sub_free (struct pool *, size_t cnt);
+static size_t pool_shrink (struct pool *);
+static void *get_aligned (enum palloc_flags, size_t page_cnt, size_t align,
+		const void *site);
+static void pages_charge (struct pool *, void *pages, size_t page_cnt,
+		enum palloc_flags, const void *site);
+static void pages_uncharge (struct pool *, void *pages, size_t page_cnt);
+static void pool_put_page (struct pool *, void *page);
+static struct palloc_magazine *magazine_of (struct pool *);
+static void magazine_flush_all (struct pool *);
+static unsigned pool_fragmentation (struct pool *, size_t *largest_run);
+static size_t pool_compact (struct pool *);
+static void compactd (void *aux);
 
 /* multiboot info */
 struct multiboot_info {
@@ -224,11 +330,13 @@ split:
 			if ((uint64_t) pool_end < end) {
 				page_cnt = ((uint64_t) pool_end - start) / PGSIZE;
 				bitmap_set_multiple (pool->used_map, page_idx, page_cnt, false);
+				pool->free_cnt += page_cnt;
 				start = (uint64_t) pool_end;
 				goto split;
 			} else {
 				page_cnt = ((uint64_t) end - start) / PGSIZE;
 				bitmap_set_multiple (pool->used_map, page_idx, page_cnt, false);
+				pool->free_cnt += page_cnt;
 			}
 		}
 	}
@@ -250,6 +358,7 @@ palloc_init (void) {
 	printf ("\text_mem: 0x%llx ~ 0x%llx (Usable: %'llu kB)\n",
 		  ext_mem.start, ext_mem.end, ext_mem.size / 1024);
 	populate_pools (&base_mem, &ext_mem);
+	sema_init (&compact_sema, 0);
 	return ext_mem.end;
 }
 
@@ -261,11 +370,51 @@ palloc_init (void) {
    FLAGS, in which case the kernel panics. */
 void *
 palloc_get_multiple (enum palloc_flags flags, size_t page_cnt) {
+	return get_aligned (flags, page_cnt, 1, __builtin_return_address (0));
+}
+
+/* Like palloc_get_multiple(), but the physical address of the
+   first page is a multiple of ALIGN pages, which must be a power
+   of 2.  Huge pages need such blocks. */
+void *
+palloc_get_aligned (enum palloc_flags flags, size_t page_cnt, size_t align) {
+	return get_aligned (flags, page_cnt, align, __builtin_return_address (0));
+}
+
+/* Implements palloc_get_aligned() on behalf of a caller at SITE. */
+static void *
+get_aligned (enum palloc_flags flags, size_t page_cnt, size_t align,
+		const void *site) {
 	struct pool *pool = flags & PAL_USER ? &user_pool : &kernel_pool;
 
+	ASSERT (align > 0 && (align & (align - 1)) == 0);
+
 	lock_acquire (&pool->lock);
-	size_t page_idx = bitmap_scan_and_flip (pool->used_map, 0, page_cnt, false);
+	size_t page_idx = pool_scan_aligned (pool, page_cnt, align);
+	if (page_idx == BITMAP_ERROR) {
+		/* Pages cached in magazines may be what we are missing. */
+		magazine_flush_all (pool);
+		page_idx = pool_scan_aligned (pool, page_cnt, align);
+	}
 	lock_release (&pool->lock);
+
+	if (page_idx == BITMAP_ERROR && pool_shrink (pool) > 0) {
+		lock_acquire (&pool->lock);
+		page_idx = pool_scan_aligned (pool, page_cnt, align);
+		lock_release (&pool->lock);
+		if (page_idx != BITMAP_ERROR)
+			reclaim_cnt++;
+	}
+	if (page_idx != BITMAP_ERROR)
+		pool_sub_free (pool, page_cnt);
+
+	/* Free pages may just be scattered.  Have them gathered, for
+	   the next request's sake. */
+	if (page_idx == BITMAP_ERROR && page_cnt > 1 && pool->migrate != NULL
+			&& !compact_pending) {
+		compact_pending = true;
+		sema_up (&compact_sema);
+	}
 	void *pages;
 
 	if (page_idx != BITMAP_ERROR)
@@ -274,6 +423,7 @@ palloc_get_multiple (enum palloc_flags flags, size_t page_cnt) {
 		pages = NULL;
 
 	if (pages) {
+		pages_charge (pool, pages, page_cnt, flags, site);
 		if (flags & PAL_ZERO)
 			memset (pages, 0, PGSIZE * page_cnt);
 	} else {
@@ -293,7 +443,63 @@ palloc_get_multiple (enum palloc_flags flags, size_t page_cnt) {
    FLAGS, in which case the kernel panics. */
 void *
 palloc_get_page (enum palloc_flags flags) {
-	return palloc_get_multiple (flags, 1);
+	struct pool *pool = flags & PAL_USER ? &user_pool : &kernel_pool;
+	struct palloc_magazine *mag;
+	void *batch[PAL_MAG_BATCH];
+	void *page = NULL;
+	size_t batch_cnt, i;
+	enum intr_level old_level;
+
+	old_level = intr_disable ();
+	if ((flags & PAL_ZERO) && pool->zeroed_cnt > 0) {
+		page = pool->zeroed[--pool->zeroed_cnt];
+		zero_hit_cnt++;
+		intr_set_level (old_level);
+		pages_charge (pool, page, 1, flags, __builtin_return_address (0));
+		return page;
+	}
+	mag = magazine_of (pool);
+	if (mag->cnt > 0) {
+		page = mag->pages[--mag->cnt];
+		mag_hit_cnt++;
+	}
+	intr_set_level (old_level);
+
+	if (page == NULL) {
+		/* Refill: the first page is ours, the rest is cached. */
+		batch_cnt = pool_take_pages (pool, batch, PAL_MAG_BATCH);
+		if (batch_cnt == 0 && pool_shrink (pool) > 0) {
+			batch_cnt = pool_take_pages (pool, batch, PAL_MAG_BATCH);
+			if (batch_cnt > 0)
+				reclaim_cnt++;
+		}
+		if (batch_cnt > 0) {
+			pool_sub_free (pool, batch_cnt);
+			page = batch[0];
+			old_level = intr_disable ();
+			mag = magazine_of (pool);
+			mag_miss_cnt++;
+			for (i = 1; i < batch_cnt; i++)
+				if (mag->cnt < PAL_MAG_SIZE)
+					mag->pages[mag->cnt++] = batch[i];
+				else
+					pool_put_page (pool, batch[i]);
+			intr_set_level (old_level);
+		}
+	}
+
+	if (page) {
+		pages_charge (pool, page, 1, flags, __builtin_return_address (0));
+		if (flags & PAL_ZERO) {
+			memset (page, 0, PGSIZE);
+			zero_miss_cnt++;
+		}
+	} else {
+		if (flags & PAL_ASSERT)
+			PANIC ("palloc_get: out of pages");
+	}
+
+	return page;
 }
 
 /* Frees the PAGE_CNT pages starting at PAGES. */
@@ -306,26 +512,186 @@ palloc_free_multiple (void *pages, size_t page_cnt) {
 	if (pages == NULL || page_cnt == 0)
 		return;
 
-	if (page_from_pool (&kernel_pool, pages))
-		pool = &kernel_pool;
-	else if (page_from_pool (&user_pool, pages))
-		pool = &user_pool;
-	else
-		NOT_REACHED ();
-
+	pool = pool_of_page (pages);
 	page_idx = pg_no (pages) - pg_no (pool->base);
+	pages_uncharge (pool, pages, page_cnt);
 
 #ifndef NDEBUG
 	memset (pages, 0xcc, PGSIZE * page_cnt);
 #endif
 	ASSERT (bitmap_all (pool->used_map, page_idx, page_cnt));
 	bitmap_set_multiple (pool->used_map, page_idx, page_cnt, false);
+	pool_adjust_free (pool, page_cnt);
 }
 
 /* Frees the page at PAGE. */
 void
 palloc_free_page (void *page) {
-	palloc_free_multiple (page, 1);
+	struct palloc_magazine *mag;
+	struct pool *pool;
+	enum intr_level old_level;
+	size_t i;
+
+	ASSERT (pg_ofs (page) == 0);
+	if (page == NULL)
+		return;
+
+	pool = pool_of_page (page);
+	ASSERT (bitmap_test (pool->used_map, pg_no (page) - pg_no (pool->base)));
+	pages_uncharge (pool, page, 1);
+#ifndef NDEBUG
+	memset (page, 0xcc, PGSIZE);
+#endif
+
+	old_level = intr_disable ();
+	mag = magazine_of (pool);
+	if (mag->cnt == PAL_MAG_SIZE) {
+		/* Full: hand the oldest batch back to the pool. */
+		for (i = 0; i < PAL_MAG_BATCH; i++)
+			pool_put_page (pool, mag->pages[i]);
+		memmove (mag->pages, mag->pages + PAL_MAG_BATCH,
+				sizeof *mag->pages * (PAL_MAG_SIZE - PAL_MAG_BATCH));
+		mag->cnt -= PAL_MAG_BATCH;
+		mag_drain_cnt++;
+	}
+	mag->pages[mag->cnt++] = page;
+	mag_free_cnt++;
+	intr_set_level (old_level);
+}
+
+/* Returns every page cached in the running thread's magazines to
+   its pool.  Called on behalf of a dying thread, whose magazines
+   are about to be freed along with its page. */
+void
+palloc_magazine_drain (void) {
+	struct thread *t = thread_current ();
+	enum intr_level old_level;
+	size_t i;
+
+	old_level = intr_disable ();
+	for (i = 0; i < sizeof t->page_mags / sizeof *t->page_mags; i++) {
+		struct palloc_magazine *mag = &t->page_mags[i];
+		struct pool *pool = i == 0 ? &kernel_pool : &user_pool;
+
+		while (mag->cnt > 0)
+			pool_put_page (pool, mag->pages[--mag->cnt]);
+	}
+	intr_set_level (old_level);
+}
+
+/* Called by the idle thread when no other thread is ready to
+   run.  Takes one free page from a pool whose pre-zeroed stack is
+   not full, zeroes it and pushes it on the stack.  Returns true if
+   a page was zeroed, false if there was nothing to do.
+
+   The idle thread must never block, so a pool whose lock is held
+   by someone else is simply skipped.  Interrupts are turned on
+   while the page is zeroed and are off again on return. */
+bool
+palloc_zero_idle (void) {
+	struct pool *pools[] = { &kernel_pool, &user_pool };
+	size_t i, page_idx;
+	void *page;
+
+	ASSERT (intr_get_level () == INTR_OFF);
+
+	for (i = 0; i < sizeof pools / sizeof *pools; i++) {
+		struct pool *pool = pools[i];
+
+		if (pool->zeroed_cnt >= ZEROED_MAX || !lock_try_acquire (&pool->lock))
+			continue;
+		page_idx = bitmap_scan_and_flip (pool->used_map, 0, 1, false);
+		lock_release (&pool->lock);
+		if (page_idx == BITMAP_ERROR)
+			continue;
+		pool_adjust_free (pool, -1);
+
+		page = pool->base + PGSIZE * page_idx;
+		intr_enable ();
+		memset (page, 0, PGSIZE);
+		intr_disable ();
+
+		if (pool->zeroed_cnt < ZEROED_MAX) {
+			pool->zeroed[pool->zeroed_cnt++] = page;
+			zero_idle_cnt++;
+		} else
+			pool_put_page (pool, page);
+		return true;
+	}
+	return false;
+}
+
+/* Registers MIGRATE as the function that moves used pages of the
+   pool selected by FLAGS, making that pool eligible for
+   compaction.  MIGRATE is called from the compaction daemon with
+   no locks held. */
+void
+palloc_set_migrate (enum palloc_flags flags, palloc_migrate_func *migrate) {
+	struct pool *pool = flags & PAL_USER ? &user_pool : &kernel_pool;
+	pool->migrate = migrate;
+}
+
+/* Returns the number of free pages in the pool selected by FLAGS,
+   not counting those cached in magazines or pre-zeroed.  Does not
+   take the pool's lock, so the result is only a snapshot. */
+size_t
+palloc_free_count (enum palloc_flags flags) {
+	struct pool *pool = flags & PAL_USER ? &user_pool : &kernel_pool;
+	return pool->free_cnt;
+}
+
+/* Compacts the pool selected by FLAGS if it has a migrate
+   function and its fragmentation index is above
+   COMPACT_THRESHOLD.  Returns the number of pages moved. */
+size_t
+palloc_compact (enum palloc_flags flags) {
+	struct pool *pool = flags & PAL_USER ? &user_pool : &kernel_pool;
+	size_t before, after, moved;
+
+	if (pool->migrate == NULL)
+		return 0;
+
+	magazine_flush_all (pool);
+	if (pool_fragmentation (pool, &before) <= COMPACT_THRESHOLD)
+		return 0;
+
+	moved = pool_compact (pool);
+	pool_fragmentation (pool, &after);
+
+	compact_run_cnt++;
+	compact_moved_cnt += moved;
+	compact_run_before = before;
+	compact_run_after = after;
+	return moved;
+}
+
+/* Starts the compaction daemon.  Must be called after
+   thread_start(). */
+void
+palloc_compactd_start (void) {
+	thread_create ("kcompactd", PRI_MIN, compactd, NULL);
+}
+
+/* Prints page allocator statistics. */
+void
+palloc_print_stats (void) {
+	long long allocs = mag_hit_cnt + mag_miss_cnt;
+	long long zero_allocs = zero_hit_cnt + zero_miss_cnt;
+
+	printf ("Palloc: %lld single-page allocs, %lld magazine hits (%lld%%), "
+			"%lld refills, %lld drains, %lld flushes\n",
+			allocs, mag_hit_cnt, allocs ? mag_hit_cnt * 100 / allocs : 0,
+			mag_miss_cnt, mag_drain_cnt, mag_flush_cnt);
+	printf ("Palloc: %lld zeroed-page allocs, %lld pre-zeroed (%lld%%), "
+			"%lld pages zeroed while idle\n",
+			zero_allocs, zero_hit_cnt,
+			zero_allocs ? zero_hit_cnt * 100 / zero_allocs : 0, zero_idle_cnt);
+	printf ("Palloc: %lld compactions, %lld pages moved, %lld unmovable, "
+			"largest free run %zu -> %zu pages\n",
+			compact_run_cnt, compact_moved_cnt, compact_fail_cnt,
+			compact_run_before, compact_run_after);
+	printf ("Palloc: %lld low watermark hits, %lld allocs saved by shrinkers\n",
+			wmark_cnt, reclaim_cnt);
 }
 
 /* Initializes pool P as starting at START and ending at END */
@@ -335,11 +701,15 @@ init_pool (struct pool *p, void **bm_base, uint64_t start, uint64_t end) {
      Calculate the space needed for the bitmap
      and subtract it from the pool's size. */
 	uint64_t pgcnt = (end - start) / PGSIZE;
-	size_t bm_pages = DIV_ROUND_UP (bitmap_buf_size (pgcnt), PGSIZE) * PGSIZE;
+	size_t bm_size = bitmap_buf_size (pgcnt);
+	size_t bm_pages = DIV_ROUND_UP (bm_size + pgcnt, PGSIZE) * PGSIZE;
 
 	lock_init(&p->lock);
-	p->used_map = bitmap_create_in_buf (pgcnt, *bm_base, bm_pages);
+	p->used_map = bitmap_create_in_buf (pgcnt, *bm_base, bm_size);
 	p->base = (void *) start;
+	p->tags = (uint8_t *) *bm_base + bm_size;
+	p->free_cnt = 0;
+	p->low_wmark = pgcnt / LOW_WMARK_DIV;
 
 	// Mark all to unusable.
 	bitmap_set_all(p->used_map, true);
@@ -356,3 +726,242 @@ page_from_pool (const struct pool *pool, void *page) {
 	size_t end_page = start_page + bitmap_size (pool->used_map);
 	return page_no >= start_page && page_no < end_page;
 }
+
+/* Returns the pool that PAGE was allocated from. */
+static struct pool *
+pool_of_page (void *page) {
+	if (page_from_pool (&kernel_pool, page))
+		return &kernel_pool;
+	else if (page_from_pool (&user_pool, page))
+		return &user_pool;
+	else
+		NOT_REACHED ();
+}
+
+/* Takes up to CNT free pages from POOL, not necessarily
+   contiguous, and stores them in PAGES.  Returns the number of
+   pages taken. */
+static size_t
+pool_take_pages (struct pool *pool, void **pages, size_t cnt) {
+	size_t page_idx = 0;
+	size_t taken = 0;
+	bool flushed = false;
+
+	lock_acquire (&pool->lock);
+	while (taken < cnt) {
+		page_idx = bitmap_scan_and_flip (pool->used_map, page_idx, 1, false);
+		if (page_idx == BITMAP_ERROR) {
+			if (taken > 0 || flushed)
+				break;
+			magazine_flush_all (pool);
+			flushed = true;
+			page_idx = 0;
+			continue;
+		}
+		pages[taken++] = pool->base + PGSIZE * page_idx;
+	}
+	lock_release (&pool->lock);
+	return taken;
+}
+
+/* Finds CNT free pages in POOL, the first of which is at a
+   physical address that is a multiple of ALIGN pages, marks them
+   used and returns the index of the first one, or BITMAP_ERROR if
+   there is no such run.  The caller must hold POOL's lock. */
+static size_t
+pool_scan_aligned (struct pool *pool, size_t cnt, size_t align) {
+	size_t page_cnt = bitmap_size (pool->used_map);
+	size_t page_idx;
+
+	ASSERT (lock_held_by_current_thread (&pool->lock));
+
+	if (align == 1)
+		return bitmap_scan_and_flip (pool->used_map, 0, cnt, false);
+
+	page_idx = (align - pg_no (pool->base) % align) % align;
+	for (; page_idx + cnt <= page_cnt; page_idx += align)
+		if (bitmap_none (pool->used_map, page_idx, cnt)) {
+			bitmap_set_multiple (pool->used_map, page_idx, cnt, true);
+			return page_idx;
+		}
+	return BITMAP_ERROR;
+}
+
+/* Charges the PAGE_CNT pages at PAGES, just taken from POOL on
+   behalf of a caller at SITE, to the tag in FLAGS. */
+static void
+pages_charge (struct pool *pool, void *pages, size_t page_cnt,
+		enum palloc_flags flags, const void *site) {
+	enum mem_tag tag = PAL_TAG_OF (flags);
+
+	memset (pool->tags + (pg_no (pages) - pg_no (pool->base)), tag, page_cnt);
+	memacct_alloc (tag, flags & PAL_NOTRACK ? NULL : pages, 0, page_cnt, site);
+}
+
+/* Credits the tag of the PAGE_CNT pages at PAGES, being freed to
+   POOL. */
+static void
+pages_uncharge (struct pool *pool, void *pages, size_t page_cnt) {
+	enum mem_tag tag = pool->tags[pg_no (pages) - pg_no (pool->base)];
+
+	memacct_free (tag, pages, 0, page_cnt);
+}
+
+/* Marks PAGE free in POOL's bitmap.  Like palloc_free_multiple(),
+   this does not take the pool's lock. */
+static void
+pool_put_page (struct pool *pool, void *page) {
+	bitmap_reset (pool->used_map, pg_no (page) - pg_no (pool->base));
+	pool_adjust_free (pool, 1);
+}
+
+/* Adds DELTA to POOL's free page count.  Frees do not take the
+   pool's lock, so the count is updated with interrupts off. */
+static void
+pool_adjust_free (struct pool *pool, long delta) {
+	enum intr_level old_level = intr_disable ();
+	pool->free_cnt += delta;
+	intr_set_level (old_level);
+}
+
+/* Subtracts CNT, just allocated, from POOL's free page count, and
+   shrinks the kernel's caches if that takes the kernel pool below
+   its low watermark. */
+static void
+pool_sub_free (struct pool *pool, size_t cnt) {
+	enum intr_level old_level = intr_disable ();
+	bool crossed = pool->free_cnt >= pool->low_wmark
+		&& pool->free_cnt - cnt < pool->low_wmark;
+
+	pool->free_cnt -= cnt;
+	if (crossed)
+		wmark_cnt++;
+	intr_set_level (old_level);
+
+	if (crossed)
+		pool_shrink (pool);
+}
+
+/* Shrinks the kernel's caches on behalf of POOL and returns the
+   number of objects freed.  Shrinkers only give back kernel pool
+   pages, so a short user pool is left to the VM's own reclaim. */
+static size_t
+pool_shrink (struct pool *pool) {
+	return pool == &kernel_pool ? shrink_caches () : 0;
+}
+
+/* Returns the running thread's magazine for POOL.
+   Interrupts must be off. */
+static struct palloc_magazine *
+magazine_of (struct pool *pool) {
+	ASSERT (intr_get_level () == INTR_OFF);
+	return &thread_current ()->page_mags[pool == &user_pool];
+}
+
+/* thread_foreach() helper for magazine_flush_all(). */
+static void
+magazine_flush (struct thread *t, void *pool_) {
+	struct pool *pool = pool_;
+	struct palloc_magazine *mag = &t->page_mags[pool == &user_pool];
+
+	while (mag->cnt > 0)
+		pool_put_page (pool, mag->pages[--mag->cnt]);
+}
+
+/* Gives every page cached for POOL in any thread's magazine, and
+   every pre-zeroed page of POOL, back to POOL. */
+static void
+magazine_flush_all (struct pool *pool) {
+	enum intr_level old_level = intr_disable ();
+	thread_foreach (magazine_flush, pool);
+	while (pool->zeroed_cnt > 0)
+		pool_put_page (pool, pool->zeroed[--pool->zeroed_cnt]);
+	mag_flush_cnt++;
+	intr_set_level (old_level);
+}
+
+/* Returns POOL's fragmentation index in per mille: 0 when its
+   free pages form a single run, approaching 1000 as they are
+   scattered in single pages.  Stores the length of the longest
+   free run in *LARGEST_RUN.  Does not take the pool's lock, so the
+   result is only a snapshot. */
+static unsigned
+pool_fragmentation (struct pool *pool, size_t *largest_run) {
+	size_t page_cnt = bitmap_size (pool->used_map);
+	size_t free_cnt = 0, run = 0;
+	size_t i;
+
+	*largest_run = 0;
+	for (i = 0; i < page_cnt; i++)
+		if (!bitmap_test (pool->used_map, i)) {
+			free_cnt++;
+			if (++run > *largest_run)
+				*largest_run = run;
+		} else
+			run = 0;
+	return free_cnt > 0 ? 1000 - *largest_run * 1000 / free_cnt : 0;
+}
+
+/* Moves up to COMPACT_BATCH used pages from the bottom of POOL to
+   free pages at its top, with two scanners walking towards each
+   other.  Returns the number of pages moved.
+
+   The destination page is reserved under the pool's lock, but the
+   migrate function runs without it: it takes its own locks, and
+   their holders may be waiting for this pool. */
+static size_t
+pool_compact (struct pool *pool) {
+	size_t migrate_idx = 0;
+	size_t free_idx = bitmap_size (pool->used_map);
+	size_t moved = 0;
+
+	while (moved < COMPACT_BATCH) {
+		void *page, *new_page;
+
+		/* Next used page from the bottom. */
+		while (migrate_idx < free_idx
+				&& !bitmap_test (pool->used_map, migrate_idx))
+			migrate_idx++;
+
+		/* Next free page from the top. */
+		lock_acquire (&pool->lock);
+		while (free_idx > migrate_idx
+				&& bitmap_test (pool->used_map, free_idx - 1))
+			free_idx--;
+		if (free_idx <= migrate_idx) {
+			lock_release (&pool->lock);
+			break;
+		}
+		bitmap_mark (pool->used_map, --free_idx);
+		lock_release (&pool->lock);
+		pool_adjust_free (pool, -1);
+
+		page = pool->base + PGSIZE * migrate_idx;
+		new_page = pool->base + PGSIZE * free_idx;
+		if (pool->migrate (page, new_page)) {
+			pool->tags[free_idx] = pool->tags[migrate_idx];
+			memacct_move (page, new_page);
+			pool_put_page (pool, page);
+			moved++;
+		} else {
+			/* Not movable: keep the destination for the next one. */
+			pool_put_page (pool, new_page);
+			free_idx++;
+			compact_fail_cnt++;
+		}
+		migrate_idx++;
+	}
+	return moved;
+}
+
+/* Compaction daemon.  Sleeps until a multi-page allocation fails,
+   then compacts the pools. */
+static void
+compactd (void *aux UNUSED) {
+	for (;;) {
+		sema_down (&compact_sema);
+		compact_pending = false;
+		palloc_compact (PAL_USER);
+		palloc_compact (0);
+	}
+}
@@ -0,0 +1,172 @@
+#include "threads/scratch.h"
+#include <debug.h>
+#include <round.h>
+#include <stdio.h>
+#include "threads/interrupt.h"
+#include "threads/memacct.h"
+#include "threads/palloc.h"
+#include "threads/thread.h"
+#include "threads/vaddr.h"
+
+/* Scratch arenas.
+
+   Much of what the kernel allocates lives only until the
+   function that allocated it returns: a bounce buffer for a
+   partial sector, a copy of a command line to tokenize.  Sending
+   each of those through malloc() or the page allocator costs a
+   lock and a search for memory that is given back moments later.
+
+   Instead, each thread has a scratch arena that such temporaries
+   are carved from by bumping a pointer.  Its owner takes a mark
+   with scratch_mark() before allocating and hands the mark to
+   scratch_release() when it is done, which frees everything
+   allocated since in one step.  Marks nest like the calls that
+   take them, so a function may use the arena without knowing
+   whether its caller is using it too.
+
+   The arena is a stack of chunks of whole pages, taken from the
+   kernel pool when the current chunk is full.  Releasing a mark
+   gives back the chunks allocated after it, except that the
+   bottom chunk is kept for the next use, so in the common case no
+   page allocation happens at all.  The bottom chunk goes away when
+   the thread exits.
+
+   An arena belongs to its thread: it must not be used from an
+   interrupt handler, and memory from it must not be handed to
+   another thread. */
+
+/* Header at the start of each chunk. */
+struct scratch_chunk {
+	struct scratch_chunk *prev;     /* Chunk below this one, or null. */
+	uint8_t *prev_top;              /* Top of PREV when this was pushed. */
+	size_t page_cnt;                /* Size of chunk in pages. */
+};
+
+/* Alignment of scratch allocations. */
+#define SCRATCH_ALIGN 16
+
+/* Offset of the first usable byte in a chunk. */
+#define CHUNK_HDR ROUND_UP (sizeof (struct scratch_chunk), SCRATCH_ALIGN)
+
+static long long alloc_cnt;         /* # of scratch_alloc() calls. */
+static long long chunk_cnt;         /* # of chunks taken from palloc. */
+
+static bool push_chunk (struct scratch *, size_t size);
+static void pop_chunk (struct scratch *);
+
+/* Returns the running thread's arena. */
+static struct scratch *
+arena (void) {
+	ASSERT (!intr_context ());
+	return &thread_current ()->scratch;
+}
+
+/* Allocates SIZE bytes, aligned to SCRATCH_ALIGN, from the running
+   thread's scratch arena and returns them, or returns a null
+   pointer if memory is not available.  The memory is not zeroed.
+   It is freed by scratch_release() with a mark taken before the
+   call. */
+void *
+scratch_alloc (size_t size) {
+	struct scratch *s = arena ();
+	void *p;
+
+	size = ROUND_UP (size, SCRATCH_ALIGN);
+	if (s->chunk == NULL || (size_t) (s->end - s->top) < size)
+		if (!push_chunk (s, size))
+			return NULL;
+
+	p = s->top;
+	s->top += size;
+	alloc_cnt++;
+	return p;
+}
+
+/* Returns a mark for the current top of the running thread's
+   scratch arena. */
+void *
+scratch_mark (void) {
+	return arena ()->top;
+}
+
+/* Frees everything allocated from the running thread's scratch
+   arena since MARK was taken. */
+void
+scratch_release (void *mark_) {
+	struct scratch *s = arena ();
+	uint8_t *mark = mark_;
+
+	/* Pop chunks until MARK falls inside the current one.  A mark
+	   taken at the very end of a chunk may equal the address of
+	   the next chunk, but never its first usable byte. */
+	while (s->chunk != NULL
+			&& !(mark >= (uint8_t *) s->chunk + CHUNK_HDR && mark <= s->end)) {
+		if (s->chunk->prev == NULL) {
+			/* Keep the bottom chunk, emptied. */
+			s->top = (uint8_t *) s->chunk + CHUNK_HDR;
+			return;
+		}
+		pop_chunk (s);
+	}
+	if (s->chunk != NULL)
+		s->top = mark;
+}
+
+/* Frees everything in the running thread's scratch arena.  Used
+   when the thread's kernel stack is abandoned, for instance by a
+   successful exec, so that no mark on it will ever be released. */
+void
+scratch_reset (void) {
+	scratch_release (NULL);
+}
+
+/* Gives all of the running thread's scratch arena back to the
+   page allocator.  Called on behalf of a dying thread. */
+void
+scratch_destroy (void) {
+	struct scratch *s = &thread_current ()->scratch;
+
+	while (s->chunk != NULL)
+		pop_chunk (s);
+}
+
+/* Prints scratch arena statistics. */
+void
+scratch_print_stats (void) {
+	printf ("Scratch: %lld allocs, %lld chunks allocated\n",
+			alloc_cnt, chunk_cnt);
+}
+
+/* Pushes a new chunk with room for at least SIZE bytes on S.
+   Returns true if successful, false if out of memory. */
+static bool
+push_chunk (struct scratch *s, size_t size) {
+	size_t page_cnt = DIV_ROUND_UP (CHUNK_HDR + size, PGSIZE);
+	struct scratch_chunk *c;
+
+	/* Like a thread's other per-thread caches, the arena is not
+	   charged to its owner for -memleak. */
+	c = palloc_get_multiple (PAL_NOTRACK | PAL_TAG (MEM_SCRATCH), page_cnt);
+	if (c == NULL)
+		return false;
+	c->prev = s->chunk;
+	c->prev_top = s->top;
+	c->page_cnt = page_cnt;
+	s->chunk = c;
+	s->top = (uint8_t *) c + CHUNK_HDR;
+	s->end = (uint8_t *) c + page_cnt * PGSIZE;
+	chunk_cnt++;
+	return true;
+}
+
+/* Pops S's current chunk and frees it. */
+static void
+pop_chunk (struct scratch *s) {
+	struct scratch_chunk *c = s->chunk;
+
+	s->chunk = c->prev;
+	s->top = c->prev_top;
+	s->end = s->chunk != NULL
+		? (uint8_t *) s->chunk + s->chunk->page_cnt * PGSIZE : NULL;
+	palloc_free_multiple (c, c->page_cnt);
+}
@@ -0,0 +1,116 @@
+#include "threads/shrinker.h"
+#include <debug.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include "threads/interrupt.h"
+
+/* Shrinkers.
+
+   Kernel caches keep memory they could do without: slabs with no
+   objects left in them, inodes nobody has open, and so on.  That
+   is the right thing to do while memory is plentiful, but once a
+   pool runs low the same memory is better spent on the allocation
+   that would otherwise fail.  A cache that can give memory back
+   registers a shrinker, a pair of functions that report how much
+   it could free and free it.
+
+   The page allocator calls shrink_caches() when the kernel pool
+   falls below its low watermark and again before it gives up on
+   an allocation from it.  Shrinkers free kernel memory only, so
+   the user pool never calls them.  Every shrinker is asked to give back everything it
+   can: a cache that has been emptied is cheap to refill, and a
+   pool that has fallen this low needs all the help it can get.
+
+   Shrinkers run newest first.  Higher-level caches register after
+   the slab allocator they are built on, so they release their
+   objects before the slab shrinker gives back the slabs those
+   objects leave empty. */
+
+/* Maximum number of shrinkers. */
+#define SHRINKER_MAX 8
+
+/* A registered shrinker. */
+struct shrinker {
+	const char *name;               /* Name, for statistics. */
+	shrinker_count_func *count;     /* Reports freeable objects. */
+	shrinker_scan_func *scan;       /* Frees objects. */
+	long long run_cnt;              /* # of times scanned. */
+	long long freed_cnt;            /* # of objects freed. */
+};
+
+static struct shrinker shrinkers[SHRINKER_MAX];
+static size_t shrinker_cnt;
+
+static bool shrinking;              /* shrink_caches() running? */
+static long long shrink_cnt;        /* # of shrink_caches() calls. */
+
+/* Registers a shrinker called NAME whose COUNT function reports
+   how many objects it could free and whose SCAN function frees
+   them.  NAME must stay valid for the lifetime of the kernel. */
+void
+register_shrinker (const char *name, shrinker_count_func *count,
+		shrinker_scan_func *scan) {
+	enum intr_level old_level;
+
+	ASSERT (count != NULL && scan != NULL);
+
+	old_level = intr_disable ();
+	if (shrinker_cnt >= SHRINKER_MAX)
+		PANIC ("too many shrinkers");
+	shrinkers[shrinker_cnt++] = (struct shrinker) {
+		.name = name,
+		.count = count,
+		.scan = scan,
+	};
+	intr_set_level (old_level);
+}
+
+/* Asks every shrinker to free everything it can.  Returns the
+   number of objects freed.  Does nothing if called from an
+   interrupt handler, or while another thread is already
+   shrinking: that thread's work will serve this one too. */
+size_t
+shrink_caches (void) {
+	enum intr_level old_level;
+	size_t freed = 0;
+	size_t i;
+
+	if (intr_context ())
+		return 0;
+
+	old_level = intr_disable ();
+	if (shrinking) {
+		intr_set_level (old_level);
+		return 0;
+	}
+	shrinking = true;
+	shrink_cnt++;
+	intr_set_level (old_level);
+
+	for (i = shrinker_cnt; i-- > 0; ) {
+		struct shrinker *s = &shrinkers[i];
+		size_t cnt = s->count ();
+		size_t n;
+
+		if (cnt == 0)
+			continue;
+		n = s->scan (cnt);
+		s->run_cnt++;
+		s->freed_cnt += n;
+		freed += n;
+	}
+
+	shrinking = false;
+	return freed;
+}
+
+/* Prints shrinker statistics. */
+void
+shrinker_print_stats (void) {
+	size_t i;
+
+	printf ("Shrink: %lld shrinks\n", shrink_cnt);
+	for (i = 0; i < shrinker_cnt; i++)
+		printf ("Shrink: %-10s %lld scans, %lld objects freed\n",
+				shrinkers[i].name, shrinkers[i].run_cnt, shrinkers[i].freed_cnt);
+}
@@ -0,0 +1,462 @@
+#include "threads/slab.h"
+#include <debug.h>
+#include <list.h>
+#include <round.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include "threads/palloc.h"
+#include "threads/shrinker.h"
+#include "threads/synch.h"
+#include "threads/vaddr.h"
+
+/* Slab allocator.
+
+   An object cache ("kmem_cache") hands out objects of a single
+   size.  Its memory comes from the page allocator one page at a
+   time; each page is a "slab" holding a small header followed by
+   as many objects as fit.  A cache keeps its slabs on three lists:
+   partially used slabs, which allocations are served from first,
+   full slabs, and completely free slabs, which are kept around
+   (up to EMPTY_SLABS_MAX of them) to absorb alloc/free bursts and
+   otherwise given back to the page allocator.
+
+   Free objects within a slab are chained through a pointer stored
+   in the object itself.  If the cache has a constructor, objects
+   are constructed once, when their slab is created, and must be
+   freed in their constructed state; the free pointer is then kept
+   in an extra word past the end of the object so it does not
+   clobber constructed fields.
+
+   Because a slab is exactly one page and starts with a header,
+   the slab an object belongs to is found by rounding the object's
+   address down to a page boundary.
+
+   Under memory pressure the "slab" shrinker gives every cache's
+   free slabs back to the page allocator.  malloc() is built on
+   caches too, so this covers its size classes as well. */
+
+/* Magic number for detecting slab corruption. */
+#define SLAB_MAGIC 0x51ab51ab
+
+/* Number of completely free slabs a cache keeps. */
+#define EMPTY_SLABS_MAX 1
+
+/* An object cache. */
+struct kmem_cache {
+	const char *name;           /* Name, for statistics. */
+	size_t obj_size;            /* Size requested by the creator. */
+	size_t size;                /* Bytes per object, including padding. */
+	size_t free_ofs;            /* Offset of free pointer in an object. */
+	size_t first_ofs;           /* Offset of first object in a slab. */
+	size_t objs_per_slab;       /* Number of objects in a slab. */
+	kmem_ctor_func *ctor;       /* Constructor, or null. */
+	enum mem_tag tag;           /* Memory accounting tag. */
+
+	struct lock lock;           /* Protects the members below. */
+	struct list partial;        /* Slabs with used and free objects. */
+	struct list full;           /* Slabs with no free objects. */
+	struct list empty;          /* Slabs with no used objects. */
+	size_t slab_cnt;            /* Number of slabs. */
+	size_t empty_cnt;           /* Number of slabs in EMPTY. */
+	size_t in_use;              /* Number of allocated objects. */
+	long long alloc_cnt;        /* # of kmem_cache_alloc() calls. */
+	long long free_cnt;         /* # of kmem_cache_free() calls. */
+
+	struct list_elem elem;      /* Element in cache_list. */
+};
+
+/* Slab header, at the start of each slab's page. */
+struct slab {
+	unsigned magic;             /* Always set to SLAB_MAGIC. */
+	struct kmem_cache *cache;   /* Owning cache. */
+	struct list_elem elem;      /* Element in one of the cache's lists. */
+	size_t in_use;              /* Number of allocated objects. */
+	void *free;                 /* First free object, or null. */
+};
+
+/* The cache that kmem_cache structures come from. */
+static struct kmem_cache cache_cache;
+
+/* All caches, including cache_cache. */
+static struct list cache_list;
+static struct lock cache_list_lock;
+
+static void cache_setup (struct kmem_cache *, const char *name,
+		size_t size, size_t align, kmem_ctor_func *, enum mem_tag);
+static struct slab *slab_create (struct kmem_cache *);
+static void slab_destroy (struct kmem_cache *, struct slab *);
+static struct slab *obj_to_slab (void *);
+static void cache_free (struct kmem_cache *, void *obj);
+static size_t cache_shrink (struct kmem_cache *, size_t max);
+static shrinker_count_func slab_shrink_count;
+static shrinker_scan_func slab_shrink_scan;
+
+/* Returns the free pointer stored in free object OBJ of CACHE. */
+static inline void **
+free_ptr (const struct kmem_cache *cache, void *obj) {
+	return (void **) ((uint8_t *) obj + cache->free_ofs);
+}
+
+/* Initializes the slab allocator.  Must be called after the page
+   allocator and before any other kmem_cache_*() function. */
+void
+kmem_cache_init (void) {
+	list_init (&cache_list);
+	lock_init (&cache_list_lock);
+	cache_setup (&cache_cache, "kmem_cache", sizeof (struct kmem_cache),
+			sizeof (void *), NULL, MEM_MISC);
+	list_push_back (&cache_list, &cache_cache.elem);
+	register_shrinker ("slab", slab_shrink_count, slab_shrink_scan);
+}
+
+/* Creates and returns a cache of SIZE-byte objects aligned to
+   ALIGN bytes, which must be a power of 2 (or 0 for pointer
+   alignment).  If CTOR is nonnull it is run on every object when
+   its slab is created.  Objects and slabs are charged to memory
+   accounting tag TAG.  NAME must stay valid for the lifetime of
+   the cache.  Returns a null pointer if memory is not available. */
+struct kmem_cache *
+kmem_cache_create (const char *name, size_t size, size_t align,
+		kmem_ctor_func *ctor, enum mem_tag tag) {
+	struct kmem_cache *cache;
+
+	ASSERT (name != NULL);
+	ASSERT (size > 0);
+	ASSERT ((align & (align - 1)) == 0);
+
+	cache = kmem_cache_alloc (&cache_cache);
+	if (cache == NULL)
+		return NULL;
+	cache_setup (cache, name, size, align, ctor, tag);
+
+	lock_acquire (&cache_list_lock);
+	list_push_back (&cache_list, &cache->elem);
+	lock_release (&cache_list_lock);
+	return cache;
+}
+
+/* Destroys CACHE, which must have no allocated objects. */
+void
+kmem_cache_destroy (struct kmem_cache *cache) {
+	ASSERT (cache != NULL && cache != &cache_cache);
+	ASSERT (cache->in_use == 0);
+
+	lock_acquire (&cache_list_lock);
+	list_remove (&cache->elem);
+	lock_release (&cache_list_lock);
+
+	kmem_cache_shrink (cache);
+	ASSERT (cache->slab_cnt == 0);
+	kmem_cache_free (&cache_cache, cache);
+}
+
+/* Allocates and returns an object from CACHE.
+   Returns a null pointer if memory is not available. */
+void *
+kmem_cache_alloc (struct kmem_cache *cache) {
+	struct slab *slab;
+	void *obj;
+
+	ASSERT (cache != NULL);
+
+	lock_acquire (&cache->lock);
+	if (!list_empty (&cache->partial))
+		slab = list_entry (list_front (&cache->partial), struct slab, elem);
+	else if (!list_empty (&cache->empty)) {
+		slab = list_entry (list_pop_front (&cache->empty), struct slab, elem);
+		cache->empty_cnt--;
+		list_push_front (&cache->partial, &slab->elem);
+	} else {
+		slab = slab_create (cache);
+		if (slab == NULL) {
+			lock_release (&cache->lock);
+			return NULL;
+		}
+		list_push_front (&cache->partial, &slab->elem);
+	}
+
+	/* Take the slab's first free object. */
+	obj = slab->free;
+	ASSERT (obj != NULL);
+	slab->free = *free_ptr (cache, obj);
+	if (++slab->in_use == cache->objs_per_slab) {
+		list_remove (&slab->elem);
+		list_push_back (&cache->full, &slab->elem);
+	}
+	cache->in_use++;
+	cache->alloc_cnt++;
+	lock_release (&cache->lock);
+
+	memacct_alloc (cache->tag, obj, cache->obj_size, 0,
+			__builtin_return_address (0));
+	return obj;
+}
+
+/* Frees OBJ, which must have been allocated from CACHE.
+   A null OBJ is ignored. */
+void
+kmem_cache_free (struct kmem_cache *cache, void *obj) {
+	if (obj == NULL)
+		return;
+
+	lock_acquire (&cache->lock);
+	cache_free (cache, obj);
+	lock_release (&cache->lock);
+}
+
+/* Frees OBJ as kmem_cache_free() does, unless CACHE's lock is
+   taken, in which case it returns false and OBJ stays allocated.
+   For shrinkers, which must not block. */
+bool
+kmem_cache_try_free (struct kmem_cache *cache, void *obj) {
+	ASSERT (obj != NULL);
+
+	if (lock_held_by_current_thread (&cache->lock)
+			|| !lock_try_acquire (&cache->lock))
+		return false;
+	cache_free (cache, obj);
+	lock_release (&cache->lock);
+	return true;
+}
+
+/* Returns OBJ to its slab in CACHE.  The caller must hold CACHE's
+   lock. */
+static void
+cache_free (struct kmem_cache *cache, void *obj) {
+	struct slab *slab = obj_to_slab (obj);
+
+	ASSERT (slab->cache == cache);
+	ASSERT ((pg_ofs (obj) - cache->first_ofs) % cache->size == 0);
+	memacct_free (cache->tag, obj, cache->obj_size, 0);
+
+#ifndef NDEBUG
+	/* Clear the object to help detect use-after-free bugs.
+	   Constructed objects must keep their contents. */
+	if (cache->ctor == NULL)
+		memset (obj, 0xcc, cache->obj_size);
+#endif
+
+	*free_ptr (cache, obj) = slab->free;
+	slab->free = obj;
+
+	if (slab->in_use-- == cache->objs_per_slab) {
+		/* Was full, now partial. */
+		list_remove (&slab->elem);
+		list_push_front (&cache->partial, &slab->elem);
+	}
+	if (slab->in_use == 0) {
+		list_remove (&slab->elem);
+		if (cache->empty_cnt < EMPTY_SLABS_MAX) {
+			list_push_front (&cache->empty, &slab->elem);
+			cache->empty_cnt++;
+		} else
+			slab_destroy (cache, slab);
+	}
+	cache->in_use--;
+	cache->free_cnt++;
+}
+
+/* Returns the size of the objects in CACHE, as requested from
+   kmem_cache_create(). */
+size_t
+kmem_cache_size (const struct kmem_cache *cache) {
+	return cache->obj_size;
+}
+
+/* Gives all of CACHE's free slabs back to the page allocator.
+   Returns the number of pages freed. */
+size_t
+kmem_cache_shrink (struct kmem_cache *cache) {
+	size_t freed;
+
+	lock_acquire (&cache->lock);
+	freed = cache_shrink (cache, SIZE_MAX);
+	lock_release (&cache->lock);
+	return freed;
+}
+
+/* Returns the cache that OBJ was allocated from, or a null
+   pointer if OBJ's page is not a slab. */
+struct kmem_cache *
+kmem_cache_of (void *obj) {
+	struct slab *slab = pg_round_down (obj);
+
+	ASSERT (obj != NULL);
+	return slab->magic == SLAB_MAGIC ? slab->cache : NULL;
+}
+
+/* Prints the utilization of every cache that has ever been
+   used: objects in use over object slots, and bytes requested
+   over bytes taken from the page allocator. */
+void
+kmem_cache_print_stats (void) {
+	struct list_elem *e;
+
+	printf ("Slab: %-14s %5s %4s %6s %6s %7s %5s %5s\n",
+			"cache", "size", "objs", "slabs", "inuse", "allocs", "occ%", "util%");
+	for (e = list_begin (&cache_list); e != list_end (&cache_list);
+			e = list_next (e)) {
+		struct kmem_cache *c = list_entry (e, struct kmem_cache, elem);
+		size_t slots = c->slab_cnt * c->objs_per_slab;
+		size_t bytes = c->slab_cnt * PGSIZE;
+
+		if (c->alloc_cnt == 0)
+			continue;
+		printf ("Slab: %-14s %5zu %4zu %6zu %6zu %7lld %5zu %5zu\n",
+				c->name, c->obj_size, c->objs_per_slab, c->slab_cnt,
+				c->in_use, c->alloc_cnt,
+				slots ? c->in_use * 100 / slots : 0,
+				bytes ? c->in_use * c->obj_size * 100 / bytes : 0);
+	}
+}
+
+/* Initializes CACHE for SIZE-byte objects aligned to ALIGN with
+   constructor CTOR, charged to TAG. */
+static void
+cache_setup (struct kmem_cache *cache, const char *name, size_t size,
+		size_t align, kmem_ctor_func *ctor, enum mem_tag tag) {
+	if (align < sizeof (void *))
+		align = sizeof (void *);
+
+	cache->name = name;
+	cache->obj_size = size;
+	cache->ctor = ctor;
+	cache->tag = tag;
+	if (ctor != NULL) {
+		/* Keep the free pointer out of the constructed object. */
+		cache->free_ofs = ROUND_UP (size, sizeof (void *));
+		cache->size = ROUND_UP (cache->free_ofs + sizeof (void *), align);
+	} else {
+		cache->free_ofs = 0;
+		cache->size = ROUND_UP (size, align);
+	}
+	cache->first_ofs = ROUND_UP (sizeof (struct slab), align);
+	ASSERT (cache->first_ofs + cache->size <= PGSIZE);
+	cache->objs_per_slab = (PGSIZE - cache->first_ofs) / cache->size;
+
+	lock_init (&cache->lock);
+	list_init (&cache->partial);
+	list_init (&cache->full);
+	list_init (&cache->empty);
+	cache->slab_cnt = 0;
+	cache->empty_cnt = 0;
+	cache->in_use = 0;
+	cache->alloc_cnt = 0;
+	cache->free_cnt = 0;
+}
+
+/* Allocates a new slab for CACHE, constructs its objects and
+   chains them on its free list.  The caller must hold CACHE's
+   lock and put the slab on one of CACHE's lists.  Returns a null
+   pointer if memory is not available. */
+static struct slab *
+slab_create (struct kmem_cache *cache) {
+	struct slab *slab;
+	uint8_t *obj;
+	size_t i;
+
+	/* A slab outlives the objects in it, so it is not recorded as
+	   an allocation of whoever made it. */
+	slab = palloc_get_page (PAL_NOTRACK | PAL_TAG (cache->tag));
+	if (slab == NULL)
+		return NULL;
+
+	slab->magic = SLAB_MAGIC;
+	slab->cache = cache;
+	slab->in_use = 0;
+	slab->free = NULL;
+
+	/* Chain objects in address order. */
+	obj = (uint8_t *) slab + cache->first_ofs
+		+ (cache->objs_per_slab - 1) * cache->size;
+	for (i = 0; i < cache->objs_per_slab; i++, obj -= cache->size) {
+		if (cache->ctor != NULL)
+			cache->ctor (obj);
+		*free_ptr (cache, obj) = slab->free;
+		slab->free = obj;
+	}
+
+	cache->slab_cnt++;
+	return slab;
+}
+
+/* Returns SLAB, which must have no allocated objects and not be
+   on any list, to the page allocator. */
+static void
+slab_destroy (struct kmem_cache *cache, struct slab *slab) {
+	ASSERT (slab->in_use == 0);
+
+	slab->magic = 0;
+	cache->slab_cnt--;
+	palloc_free_page (slab);
+}
+
+/* Gives up to MAX of CACHE's free slabs back to the page
+   allocator and returns the number freed.  The caller must hold
+   CACHE's lock. */
+static size_t
+cache_shrink (struct kmem_cache *cache, size_t max) {
+	size_t freed = 0;
+
+	while (freed < max && !list_empty (&cache->empty)) {
+		struct slab *slab = list_entry (list_pop_front (&cache->empty),
+				struct slab, elem);
+		slab_destroy (cache, slab);
+		cache->empty_cnt--;
+		freed++;
+	}
+	return freed;
+}
+
+/* Shrinker count function: the number of free slabs in all
+   caches.  Taken without locks, so only a snapshot. */
+static size_t
+slab_shrink_count (void) {
+	struct list_elem *e;
+	size_t cnt = 0;
+
+	for (e = list_begin (&cache_list); e != list_end (&cache_list);
+			e = list_next (e))
+		cnt += list_entry (e, struct kmem_cache, elem)->empty_cnt;
+	return cnt;
+}
+
+/* Shrinker scan function: frees up to NR_TO_SCAN free slabs,
+   skipping caches whose lock is taken, by the allocating thread
+   itself too: kmem_cache_alloc() holds its cache's lock while it
+   asks for a new slab. */
+static size_t
+slab_shrink_scan (size_t nr_to_scan) {
+	struct list_elem *e;
+	size_t freed = 0;
+
+	if (lock_held_by_current_thread (&cache_list_lock)
+			|| !lock_try_acquire (&cache_list_lock))
+		return 0;
+	for (e = list_begin (&cache_list);
+			e != list_end (&cache_list) && freed < nr_to_scan;
+			e = list_next (e)) {
+		struct kmem_cache *c = list_entry (e, struct kmem_cache, elem);
+
+		if (c->empty_cnt == 0 || lock_held_by_current_thread (&c->lock)
+				|| !lock_try_acquire (&c->lock))
+			continue;
+		freed += cache_shrink (c, nr_to_scan - freed);
+		lock_release (&c->lock);
+	}
+	lock_release (&cache_list_lock);
+	return freed;
+}
+
+/* Returns the slab that OBJ is inside. */
+static struct slab *
+obj_to_slab (void *obj) {
+	struct slab *slab = pg_round_down (obj);
+
+	/* Check that the slab is valid. */
+	ASSERT (slab != NULL);
+	ASSERT (slab->magic == SLAB_MAGIC);
+
+	return slab;
+}
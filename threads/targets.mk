@@ -5,6 +5,11 @@ threads_SRC += threads/intr-stubs.S	# Interrupt stubs.
 threads_SRC += threads/synch.c		# Synchronization.
 threads_SRC += threads/palloc.c		# Page allocator.
 threads_SRC += threads/malloc.c		# Subpage allocator.
+threads_SRC += threads/slab.c		# Object caches.
+threads_SRC += threads/vmalloc.c	# Virtually contiguous allocator.
+threads_SRC += threads/memacct.c	# Kernel memory accounting.
+threads_SRC += threads/shrinker.c	# Cache shrinking under pressure.
+threads_SRC += threads/scratch.c	# Per-thread scratch arenas.
 threads_SRC += threads/start.S		# Startup code.
 threads_SRC += threads/mmu.c		    # Memory management unit related things.
 threads_SRC += threads/fp-ops.c
\ No newline at end of file
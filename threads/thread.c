@@ -7,6 +7,7 @@
 #include "threads/flags.h"
 #include "threads/interrupt.h"
 #include "threads/intr-stubs.h"
+#include "threads/memacct.h"
 #include "threads/palloc.h"
 #include "threads/synch.h"
 #include "threads/vaddr.h"
@@ -212,7 +213,7 @@ thread_create (const char *name, int priority,
 	ASSERT (function != NULL);
 
 	/* Allocate thread. */
-	t = palloc_get_page (PAL_ZERO);						// (4KB) single page
+	t = palloc_get_page (PAL_ZERO | PAL_TAG (MEM_THREAD));	// (4KB) single page
 	if (t == NULL)
 		return TID_ERROR;
 
@@ -239,7 +240,8 @@ thread_create (const char *name, int priority,
 	t->parent_process = thread_current();
 
 	/* FDT setup */
-	t->fdt = palloc_get_multiple(PAL_ZERO, 1);
+	t->fdt = palloc_get_page(PAL_ZERO | PAL_TAG (MEM_FDT));
+	memacct_set_owner (t->fdt, tid);
 	t->nex_fd = 2;
 	for (size_t i = 2; i < MAX_FDT; i++)
 		t->fdt[i] = NULL;
@@ -321,6 +323,21 @@ thread_tid (void) {
 	return thread_current ()->tid;
 }
 
+/* Invokes FUNC on all threads, passing along AUX.
+   This function must be called with interrupts off. */
+void
+thread_foreach (thread_action_func *func, void *aux) {
+	struct list_elem *e;
+
+	ASSERT (intr_get_level () == INTR_OFF);
+
+	for (e = list_begin (&all_thread_list); e != list_end (&all_thread_list);
+			e = list_next (e)) {
+		struct thread *t = list_entry (e, struct thread, adv_elem);
+		func (t, aux);
+	}
+}
+
 /* Deschedules the current thread and destroys it.  Never
    returns to the caller. */
 void
@@ -444,6 +461,12 @@ idle (void *idle_started_ UNUSED) {
 		intr_disable ();
 		thread_block ();
 
+		/* Nothing else is ready, so use the time to zero a free
+		   page for a later palloc_get_page (PAL_ZERO).  Go around
+		   again after each page so a woken thread gets the CPU. */
+		if (palloc_zero_idle ())
+			continue;
+
 		/* Re-enable interrupts and wait for the next one.
 
 		   The `sti' instruction disables interrupts until the
@@ -639,6 +662,12 @@ do_schedule(int status) {
 			list_entry (list_pop_front (&destruction_req), struct thread, elem);
 		palloc_free_page(victim);
 	}
+	/* A dying thread's scratch arena and page magazines go away
+	   with its page. */
+	if (status == THREAD_DYING) {
+		scratch_destroy ();
+		palloc_magazine_drain ();
+	}
 	thread_current ()->status = status;
 	schedule ();
 }
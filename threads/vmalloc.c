@@ -0,0 +1,204 @@
+#include "threads/vmalloc.h"
+#include <bitmap.h>
+#include <debug.h>
+#include <round.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include "threads/init.h"
+#include "threads/malloc.h"
+#include "threads/mmu.h"
+#include "threads/palloc.h"
+#include "threads/synch.h"
+#include "threads/vaddr.h"
+
+/* Virtually contiguous kernel allocations.
+
+   malloc() satisfies large requests with palloc_get_multiple(),
+   which needs a physically contiguous run of pages.  Once the
+   kernel pool is fragmented such runs become hard to find even
+   though plenty of single pages are free.  vmalloc() instead
+   takes one page at a time from the page allocator and maps the
+   pages side by side in the vmalloc area (see vaddr.h).
+
+   The vmalloc area is handed out in page units tracked by a
+   bitmap.  Each allocation is followed by one unmapped guard
+   page, which both catches overruns and marks where the
+   allocation ends: vfree() unmaps pages until it reaches an
+   unmapped one, so no other bookkeeping is needed.
+
+   The page tables behind the vmalloc area hang off base_pml4's
+   kernel PML4 entry, which every process's pml4 shares, so a
+   mapping made here is visible in every address space at once.
+
+   vmalloc'd memory is not physically contiguous, so it must not
+   be passed to vtop() or handed to a device for DMA.  It is fine
+   for anything the CPU itself reads and writes, including disk
+   I/O through the PIO driver. */
+
+/* Number of pages in the vmalloc area. */
+#define VMALLOC_PAGES ((VMALLOC_END - VMALLOC_START) / PGSIZE)
+
+/* Used pages of the vmalloc area, including guard pages. */
+static struct bitmap *vmalloc_map;
+
+/* Protects vmalloc_map and the page tables behind the area. */
+static struct lock vmalloc_lock;
+
+/* Statistics. */
+static long long vmalloc_cnt;       /* # of successful vmalloc() calls. */
+static long long vmalloc_pages;     /* # of pages currently mapped. */
+static long long vmalloc_peak;      /* Maximum of vmalloc_pages. */
+static long long kvmalloc_fallbacks; /* # of kvmalloc()s served by vmalloc(). */
+
+static bool is_mapped (const void *va);
+static void unmap_range (uint8_t *va);
+
+/* Initializes the vmalloc area.  Must be called after
+   paging_init(). */
+void
+vmalloc_init (void) {
+	lock_init (&vmalloc_lock);
+	vmalloc_map = bitmap_create (VMALLOC_PAGES);
+	if (vmalloc_map == NULL)
+		PANIC ("vmalloc: cannot allocate area bitmap");
+}
+
+/* Obtains and returns a new block of at least SIZE bytes that is
+   contiguous in kernel virtual memory but not necessarily in
+   physical memory.  The block is page-aligned.
+   Returns a null pointer if SIZE is zero or if either the vmalloc
+   area or the page allocator is exhausted. */
+void *
+vmalloc (size_t size) {
+	size_t page_cnt = DIV_ROUND_UP (size, PGSIZE);
+	size_t idx, i;
+	uint8_t *va;
+
+	if (page_cnt == 0 || vmalloc_map == NULL)
+		return NULL;
+
+	lock_acquire (&vmalloc_lock);
+
+	/* Reserve PAGE_CNT pages plus the trailing guard page. */
+	idx = bitmap_scan_and_flip (vmalloc_map, 0, page_cnt + 1, false);
+	if (idx == BITMAP_ERROR) {
+		lock_release (&vmalloc_lock);
+		return NULL;
+	}
+	va = (uint8_t *) VMALLOC_START + idx * PGSIZE;
+
+	for (i = 0; i < page_cnt; i++) {
+		void *kpage = palloc_get_page (0);
+		if (kpage == NULL
+				|| !pml4_set_kpage (base_pml4, va + i * PGSIZE, kpage, true)) {
+			if (kpage != NULL)
+				palloc_free_page (kpage);
+			unmap_range (va);
+			bitmap_set_multiple (vmalloc_map, idx, page_cnt + 1, false);
+			lock_release (&vmalloc_lock);
+			return NULL;
+		}
+	}
+
+	vmalloc_cnt++;
+	vmalloc_pages += page_cnt;
+	if (vmalloc_pages > vmalloc_peak)
+		vmalloc_peak = vmalloc_pages;
+	lock_release (&vmalloc_lock);
+	return va;
+}
+
+/* Frees block VA, which must have been returned by vmalloc().
+   If VA is a null pointer, does nothing. */
+void
+vfree (void *va) {
+	size_t idx, page_cnt;
+
+	if (va == NULL)
+		return;
+	ASSERT (is_vmalloc_vaddr (va));
+	ASSERT (pg_ofs (va) == 0);
+
+	lock_acquire (&vmalloc_lock);
+	idx = pg_no ((uint64_t) va - VMALLOC_START);
+	for (page_cnt = 0; is_mapped ((uint8_t *) va + page_cnt * PGSIZE);
+			page_cnt++)
+		continue;
+	ASSERT (page_cnt > 0);
+
+	unmap_range (va);
+	bitmap_set_multiple (vmalloc_map, idx, page_cnt + 1, false);
+	vmalloc_pages -= page_cnt;
+	lock_release (&vmalloc_lock);
+}
+
+/* Returns true if page VA of the vmalloc area is mapped. */
+static bool
+is_mapped (const void *va) {
+	uint64_t *pte = pml4e_walk (base_pml4, (uint64_t) va, 0);
+	return pte != NULL && (*pte & PTE_P) != 0;
+}
+
+/* Unmaps and frees the pages mapped from VA up to the first
+   unmapped page.  The caller must hold vmalloc_lock. */
+static void
+unmap_range (uint8_t *va) {
+	void *kpage;
+
+	ASSERT (lock_held_by_current_thread (&vmalloc_lock));
+
+	for (; (kpage = pml4_clear_kpage (base_pml4, va)) != NULL; va += PGSIZE)
+		palloc_free_page (kpage);
+}
+
+/* Obtains a new block of at least SIZE bytes, preferring
+   physically contiguous memory from malloc() and falling back to
+   vmalloc() when no contiguous run is available.  The result
+   must be released with kvfree().
+   Returns a null pointer if no memory is available. */
+void *
+kvmalloc (size_t size) {
+	void *p = malloc (size);
+
+	if (p == NULL && size > 0) {
+		p = vmalloc (size);
+		if (p != NULL)
+			kvmalloc_fallbacks++;
+	}
+	return p;
+}
+
+/* Like kvmalloc(), but for an array of A elements of B bytes
+   each, zeroed. */
+void *
+kvcalloc (size_t a, size_t b) {
+	size_t size = a * b;
+	void *p;
+
+	if (size < a || size < b)
+		return NULL;
+
+	p = kvmalloc (size);
+	if (p != NULL)
+		memset (p, 0, size);
+	return p;
+}
+
+/* Frees block P, which must have been returned by kvmalloc() or
+   kvcalloc().  If P is a null pointer, does nothing. */
+void
+kvfree (void *p) {
+	if (is_vmalloc_vaddr (p))
+		vfree (p);
+	else
+		free (p);
+}
+
+/* Prints vmalloc statistics. */
+void
+vmalloc_print_stats (void) {
+	printf ("Vmalloc: %lld allocs, %lld pages mapped (peak %lld), "
+			"%lld kvmalloc fallbacks\n",
+			vmalloc_cnt, vmalloc_pages, vmalloc_peak, kvmalloc_fallbacks);
+}
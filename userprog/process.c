@@ -13,7 +13,10 @@
 #include "threads/flags.h"
 #include "threads/init.h"
 #include "threads/interrupt.h"
+#include "threads/malloc.h"
+#include "threads/memacct.h"
 #include "threads/palloc.h"
+#include "threads/scratch.h"
 #include "threads/thread.h"
 #include "threads/mmu.h"
 #include "threads/vaddr.h"
@@ -71,7 +74,14 @@ initd (void *f_name) {
 
 	process_init ();
 
-	if (process_exec (f_name) < 0)
+	/* process_exec() wants the name in our own scratch arena. */
+	char *file_name = scratch_alloc (strlen (f_name) + 1);
+	if (file_name == NULL)
+		PANIC("Fail to launch initd\n");
+	strlcpy (file_name, f_name, strlen (f_name) + 1);
+	palloc_free_page (f_name);
+
+	if (process_exec (file_name) < 0)
 		PANIC("Fail to launch initd\n");
 	NOT_REACHED ();
 }
@@ -126,7 +136,7 @@ duplicate_pte (uint64_t *pte, void *va, void *aux) {
 
 	/* 3. TODO: Allocate new PAL_USER page for the child and set result to
 	 *    TODO: NEWPAGE. */
-	newpage = palloc_get_page(PAL_USER);
+	newpage = palloc_get_page(PAL_USER | PAL_TAG (MEM_VM));
 	if (newpage == NULL)
 		return false;
 
@@ -192,6 +202,11 @@ __do_fork (void *aux) {
 	current->nex_fd = parent->nex_fd;
 	/* copy file descriptor table */
 
+	/* Our own handle on the executable, which pages not loaded yet
+	 * are read from and which keeps it write-protected. */
+	if (parent->fp != NULL)
+		current->fp = file_duplicate (parent->fp);
+
 	sema_up(&current->sema_load);
 	process_init ();
 	if_.R.rax = 0;
@@ -207,8 +222,9 @@ error:
 	exit(-1);
 }
 
-/* Switch the current execution context to the f_name.
- * Returns -1 on fail. */
+/* Switch the current execution context to the f_name, which must
+ * have been allocated from the running thread's scratch arena.
+ * Returns -1 on fail, leaving f_name to the caller. */
 int
 process_exec (void *f_name) {
 	// char *file_name = f_name;
@@ -231,11 +247,12 @@ process_exec (void *f_name) {
 	sema_up(&thread_current()->sema_load);
 
 	/* If load failed, quit. */
-	palloc_free_page (f_name);
 	if (!success)
 		return -1;
 	
-	/* Start switched process. */
+	/* Start switched process.  Our kernel stack is abandoned, and
+	 * with it every scratch mark on it, f_name's included. */
+	scratch_reset ();
 	do_iret (&_if);
 	NOT_REACHED ();
 }
@@ -300,9 +317,12 @@ process_exit (void) {
 			file_close(curr->fdt[i]);
 	}
 	
-	palloc_free_multiple(curr->fdt, 1);
-	file_close(curr->fp);
+	palloc_free_page(curr->fdt);
+	/* The executable stays open until its pages are gone, as vm's
+	 * index of shared text requires. */
 	process_cleanup ();
+	file_close(curr->fp);
+	memacct_exit ();
 }
 
 /* Free the current process's resources. */
@@ -417,8 +437,11 @@ load (const char *file_name, struct intr_frame *if_) {
 
 	/* parsing file_name */
 	char *save_ptr;
-	char *argv = palloc_get_page(0);
-	strlcpy(argv, file_name, PGSIZE);
+	void *mark = scratch_mark ();
+	char *argv = scratch_alloc (strlen (file_name) + 1);
+	if (argv == NULL)
+		return false;
+	strlcpy (argv, file_name, strlen (file_name) + 1);
 	
 	strtok_r(file_name, " ", &save_ptr);
 
@@ -432,7 +455,6 @@ load (const char *file_name, struct intr_frame *if_) {
 	lock_acquire(&filesys_lock);
 	file = filesys_open (file_name);
 	if (file == NULL) {
-		palloc_free_page(argv);
 		printf ("load: %s: open failed\n", file_name);
 		goto done;
 	}
@@ -562,9 +584,9 @@ load (const char *file_name, struct intr_frame *if_) {
 	file_deny_write(file);
 
 	success = true;
-	palloc_free_page(argv);
 done:
 	/* We arrive here whether the load is successful or not. */
+	scratch_release (mark);
 	// file_close (file);
 
 	return success;
@@ -653,7 +675,7 @@ load_segment (struct file *file, off_t ofs, uint8_t *upage,
 		size_t page_zero_bytes = PGSIZE - page_read_bytes;
 
 		/* Get a page of memory. */
-		uint8_t *kpage = palloc_get_page (PAL_USER);
+		uint8_t *kpage = palloc_get_page (PAL_USER | PAL_TAG (MEM_VM));
 		if (kpage == NULL)
 			return false;
 
@@ -685,7 +707,7 @@ setup_stack (struct intr_frame *if_) {
 	uint8_t *kpage;
 	bool success = false;
 
-	kpage = palloc_get_page (PAL_USER | PAL_ZERO);
+	kpage = palloc_get_page (PAL_USER | PAL_ZERO | PAL_TAG (MEM_VM));
 	if (kpage != NULL) {
 		success = install_page (((uint8_t *) USER_STACK) - PGSIZE, kpage, true);
 		if (success)
@@ -719,11 +741,28 @@ install_page (void *upage, void *kpage, bool writable) {
  * If you want to implement the function for only project 2, implement it on the
  * upper block. */
 
+/* Loads PAGE from the executable as described by AUX, a struct
+ * load_info, on its first fault. */
 static bool
 lazy_load_segment (struct page *page, void *aux) {
-	/* TODO: Load the segment from the file */
-	/* TODO: This called when the first page fault occurs on address VA. */
-	/* TODO: VA is available when calling this function. */
+	struct load_info *info = aux;
+	struct file *file = info->file != NULL ? info->file : thread_current ()->fp;
+	uint8_t *kva = page->frame->kva;
+	bool held = lock_held_by_current_thread (&filesys_lock);
+	bool success;
+
+	/* The fault may come from a system call that is already inside
+	 * the file system, such as read() into a page not loaded yet. */
+	if (!held)
+		lock_acquire (&filesys_lock);
+	success = (file_read_at (file, kva, info->read_bytes, info->ofs)
+			== (int) info->read_bytes);
+	if (!held)
+		lock_release (&filesys_lock);
+
+	memset (kva + info->read_bytes, 0, PGSIZE - info->read_bytes);
+	free (info);
+	return success;
 }
 
 /* Loads a segment starting at offset OFS in FILE at address
@@ -738,32 +777,52 @@ lazy_load_segment (struct page *page, void *aux) {
  * The pages initialized by this function must be writable by the
  * user process if WRITABLE is true, read-only otherwise.
  *
+ * FILE must be the process's executable.  Nothing is read until a
+ * page is first touched; pages with nothing to read are simply
+ * zero-filled then.
+ *
  * Return true if successful, false if a memory allocation error
  * or disk read error occurs. */
 static bool
-load_segment (struct file *file, off_t ofs, uint8_t *upage,
+load_segment (struct file *file UNUSED, off_t ofs, uint8_t *upage,
 		uint32_t read_bytes, uint32_t zero_bytes, bool writable) {
 	ASSERT ((read_bytes + zero_bytes) % PGSIZE == 0);
 	ASSERT (pg_ofs (upage) == 0);
 	ASSERT (ofs % PGSIZE == 0);
 
+	if (vma_create (&thread_current ()->spt.vmas, upage,
+				upage + read_bytes + zero_bytes, VMA_SEGMENT, writable) == NULL)
+		return false;
+
 	while (read_bytes > 0 || zero_bytes > 0) {
 		/* Do calculate how to fill this page.
 		 * We will read PAGE_READ_BYTES bytes from FILE
 		 * and zero the final PAGE_ZERO_BYTES bytes. */
 		size_t page_read_bytes = read_bytes < PGSIZE ? read_bytes : PGSIZE;
 		size_t page_zero_bytes = PGSIZE - page_read_bytes;
-
-		/* TODO: Set up aux to pass information to the lazy_load_segment. */
-		void *aux = NULL;
+		vm_initializer *init = NULL;
+		struct load_info *aux = NULL;
+
+		if (page_read_bytes > 0) {
+			aux = malloc (sizeof *aux);
+			if (aux == NULL)
+				return false;
+			aux->file = NULL;
+			aux->ofs = ofs;
+			aux->read_bytes = page_read_bytes;
+			init = lazy_load_segment;
+		}
 		if (!vm_alloc_page_with_initializer (VM_ANON, upage,
-					writable, lazy_load_segment, aux))
+					writable, init, aux)) {
+			free (aux);
 			return false;
+		}
 
 		/* Advance. */
 		read_bytes -= page_read_bytes;
 		zero_bytes -= page_zero_bytes;
 		upage += PGSIZE;
+		ofs += page_read_bytes;
 	}
 	return true;
 }
@@ -774,11 +833,16 @@ setup_stack (struct intr_frame *if_) {
 	bool success = false;
 	void *stack_bottom = (void *) (((uint8_t *) USER_STACK) - PGSIZE);
 
-	/* TODO: Map the stack on stack_bottom and claim the page immediately.
-	 * TODO: If success, set the rsp accordingly.
-	 * TODO: You should mark the page is stack. */
-	/* TODO: Your code goes here */
-
+	/* The arguments go in right away, so claim the page now.  The
+	 * stack grows below it on demand, within its area. */
+	if (vma_create (&thread_current ()->spt.vmas,
+				(void *) (USER_STACK - STACK_MAX), (void *) USER_STACK,
+				VMA_STACK, true) != NULL
+			&& vm_alloc_page (VM_ANON, stack_bottom, true)
+			&& vm_claim_page (stack_bottom)) {
+		if_->rsp = USER_STACK;
+		success = true;
+	}
 	return success;
 }
 #endif /* VM */
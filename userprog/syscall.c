@@ -11,9 +11,13 @@
 #include "filesys/filesys.h"
 #include "filesys/file.h"
 #include "threads/palloc.h"
+#include "threads/scratch.h"
 #include <string.h>
 
 #include "userprog/process.h"
+#ifdef VM
+#include "vm/vm.h"
+#endif
 // #include "string.h"
 
 void syscall_entry (void);
@@ -49,8 +53,16 @@ syscall_init (void) {
 
 bool
 address_check (void *pointer) {
+#ifdef VM
+	/* Pages are loaded lazily and the stack grows on demand, so a
+	 * valid pointer need not be mapped yet.  A bad one faults when
+	 * the kernel dereferences it, and the fault kills the process. */
+	if (pointer == NULL || is_kernel_vaddr(pointer))
+		exit(-1);
+#else
 	if (pointer == NULL || is_kernel_vaddr(pointer) || pml4_get_page(thread_current()->pml4, pointer) == NULL)
 		exit(-1);
+#endif
 }
 
 /* The main system call interface */
@@ -65,6 +77,11 @@ syscall_handler (struct intr_frame *f UNUSED) {
 	uint64_t arg5 = f->R.r8;
 	uint64_t arg6 = f->R.r9;
 
+#ifdef VM
+	/* For stack growth on faults taken while serving this call. */
+	thread_current ()->user_rsp = (void *) f->rsp;
+#endif
+
 	// check validity
 	switch (f->R.rax)
 	{
@@ -135,6 +152,16 @@ syscall_handler (struct intr_frame *f UNUSED) {
 			close((int)arg1);
 			break;
 
+#ifdef VM
+		case SYS_MMAP:
+			f->R.rax = (uint64_t) mmap((void*)arg1, (size_t)arg2, (int)arg3, (int)arg4, (off_t)arg5);
+			break;
+
+		case SYS_MUNMAP:
+			munmap((void*)arg1);
+			break;
+#endif
+
 		default:
 			exit(-1);
 			break;
@@ -150,6 +177,11 @@ void halt (void)
 void exit (int status)
 {
 	struct thread *curr = thread_current();
+
+	/* A fault on a bad user pointer may kill us inside the file
+	 * system. */
+	if (lock_held_by_current_thread (&filesys_lock))
+		lock_release (&filesys_lock);
 	thread_current()->exit_code = status;
 	printf("%s: exit(%d)\n", curr->name, curr->exit_code);
 	thread_exit();
@@ -268,6 +300,23 @@ void close (int fd)
 	file_close(param);
 }
 
+#ifdef VM
+void *mmap (void *addr, size_t length, int writable, int fd, off_t offset)
+{
+	struct file *param;
+
+	if (fd < 2 || fd >= MAX_FDT) return NULL;
+	param = fd_to_file(fd);
+	if (param == NULL) return NULL;
+	return do_mmap(addr, length, writable, param, offset);
+}
+
+void munmap (void *addr)
+{
+	do_munmap(addr);
+}
+#endif
+
 /* fd -> struct file* */
 struct file*
 fd_to_file (int fd) {
@@ -305,8 +354,15 @@ int wait (pid_t pid)
 
 int exec (const char *file)
 {
-	char *temp = palloc_get_page(PAL_ZERO);
+	void *mark = scratch_mark ();
+	char *temp = scratch_alloc (strlen (file) + 1);
+	int result;
+
+	if (temp == NULL)
+		return -1;
 	strlcpy(temp, file, strlen(file) + 1);
 	sema_down(&thread_current()->sema_load);
-	return process_exec(temp);
+	result = process_exec(temp);
+	scratch_release (mark);
+	return result;
 }
\ No newline at end of file
@@ -2,6 +2,15 @@
 
 #include "vm/vm.h"
 #include "devices/disk.h"
+#include <bitmap.h>
+#include <stdio.h>
+#include <string.h>
+#include "threads/malloc.h"
+#include "threads/memacct.h"
+#include "threads/palloc.h"
+#include "threads/synch.h"
+#include "threads/thread.h"
+#include "threads/vaddr.h"
 
 /* DO NOT MODIFY BELOW LINE */
 static struct disk *swap_disk;
@@ -17,36 +26,302 @@ static const struct page_operations anon_ops = {
 	.type = VM_ANON,
 };
 
+/* The swap disk is divided into page-sized slots of
+ * SECTORS_PER_SLOT sectors.  SWAP_MAP has a bit per slot, set if the
+ * slot is in use, and SWAP_REFS counts the pages that refer to each
+ * slot in use: after fork(), the parent's and the child's copies of
+ * a swapped-out page share its slot, until each reads it back in or
+ * goes away, and the slot is freed with the last of them.
+ *
+ * The disk is driven by programmed I/O, and every command costs a
+ * device selection and a wait for the drive, so swap moves pages in
+ * as few commands as it can.  An evicted page is not written out on
+ * its own: it is copied into the open cluster, a run of SWAP_CLUSTER
+ * slots reserved together, which goes to disk in one command once
+ * it is full.  Pages evicted one after another, which for a process
+ * sweeping through its memory are neighbours, so end up in
+ * neighbouring slots.  A page whose cluster has not been written yet
+ * is read back from the cluster's buffer.
+ *
+ * When a page is read back in, the pages after it in the same area
+ * that sit in the slots after its own are read by the same command,
+ * up to SWAP_READAHEAD of them, into the readahead buffer, where their
+ * own faults find them.  Nothing is mapped ahead of time, so
+ * readahead takes no frames away from anyone.
+ *
+ * SWAP_LOCK protects all of this, across the I/O too. */
+#define SECTORS_PER_SLOT (PGSIZE / DISK_SECTOR_SIZE)
+#define NO_SLOT SIZE_MAX
+
+#define SWAP_CLUSTER 8          /* Slots written by one command. */
+#define SWAP_READAHEAD 7        /* Most slots read ahead. */
+
+static struct bitmap *swap_map;
+static uint8_t *swap_refs;
+static struct lock swap_lock;
+static size_t swap_cursor;      /* Where to look for the next cluster. */
+
+/* The open cluster. */
+static uint8_t *cluster_buf;    /* SWAP_CLUSTER pages. */
+static size_t cluster_base;     /* First slot, or NO_SLOT if none open. */
+static size_t cluster_cnt;      /* Slots filled so far. */
+static uint32_t cluster_dead;   /* Filled slots freed since, by bit. */
+
+/* The readahead buffer. */
+static uint8_t *ra_buf;         /* SWAP_READAHEAD + 1 pages. */
+static size_t ra_base;          /* Slot of first page, or NO_SLOT. */
+static uint32_t ra_valid;       /* Pages still current, by bit. */
+
+/* Statistics. */
+static long long swap_out_cnt;      /* # of pages swapped out. */
+static long long swap_write_cnt;    /* # of write commands. */
+static long long swap_in_cnt;       /* # of pages swapped in. */
+static long long swap_read_cnt;     /* # of read commands. */
+static long long cluster_hit_cnt;   /* # of pages read from the cluster. */
+static long long ra_hit_cnt;        /* # of pages read from readahead. */
+
 /* Initialize the data for anonymous pages */
 void
 vm_anon_init (void) {
-	/* TODO: Set up the swap_disk. */
-	swap_disk = NULL;
+	/* Without a swap disk, anonymous pages just cannot be evicted. */
+	swap_disk = disk_get (1, 1);
+	lock_init (&swap_lock);
+	swap_map = bitmap_create (swap_disk != NULL
+			? disk_size (swap_disk) / SECTORS_PER_SLOT : 0);
+	swap_refs = calloc (bitmap_size (swap_map) + 1, sizeof *swap_refs);
+	if (swap_map == NULL || swap_refs == NULL)
+		PANIC ("out of memory for the swap map");
+
+	cluster_base = ra_base = NO_SLOT;
+	if (swap_disk != NULL) {
+		cluster_buf = palloc_get_multiple (PAL_TAG (MEM_VM), SWAP_CLUSTER);
+		ra_buf = palloc_get_multiple (PAL_TAG (MEM_VM), SWAP_READAHEAD + 1);
+		if (cluster_buf == NULL || ra_buf == NULL)
+			PANIC ("out of memory for swap buffers");
+	}
 }
 
 /* Initialize the file mapping */
 bool
-anon_initializer (struct page *page, enum vm_type type, void *kva) {
+anon_initializer (struct page *page, enum vm_type type UNUSED,
+		void *kva UNUSED) {
 	/* Set up the handler */
 	page->operations = &anon_ops;
 
 	struct anon_page *anon_page = &page->anon;
+	anon_page->slot = NO_SLOT;
+	return true;
+}
+
+/* Reads CNT slots starting at SLOT into BUF. */
+static void
+swap_read (size_t slot, size_t cnt, void *buf) {
+	disk_read_multiple (swap_disk, slot * SECTORS_PER_SLOT,
+			cnt * SECTORS_PER_SLOT, buf);
+	swap_read_cnt++;
+}
+
+/* Writes CNT slots starting at SLOT from BUF. */
+static void
+swap_write (size_t slot, size_t cnt, const void *buf) {
+	disk_write_multiple (swap_disk, slot * SECTORS_PER_SLOT,
+			cnt * SECTORS_PER_SLOT, buf);
+	swap_write_cnt++;
+}
+
+/* Returns true if SLOT is in the open cluster. */
+static bool
+in_cluster (size_t slot) {
+	return (cluster_base != NO_SLOT && slot >= cluster_base
+			&& slot < cluster_base + SWAP_CLUSTER);
+}
+
+/* Reserves a new cluster.  Returns false if there is no run of
+ * SWAP_CLUSTER free slots. */
+static bool
+cluster_open (void) {
+	size_t slot = bitmap_scan_and_flip (swap_map, swap_cursor, SWAP_CLUSTER,
+			false);
+
+	if (slot == BITMAP_ERROR)
+		slot = bitmap_scan_and_flip (swap_map, 0, SWAP_CLUSTER, false);
+	if (slot == BITMAP_ERROR)
+		return false;
+	cluster_base = slot;
+	cluster_cnt = 0;
+	cluster_dead = 0;
+	swap_cursor = slot + SWAP_CLUSTER;
+	return true;
+}
+
+/* Writes out the open cluster, which must be full, and closes it,
+ * releasing the slots whose pages are already gone. */
+static void
+cluster_flush (void) {
+	size_t i;
+
+	ASSERT (cluster_cnt == SWAP_CLUSTER);
+
+	swap_write (cluster_base, SWAP_CLUSTER, cluster_buf);
+	for (i = 0; i < SWAP_CLUSTER; i++)
+		if (cluster_dead & (1u << i))
+			bitmap_reset (swap_map, cluster_base + i);
+	cluster_base = NO_SLOT;
+}
+
+/* Drops a reference to swap slot SLOT, freeing it if that was the
+ * last. */
+static void
+swap_free (size_t slot) {
+	ASSERT (swap_refs[slot] > 0);
+
+	if (--swap_refs[slot] > 0)
+		return;
+	if (ra_base != NO_SLOT && slot >= ra_base
+			&& slot <= ra_base + SWAP_READAHEAD)
+		ra_valid &= ~(1u << (slot - ra_base));
+
+	/* A slot in the open cluster is still to be written, so it cannot
+	 * be given out again before that. */
+	if (in_cluster (slot))
+		cluster_dead |= 1u << (slot - cluster_base);
+	else
+		bitmap_reset (swap_map, slot);
+}
+
+/* Returns how many of the pages after PAGE, which is in slot SLOT,
+ * to read along with it: those in the same area of the current
+ * process that are swapped out to the slots after SLOT, and already
+ * on disk. */
+static size_t
+readahead_cnt (struct page *page, size_t slot) {
+	struct supplemental_page_table *spt = &thread_current ()->spt;
+	struct vma *vma;
+	size_t n;
+
+	/* fork() reads its parent's pages in for it. */
+	if (spt_find_page (spt, page->va) != page)
+		return 0;
+	vma = vma_find (&spt->vmas, page->va);
+	if (vma == NULL)
+		return 0;
+
+	for (n = 0; n < SWAP_READAHEAD; n++) {
+		void *va = (uint8_t *) page->va + (n + 1) * PGSIZE;
+		size_t next = slot + n + 1;
+		struct page *p;
+
+		if (va >= vma->end || in_cluster (next))
+			break;
+		p = spt_find_page (spt, va);
+		if (p == NULL || p->operations != &anon_ops || p->anon.slot != next)
+			break;
+	}
+	return n;
 }
 
 /* Swap in the page by read contents from the swap disk. */
 static bool
 anon_swap_in (struct page *page, void *kva) {
 	struct anon_page *anon_page = &page->anon;
+	size_t slot = anon_page->slot;
+
+	ASSERT (slot != NO_SLOT);
+
+	lock_acquire (&swap_lock);
+	if (in_cluster (slot)) {
+		memcpy (kva, cluster_buf + (slot - cluster_base) * PGSIZE, PGSIZE);
+		cluster_hit_cnt++;
+	} else if (ra_base != NO_SLOT && slot >= ra_base
+			&& slot <= ra_base + SWAP_READAHEAD
+			&& (ra_valid & (1u << (slot - ra_base)))) {
+		memcpy (kva, ra_buf + (slot - ra_base) * PGSIZE, PGSIZE);
+		ra_hit_cnt++;
+	} else {
+		size_t n = readahead_cnt (page, slot);
+
+		if (n == 0)
+			swap_read (slot, 1, kva);
+		else {
+			swap_read (slot, n + 1, ra_buf);
+			memcpy (kva, ra_buf, PGSIZE);
+			ra_base = slot;
+			ra_valid = ((1u << (n + 1)) - 1) & ~1u;
+		}
+	}
+	swap_free (slot);
+	anon_page->slot = NO_SLOT;
+	swap_in_cnt++;
+	lock_release (&swap_lock);
+	return true;
 }
 
 /* Swap out the page by writing contents to the swap disk. */
 static bool
 anon_swap_out (struct page *page) {
 	struct anon_page *anon_page = &page->anon;
+	const void *kva = page->frame->kva;
+	size_t slot;
+
+	lock_acquire (&swap_lock);
+	if (cluster_base != NO_SLOT || cluster_open ()) {
+		slot = cluster_base + cluster_cnt;
+		swap_refs[slot] = 1;
+		memcpy (cluster_buf + cluster_cnt * PGSIZE, kva, PGSIZE);
+		if (++cluster_cnt == SWAP_CLUSTER)
+			cluster_flush ();
+	} else {
+		/* Too fragmented for a cluster: write the page alone. */
+		slot = bitmap_scan_and_flip (swap_map, 0, 1, false);
+		if (slot == BITMAP_ERROR) {
+			lock_release (&swap_lock);
+			return false;
+		}
+		swap_refs[slot] = 1;
+		swap_write (slot, 1, kva);
+	}
+	anon_page->slot = slot;
+	swap_out_cnt++;
+	lock_release (&swap_lock);
+	return true;
 }
 
 /* Destroy the anonymous page. PAGE will be freed by the caller. */
 static void
 anon_destroy (struct page *page) {
 	struct anon_page *anon_page = &page->anon;
+
+	if (anon_page->slot != NO_SLOT) {
+		lock_acquire (&swap_lock);
+		swap_free (anon_page->slot);
+		lock_release (&swap_lock);
+	}
+}
+
+/* Adds a reference to the swap slot of PAGE, which is swapped out,
+ * for a copy of PAGE made by fork() or a page that shared its frame.
+ * Returns false if the slot has
+ * as many references as it can count. */
+bool
+anon_swap_dup (struct page *page) {
+	size_t slot = page->anon.slot;
+	bool ok;
+
+	ASSERT (slot != NO_SLOT);
+
+	lock_acquire (&swap_lock);
+	ok = swap_refs[slot] < SWAP_REF_MAX;
+	if (ok)
+		swap_refs[slot]++;
+	lock_release (&swap_lock);
+	return ok;
+}
+
+/* Prints swap statistics. */
+void
+vm_anon_print_stats (void) {
+	printf ("Swap: %lld pages out in %lld writes, %lld pages in in %lld "
+			"reads, %lld from the open cluster, %lld read ahead\n",
+			swap_out_cnt, swap_write_cnt, swap_in_cnt, swap_read_cnt,
+			cluster_hit_cnt, ra_hit_cnt);
 }
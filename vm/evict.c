@@ -0,0 +1,237 @@
+/* evict.c: Eviction policies.
+ *
+ * A policy sees only the frames that may be evicted (see frame.c)
+ * and learns about references to them only through the accessed
+ * bits the MMU sets in the page table: a page fault is taken on a
+ * miss, never on a hit.  Each policy is a set of operations on a
+ * struct evict_queues; a frame it has not seen before arrives with
+ * QUEUE and AGE zero.
+ *
+ * CLOCK (second chance) keeps the frames in a circle.  The hand
+ * goes round, clearing accessed bits, and stops at the first frame
+ * whose bit was already clear.
+ *
+ * LRU approximates least recently used with aging counters: on each
+ * eviction every frame's counter is shifted right, with its accessed
+ * bit shifted in at the top, and the frame with the smallest counter
+ * goes.  That orders frames by their last eight evictions' worth of
+ * references at the cost of a pass over all of them.
+ *
+ * 2Q (Johnson and Shasha, VLDB 1994) keeps a frame that holds a
+ * page for the first time on A1in, a FIFO, and evicts from there
+ * while A1in holds more than a quarter of the frames.  A page evicted
+ * from A1in is remembered on A1out, and if it faults back in while
+ * still remembered it has shown that it is reused beyond a single
+ * burst, so it goes on Am, the main queue, which is run as a CLOCK.
+ * A scan through memory thus only ever displaces A1in.  A1out holds
+ * no frames, only the identities of the last half a memory's worth
+ * of pages evicted from A1in; rather than keep them on a list, each
+ * page records the A1in eviction count at which it left in its
+ * GHOST member, so membership is one subtraction. */
+
+#include "vm/frame.h"
+#include "threads/mmu.h"
+#include "vm/vm.h"
+
+/* Initializes Q as empty. */
+void
+evict_queues_init (struct evict_queues *q) {
+	size_t i;
+
+	for (i = 0; i < EVICT_QUEUES; i++) {
+		list_init (&q->queue[i]);
+		q->cnt[i] = 0;
+	}
+	q->hand = NULL;
+	q->seq = 0;
+}
+
+/* Returns true if any of FRAME's pages has been accessed since the
+ * last call, and clears their accessed bits. */
+static bool
+test_and_clear_accessed (struct frame *frame) {
+	bool accessed = false;
+	struct list_elem *e;
+
+	for (e = list_begin (&frame->pages); e != list_end (&frame->pages);
+			e = list_next (e)) {
+		struct page *page = list_entry (e, struct page, frame_elem);
+
+		if (pml4_is_accessed (page->pml4, page->va)) {
+			pml4_set_accessed (page->pml4, page->va, false);
+			accessed = true;
+		}
+	}
+	return accessed;
+}
+
+/* Appends FRAME to queue I of Q. */
+static void
+enqueue (struct evict_queues *q, int i, struct frame *frame) {
+	frame->queue = i;
+	list_push_back (&q->queue[i], &frame->elem);
+	q->cnt[i]++;
+}
+
+/* Removes FRAME from whichever queue of Q it is in. */
+static void
+dequeue (struct evict_queues *q, struct frame *frame) {
+	if (q->hand == &frame->elem)
+		q->hand = list_next (q->hand);
+	list_remove (&frame->elem);
+	q->cnt[frame->queue]--;
+}
+
+/* Removes the first frame from queue I of Q and returns it, or
+ * returns a null pointer if the queue is empty. */
+static struct frame *
+dequeue_front (struct evict_queues *q, int i) {
+	struct frame *frame;
+
+	if (list_empty (&q->queue[i]))
+		return NULL;
+	frame = list_entry (list_front (&q->queue[i]), struct frame, elem);
+	dequeue (q, frame);
+	return frame;
+}
+
+/* Policy operation that removes FRAME from Q. */
+static void
+evict_remove (struct evict_queues *q, struct frame *frame) {
+	dequeue (q, frame);
+}
+
+/* CLOCK. */
+
+/* Puts FRAME just behind the hand, so that it is looked at last. */
+static void
+clock_insert (struct evict_queues *q, struct frame *frame) {
+	if (q->hand == NULL || q->hand == list_end (&q->queue[0]))
+		enqueue (q, 0, frame);
+	else {
+		frame->queue = 0;
+		list_insert (q->hand, &frame->elem);
+		q->cnt[0]++;
+	}
+}
+
+/* Runs the CLOCK over queue I of Q and returns the frame it stops
+ * at, removed from the queue, or a null pointer if the queue is
+ * empty.  Gives up on second chances after two full turns, in case
+ * the owners keep touching their pages while it looks. */
+static struct frame *
+clock_sweep (struct evict_queues *q, int i) {
+	struct list *list = &q->queue[i];
+	size_t limit = 2 * q->cnt[i];
+	size_t n;
+
+	if (list_empty (list))
+		return NULL;
+	for (n = 0; ; n++) {
+		struct frame *frame;
+
+		if (q->hand == NULL || q->hand == list_end (list))
+			q->hand = list_begin (list);
+		frame = list_entry (q->hand, struct frame, elem);
+		q->hand = list_next (q->hand);
+		if (!test_and_clear_accessed (frame) || n >= limit) {
+			dequeue (q, frame);
+			return frame;
+		}
+	}
+}
+
+static struct frame *
+clock_victim (struct evict_queues *q) {
+	return clock_sweep (q, 0);
+}
+
+const struct evict_policy evict_clock = {
+	.name = "clock",
+	.insert = clock_insert,
+	.remove = evict_remove,
+	.victim = clock_victim,
+};
+
+/* 2Q. */
+
+#define A1IN 0                  /* First-time pages, FIFO. */
+#define AM 1                    /* Reused pages, CLOCK. */
+
+/* A frame that arrives with a page just faulted back in holds that
+ * page alone, so its first page tells whether it is on A1out. */
+static void
+twoq_insert (struct evict_queues *q, struct frame *frame) {
+	struct page *page = list_entry (list_front (&frame->pages),
+			struct page, frame_elem);
+	size_t kout = (q->cnt[A1IN] + q->cnt[AM]) / 2 + 1;
+
+	if (frame->queue == AM
+			|| (page->ghost != 0 && q->seq - page->ghost < kout))
+		enqueue (q, AM, frame);
+	else
+		enqueue (q, A1IN, frame);
+}
+
+static struct frame *
+twoq_victim (struct evict_queues *q) {
+	size_t kin = (q->cnt[A1IN] + q->cnt[AM]) / 4;
+	struct frame *frame;
+
+	if (q->cnt[A1IN] > kin || q->cnt[AM] == 0) {
+		struct list_elem *e;
+
+		frame = dequeue_front (q, A1IN);
+		if (frame == NULL)
+			return NULL;
+		q->seq++;
+		for (e = list_begin (&frame->pages); e != list_end (&frame->pages);
+				e = list_next (e))
+			list_entry (e, struct page, frame_elem)->ghost = q->seq;
+		return frame;
+	}
+	return clock_sweep (q, AM);
+}
+
+const struct evict_policy evict_2q = {
+	.name = "2q",
+	.insert = twoq_insert,
+	.remove = evict_remove,
+	.victim = twoq_victim,
+};
+
+/* LRU approximation by aging. */
+
+static void
+lru_insert (struct evict_queues *q, struct frame *frame) {
+	enqueue (q, 0, frame);
+}
+
+/* Ages every frame and returns the oldest, the earliest inserted
+ * among equals. */
+static struct frame *
+lru_victim (struct evict_queues *q) {
+	struct frame *oldest = NULL;
+	struct list_elem *e;
+
+	for (e = list_begin (&q->queue[0]); e != list_end (&q->queue[0]);
+			e = list_next (e)) {
+		struct frame *frame = list_entry (e, struct frame, elem);
+
+		frame->age >>= 1;
+		if (test_and_clear_accessed (frame))
+			frame->age |= 0x80;
+		if (oldest == NULL || frame->age < oldest->age)
+			oldest = frame;
+	}
+	if (oldest != NULL)
+		dequeue (q, oldest);
+	return oldest;
+}
+
+const struct evict_policy evict_lru = {
+	.name = "lru",
+	.insert = lru_insert,
+	.remove = evict_remove,
+	.victim = lru_victim,
+};
@@ -1,6 +1,12 @@
 /* file.c: Implementation of memory backed file object (mmaped object). */
 
 #include "vm/vm.h"
+#include <string.h>
+#include "filesys/filesys.h"
+#include "threads/malloc.h"
+#include "threads/mmu.h"
+#include "threads/thread.h"
+#include "threads/vaddr.h"
 
 static bool file_backed_swap_in (struct page *page, void *kva);
 static bool file_backed_swap_out (struct page *page);
@@ -21,38 +27,193 @@ vm_file_init (void) {
 
 /* Initialize the file backed page */
 bool
-file_backed_initializer (struct page *page, enum vm_type type, void *kva) {
+file_backed_initializer (struct page *page, enum vm_type type UNUSED,
+		void *kva UNUSED) {
 	/* Set up the handler */
 	page->operations = &file_ops;
 
 	struct file_page *file_page = &page->file;
+	file_page->file = NULL;
+	file_page->ofs = 0;
+	file_page->read_bytes = 0;
+	return true;
+}
+
+/* Reads FILE_PAGE's bytes into KVA and zeros the rest of the page.
+ * The fault may come from a system call already inside the file
+ * system, so the lock is taken only if it is not held. */
+static bool
+file_page_read (struct file_page *file_page, void *kva) {
+	bool held = lock_held_by_current_thread (&filesys_lock);
+	bool success;
+
+	if (!held)
+		lock_acquire (&filesys_lock);
+	success = (file_read_at (file_page->file, kva, file_page->read_bytes,
+				file_page->ofs) == (int) file_page->read_bytes);
+	if (!held)
+		lock_release (&filesys_lock);
+	memset ((uint8_t *) kva + file_page->read_bytes, 0,
+			PGSIZE - file_page->read_bytes);
+	return success;
+}
+
+/* Writes FILE_PAGE's bytes back from KVA to its file.  If WAIT is
+ * false and someone else is in the file system, gives up and
+ * returns false instead of waiting. */
+static bool
+file_page_write (struct file_page *file_page, const void *kva, bool wait) {
+	bool held = lock_held_by_current_thread (&filesys_lock);
+
+	if (!held) {
+		if (wait)
+			lock_acquire (&filesys_lock);
+		else if (!lock_try_acquire (&filesys_lock))
+			return false;
+	}
+	file_write_at (file_page->file, kva, file_page->read_bytes,
+			file_page->ofs);
+	if (!held)
+		lock_release (&filesys_lock);
+	return true;
+}
+
+/* Loads PAGE of a mapping from the file described by AUX, a struct
+ * load_info, on its first fault. */
+static bool
+lazy_load_file (struct page *page, void *aux) {
+	struct load_info *info = aux;
+	struct file_page *file_page = &page->file;
+
+	file_page->file = info->file;
+	file_page->ofs = info->ofs;
+	file_page->read_bytes = info->read_bytes;
+	free (info);
+	return file_page_read (file_page, page->frame->kva);
 }
 
 /* Swap in the page by read contents from the file. */
 static bool
 file_backed_swap_in (struct page *page, void *kva) {
-	struct file_page *file_page UNUSED = &page->file;
+	return file_page_read (&page->file, kva);
 }
 
-/* Swap out the page by writeback contents to the file. */
+/* Swap out the page by writeback contents to the file.
+ *
+ * PAGE may belong to another process, whose page table it records,
+ * and it is already unmapped there, though the dirty bit survives.
+ * The thread evicting it may be one that faulted inside the file
+ * system, and that thread may be waiting for another eviction to
+ * finish, so this never waits for the file system: it fails
+ * instead, and the caller picks another victim. */
 static bool
 file_backed_swap_out (struct page *page) {
-	struct file_page *file_page UNUSED = &page->file;
+	struct file_page *file_page = &page->file;
+	uint64_t *pml4 = page->pml4;
+
+	if (pml4_is_dirty (pml4, page->va)) {
+		if (!file_page_write (file_page, page->frame->kva, false))
+			return false;
+		pml4_set_dirty (pml4, page->va, false);
+	}
+	return true;
 }
 
 /* Destory the file backed page. PAGE will be freed by the caller. */
 static void
 file_backed_destroy (struct page *page) {
-	struct file_page *file_page UNUSED = &page->file;
+	struct file_page *file_page = &page->file;
+	uint64_t *pml4 = thread_current ()->pml4;
+
+	if (page->frame != NULL && pml4 != NULL
+			&& pml4_is_dirty (pml4, page->va))
+		file_page_write (file_page, page->frame->kva, true);
 }
 
 /* Do the mmap */
 void *
 do_mmap (void *addr, size_t length, int writable,
 		struct file *file, off_t offset) {
+	struct supplemental_page_table *spt = &thread_current ()->spt;
+	uint8_t *upage = addr;
+	uint8_t *end;
+	struct vma *vma;
+	struct file *mapped;
+	size_t file_bytes;
+	off_t ofs = offset;
+
+	if (addr == NULL || pg_ofs (addr) != 0 || length == 0
+			|| offset < 0 || offset % PGSIZE != 0)
+		return NULL;
+	end = pg_round_up (upage + length);
+	if (end <= upage || !is_user_vaddr (end - 1))
+		return NULL;
+	/* One query against the areas covers the whole range: code,
+	 * data, stack and every other mapping. */
+	if (vma_overlaps (&spt->vmas, upage, end))
+		return NULL;
+
+	lock_acquire (&filesys_lock);
+	mapped = file_reopen (file);
+	file_bytes = mapped != NULL ? file_length (mapped) : 0;
+	lock_release (&filesys_lock);
+	if (file_bytes == 0) {
+		file_close (mapped);
+		return NULL;
+	}
+	file_bytes = offset < (off_t) file_bytes ? file_bytes - offset : 0;
+	if (file_bytes > length)
+		file_bytes = length;
+
+	vma = vma_create (&spt->vmas, upage, end, VMA_MMAP, writable);
+	if (vma == NULL) {
+		file_close (mapped);
+		return NULL;
+	}
+	vma->file = mapped;
+	vma->offset = offset;
+	vma->length = length;
+
+	for (; upage < end; upage += PGSIZE) {
+		size_t page_read_bytes = file_bytes < PGSIZE ? file_bytes : PGSIZE;
+		struct load_info *aux = malloc (sizeof *aux);
+
+		if (aux == NULL)
+			goto fail;
+		aux->file = mapped;
+		aux->ofs = ofs;
+		aux->read_bytes = page_read_bytes;
+		if (!vm_alloc_page_with_initializer (VM_FILE, upage, writable,
+					lazy_load_file, aux)) {
+			free (aux);
+			goto fail;
+		}
+		file_bytes -= page_read_bytes;
+		ofs += PGSIZE;
+	}
+	return addr;
+
+fail:
+	do_munmap (addr);
+	return NULL;
 }
 
 /* Do the munmap */
 void
 do_munmap (void *addr) {
+	struct supplemental_page_table *spt = &thread_current ()->spt;
+	struct vma *vma = vma_find (&spt->vmas, addr);
+	uint8_t *upage;
+
+	if (vma == NULL || vma->type != VMA_MMAP || vma->start != addr)
+		return;
+
+	for (upage = vma->start; upage < (uint8_t *) vma->end; upage += PGSIZE) {
+		struct page *page = spt_find_page (spt, upage);
+
+		/* File pages are never mapped huge. */
+		if (page != NULL)
+			spt_remove_page (spt, page);
+	}
+	vma_destroy (&spt->vmas, vma);
 }
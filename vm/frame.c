@@ -0,0 +1,401 @@
+/* frame.c: The frame table.
+ *
+ * Every user frame that holds, or is about to hold, a page is in
+ * the frame table.  A frame is either on the eviction policy's
+ * queues, where vm_evict_frame() may pick it, or pinned: being
+ * filled, being evicted, being copied for fork(), or being freed.
+ * Whoever pinned a frame owns it until it unpins or frees it.
+ *
+ * A frame holds one page, or after fork() several: one per process,
+ * all with the same contents, mapped read-only until one of them is
+ * written to (see vm_handle_wp()).  Executable text is shared the
+ * same way by processes that run the same program.  The list of a
+ * frame's pages, each of which records the page table that maps it,
+ * is the frame's reverse map: evicting or moving a shared frame
+ * visits each of its mappings, whatever the number of processes.  A
+ * frame is on the policy's queues whenever it holds a page and is
+ * not pinned.
+ *
+ * One lock protects the table, the policy's queues, the PINNED
+ * flags and the links between frames and their pages.  It is never
+ * held across I/O: an eviction pins its victim, drops the lock and
+ * only then writes the page out.  Anyone who needs a page whose
+ * frame someone else has pinned waits on FRAME_COND, which is
+ * signaled whenever a frame is unpinned or lets go of its page.
+ *
+ * The table also indexes frames by kernel virtual address, so that
+ * palloc's compaction can move a frame to another physical page
+ * (see frame_migrate()).
+ *
+ * Last, frames that hold a page of an executable's read-only text,
+ * as loaded, are indexed by the page's place in the executable: its
+ * inode, offset and length.  A process that faults on the same page
+ * of the same executable maps the frame that is there instead of
+ * reading it again, and then shares it as after fork().  A frame
+ * leaves the text index when it is evicted or freed; the processes
+ * it was loaded for hold the executable open until then, so its
+ * inode is not reused meanwhile. */
+
+#include "vm/frame.h"
+#include <debug.h>
+#include <hash.h>
+#include <string.h>
+#include "threads/interrupt.h"
+#include "threads/mmu.h"
+#include "threads/synch.h"
+#include "threads/vaddr.h"
+#include "vm/vm.h"
+
+/* Eviction policies that can be chosen with -evict=POLICY. */
+static const struct evict_policy *const policies[] = {
+	&evict_clock, &evict_2q, &evict_lru,
+};
+
+static const struct evict_policy *policy = &evict_clock;
+static struct evict_queues queues;
+
+static struct lock frame_lock;
+static struct condition frame_cond;
+static struct rhash frame_index;
+static struct rhash text_index;
+
+static bool frame_migrate (void *kpage, void *new_kpage);
+
+static uint64_t
+frame_hash (const struct rhash_elem *e, void *aux UNUSED) {
+	const struct frame *f = rhash_entry (e, struct frame, kva_elem);
+	return hash_bytes (&f->kva, sizeof f->kva);
+}
+
+static bool
+frame_less (const struct rhash_elem *a, const struct rhash_elem *b,
+		void *aux UNUSED) {
+	return (rhash_entry (a, struct frame, kva_elem)->kva
+			< rhash_entry (b, struct frame, kva_elem)->kva);
+}
+
+static uint64_t
+text_hash (const struct rhash_elem *e, void *aux UNUSED) {
+	const struct frame *f = rhash_entry (e, struct frame, text_elem);
+	return (hash_bytes (&f->inode, sizeof f->inode)
+			^ hash_int (f->ofs) ^ hash_int (f->read_bytes));
+}
+
+static bool
+text_less (const struct rhash_elem *a_, const struct rhash_elem *b_,
+		void *aux UNUSED) {
+	const struct frame *a = rhash_entry (a_, struct frame, text_elem);
+	const struct frame *b = rhash_entry (b_, struct frame, text_elem);
+
+	if (a->inode != b->inode)
+		return a->inode < b->inode;
+	if (a->ofs != b->ofs)
+		return a->ofs < b->ofs;
+	return a->read_bytes < b->read_bytes;
+}
+
+/* Initializes the frame table and lets palloc move user frames. */
+void
+frame_table_init (void) {
+	lock_init (&frame_lock);
+	cond_init (&frame_cond);
+	if (!rhash_init (&frame_index, frame_hash, frame_less, NULL)
+			|| !rhash_init (&text_index, text_hash, text_less, NULL))
+		PANIC ("out of memory for the frame table");
+	evict_queues_init (&queues);
+	palloc_set_migrate (PAL_USER, frame_migrate);
+}
+
+/* Selects the eviction policy called NAME.  Returns false if there
+ * is none.  Must be called before frame_table_init(). */
+bool
+frame_set_policy (const char *name) {
+	size_t i;
+
+	for (i = 0; i < sizeof policies / sizeof *policies; i++)
+		if (!strcmp (name, policies[i]->name)) {
+			policy = policies[i];
+			return true;
+		}
+	return false;
+}
+
+/* Returns the name of the eviction policy in use. */
+const char *
+frame_policy_name (void) {
+	return policy->name;
+}
+
+/* Returns the number of frames in the table. */
+size_t
+frame_table_size (void) {
+	return rhash_size (&frame_index);
+}
+
+/* Takes FRAME out of the text index, if it is there.  Call with
+ * FRAME_LOCK held. */
+static void
+text_unindex (struct frame *frame) {
+	if (frame->inode != NULL) {
+		rhash_delete (&text_index, &frame->text_elem);
+		frame->inode = NULL;
+	}
+}
+
+/* Adds new frame FRAME, pinned, to the table. */
+void
+frame_table_add (struct frame *frame) {
+	frame->pinned = true;
+	frame->inode = NULL;
+	lock_acquire (&frame_lock);
+	rhash_insert (&frame_index, &frame->kva_elem);
+	lock_release (&frame_lock);
+}
+
+/* Removes pinned frame FRAME from the table and wakes up anyone
+ * waiting to share it. */
+void
+frame_table_remove (struct frame *frame) {
+	ASSERT (frame->pinned);
+
+	lock_acquire (&frame_lock);
+	rhash_delete (&frame_index, &frame->kva_elem);
+	if (frame->inode != NULL) {
+		text_unindex (frame);
+		cond_broadcast (&frame_cond, &frame_lock);
+	}
+	lock_release (&frame_lock);
+}
+
+/* Returns the page FRAME holds, which must be the only one. */
+struct page *
+frame_page (struct frame *frame) {
+	ASSERT (frame->page_cnt == 1);
+	return list_entry (list_front (&frame->pages), struct page, frame_elem);
+}
+
+/* Adds PAGE, mapped in PML4, to the pages pinned FRAME holds. */
+void
+frame_link (struct frame *frame, struct page *page, uint64_t *pml4) {
+	ASSERT (frame->pinned);
+
+	lock_acquire (&frame_lock);
+	page->frame = frame;
+	page->pml4 = pml4;
+	list_push_back (&frame->pages, &page->frame_elem);
+	frame->page_cnt++;
+	lock_release (&frame_lock);
+}
+
+/* Removes PAGE from the pages pinned FRAME holds and returns how
+ * many are left.  PAGE->FRAME is left alone, for the caller to clear
+ * when done with it. */
+size_t
+frame_unlink (struct frame *frame, struct page *page) {
+	size_t left;
+
+	ASSERT (frame->pinned && page->frame == frame);
+
+	lock_acquire (&frame_lock);
+	list_remove (&page->frame_elem);
+	left = --frame->page_cnt;
+	lock_release (&frame_lock);
+	return left;
+}
+
+/* Unpins FRAME, which must hold a page, making it evictable. */
+void
+frame_unpin (struct frame *frame) {
+	ASSERT (frame->pinned && frame->page_cnt > 0);
+
+	lock_acquire (&frame_lock);
+	frame->pinned = false;
+	policy->insert (&queues, frame);
+	cond_broadcast (&frame_cond, &frame_lock);
+	lock_release (&frame_lock);
+}
+
+/* Asks the policy for a frame to evict and returns it pinned, or a
+ * null pointer if no frame is evictable. */
+struct frame *
+frame_pin_victim (void) {
+	struct frame *frame;
+
+	lock_acquire (&frame_lock);
+	frame = policy->victim (&queues);
+	if (frame != NULL)
+		frame->pinned = true;
+	lock_release (&frame_lock);
+	return frame;
+}
+
+/* Waits until PAGE's frame, if any, is not pinned by someone else.
+ * Call with FRAME_LOCK held. */
+static void
+wait_unpinned (struct page *page) {
+	while (page->frame != NULL && page->frame->pinned)
+		cond_wait (&frame_cond, &frame_lock);
+}
+
+/* Pins the frame that holds PAGE and returns it, or returns a null
+ * pointer if PAGE is not resident.  Waits out an eviction of PAGE
+ * in progress. */
+struct frame *
+frame_pin_page (struct page *page) {
+	struct frame *frame;
+
+	lock_acquire (&frame_lock);
+	wait_unpinned (page);
+	frame = page->frame;
+	if (frame != NULL) {
+		policy->remove (&queues, frame);
+		frame->pinned = true;
+	}
+	lock_release (&frame_lock);
+	return frame;
+}
+
+/* Waits out an eviction of PAGE in progress.  Returns true if PAGE
+ * is resident afterward, false if it was evicted. */
+bool
+frame_wait_page (struct page *page) {
+	bool resident;
+
+	lock_acquire (&frame_lock);
+	wait_unpinned (page);
+	resident = page->frame != NULL;
+	lock_release (&frame_lock);
+	return resident;
+}
+
+/* Unlinks pinned FRAME from the pages it held, which have been
+ * written out, and wakes up anyone waiting for that.  FRAME stays
+ * pinned. */
+void
+frame_evicted (struct frame *frame) {
+	ASSERT (frame->pinned);
+
+	lock_acquire (&frame_lock);
+	while (!list_empty (&frame->pages)) {
+		struct page *page = list_entry (list_pop_front (&frame->pages),
+				struct page, frame_elem);
+		page->frame = NULL;
+	}
+	frame->page_cnt = 0;
+	text_unindex (frame);
+	cond_broadcast (&frame_cond, &frame_lock);
+	lock_release (&frame_lock);
+}
+
+/* Enters pinned FRAME, which holds the page of executable INODE at
+ * OFS, READ_BYTES long, as loaded, in the text index.  Does nothing
+ * if another frame is there already for the same page. */
+void
+frame_index_text (struct frame *frame, struct inode *inode, off_t ofs,
+		size_t read_bytes) {
+	ASSERT (frame->pinned && frame->inode == NULL);
+
+	frame->inode = inode;
+	frame->ofs = ofs;
+	frame->read_bytes = read_bytes;
+	lock_acquire (&frame_lock);
+	if (rhash_insert (&text_index, &frame->text_elem) != NULL)
+		frame->inode = NULL;
+	lock_release (&frame_lock);
+}
+
+/* Looks up the frame that holds the page of executable INODE at
+ * OFS, READ_BYTES long, in the text index.  Returns it pinned, or a
+ * null pointer if there is none.  Waits out anyone else who has it
+ * pinned, such as an eviction, which may take it out of the index. */
+struct frame *
+frame_pin_text (struct inode *inode, off_t ofs, size_t read_bytes) {
+	struct frame key, *frame = NULL;
+	struct rhash_elem *e;
+
+	key.inode = inode;
+	key.ofs = ofs;
+	key.read_bytes = read_bytes;
+	lock_acquire (&frame_lock);
+	while ((e = rhash_find (&text_index, &key.text_elem)) != NULL) {
+		frame = rhash_entry (e, struct frame, text_elem);
+		if (!frame->pinned)
+			break;
+		cond_wait (&frame_cond, &frame_lock);
+		frame = NULL;
+	}
+	if (frame != NULL) {
+		policy->remove (&queues, frame);
+		frame->pinned = true;
+	}
+	lock_release (&frame_lock);
+	return frame;
+}
+
+/* Returns the number of frames in the text index. */
+size_t
+frame_text_size (void) {
+	return rhash_size (&text_index);
+}
+
+/* Returns true if each of the pages FRAME holds is mapped with a
+ * 4 kB PTE.  Call with FRAME_LOCK held. */
+static bool
+mapped_small (struct frame *frame) {
+	struct list_elem *e;
+
+	for (e = list_begin (&frame->pages); e != list_end (&frame->pages);
+			e = list_next (e)) {
+		struct page *page = list_entry (e, struct page, frame_elem);
+		uint64_t size;
+
+		if (pml4_lookup (page->pml4, (uint64_t) page->va, &size) == NULL
+				|| size != PGSIZE)
+			return false;
+	}
+	return true;
+}
+
+/* palloc_migrate_func for the user pool.  Copies the frame at KPAGE
+ * to NEW_KPAGE and maps each of its pages there instead, with the
+ * same permissions and accessed and dirty bits.  Pinned frames and
+ * frames of huge pages stay put. */
+static bool
+frame_migrate (void *kpage, void *new_kpage) {
+	struct frame key, *frame;
+	struct rhash_elem *e;
+	bool moved = false;
+
+	key.kva = kpage;
+	lock_acquire (&frame_lock);
+	e = rhash_find (&frame_index, &key.kva_elem);
+	frame = e != NULL ? rhash_entry (e, struct frame, kva_elem) : NULL;
+	if (frame != NULL && !frame->pinned && mapped_small (frame)) {
+		/* With interrupts off, no owner can write to the old copy
+		 * behind our back. */
+		enum intr_level old_level = intr_disable ();
+		struct list_elem *p;
+
+		memcpy (new_kpage, kpage, PGSIZE);
+		for (p = list_begin (&frame->pages); p != list_end (&frame->pages);
+				p = list_next (p)) {
+			struct page *page = list_entry (p, struct page, frame_elem);
+			uint64_t *pml4 = page->pml4;
+			bool writable = pml4_is_writable (pml4, page->va);
+			bool dirty = pml4_is_dirty (pml4, page->va);
+			bool accessed = pml4_is_accessed (pml4, page->va);
+
+			pml4_set_page (pml4, page->va, new_kpage, writable);
+			pml4_set_dirty (pml4, page->va, dirty);
+			pml4_set_accessed (pml4, page->va, accessed);
+		}
+		intr_set_level (old_level);
+
+		rhash_delete (&frame_index, &frame->kva_elem);
+		frame->kva = new_kpage;
+		rhash_insert (&frame_index, &frame->kva_elem);
+		moved = true;
+	}
+	lock_release (&frame_lock);
+	return moved;
+}
@@ -1,4 +1,7 @@
 vm_SRC = vm/vm.c          # Main api proxy
+vm_SRC += vm/vma.c        # Virtual memory areas
+vm_SRC += vm/frame.c      # Frame table
+vm_SRC += vm/evict.c      # Eviction policies
 vm_SRC += vm/uninit.c     # Uninitialized page
 vm_SRC += vm/anon.c       # Anonymous page
 vm_SRC += vm/file.c       # File mapped page
@@ -1,9 +1,151 @@
 /* vm.c: Generic interface for virtual memory objects. */
 
+#include <stdio.h>
+#include <string.h>
+#include "filesys/file.h"
 #include "threads/malloc.h"
+#include "threads/memacct.h"
+#include "threads/mmu.h"
+#include "threads/palloc.h"
+#include "threads/synch.h"
+#include "threads/thread.h"
+#include "threads/vaddr.h"
+#include "intrinsic.h"
 #include "vm/vm.h"
 #include "vm/inspect.h"
 
+/* Supplemental page table.
+ *
+ * The SPT is a radix tree with the same shape as the page table the
+ * MMU walks (see threads/mmu.c): the root node is indexed by the
+ * PML4 field of a user virtual address, the next levels by its PDPE
+ * and PDX fields, and a leaf by its PTX field, at SPT_FANOUT entries
+ * of one page per node.  spt_find_page() is four dependent loads
+ * with no hashing, comparison or locking, and walking the nodes in
+ * index order visits pages in address order.
+ *
+ * Nodes are created on the way down to an insertion.  When a
+ * removal leaves a node empty, it is freed and unlinked from its
+ * parent, and so on up, so a process pays for a node only where it
+ * has pages.  As with page tables, emptiness is found by scanning
+ * the node, which stops at the first entry in use.
+ *
+ * A leaf covers exactly the 2 MB that one PDE maps, which is what
+ * the transparent huge page check below looks at. */
+
+/* Number of bits of address each level of the SPT resolves, from
+ * the root down. */
+static const unsigned spt_shift[SPT_LEVELS] = {
+	PML4SHIFT, PDPESHIFT, PDXSHIFT, PTXSHIFT
+};
+
+/* Index of VA in a node at LEVEL of the SPT. */
+#define SPT_INDEX(VA, LEVEL) \
+	(((uint64_t) (VA) >> spt_shift[LEVEL]) & (SPT_FANOUT - 1))
+
+
+/* Transparent huge pages.
+ *
+ * An anonymous region that covers a whole 2 MB-aligned block of
+ * user memory can be backed by one HPAGE_SIZE frame mapped with a
+ * single PDE: one fault and one TLB entry instead of 512.  The fault
+ * handler asks vm_get_huge_frame() for an aligned block and falls
+ * back to 4 kB frames if there is none.  A huge page is split into
+ * 4 kB pages with vm_split_huge_page() before part of it is unmapped
+ * or evicted. */
+static long long thp_fault_cnt;     /* # of huge pages mapped. */
+static long long thp_fallback_cnt;  /* # of times no huge frame was free. */
+static long long thp_split_cnt;     /* # of huge pages split. */
+
+/* Copy-on-write fork.
+ *
+ * fork() does not copy the pages the parent has touched: the child's
+ * pages share the parent's frames, mapped read-only on both sides.
+ * The first write to such a page faults into vm_handle_wp(), which
+ * gives the writer a copy of its own.  fork() thus costs a PTE per
+ * page, whatever the parent's resident set, and a page neither side
+ * writes is never copied.  Pages the parent has swapped out are not
+ * even read in: the child's copy refers to the same swap slot, which
+ * is freed when the last page referring to it lets go (see anon.c). */
+static long long cow_share_cnt;     /* # of frames shared by fork(). */
+static long long cow_swap_share_cnt;  /* # of evicted pages shared. */
+static long long cow_copy_cnt;      /* # of shared pages copied. */
+static long long cow_reuse_cnt;     /* # of pages left unshared. */
+
+/* Shared text.
+ *
+ * Read-only pages of an executable are loaded once for all the
+ * processes that run it: a process that faults on one that another
+ * has loaded maps the same frame, read-only, instead of reading the
+ * page again, and from then on the two share it as after fork().
+ * See frame.c for the index of loaded text. */
+static long long text_share_cnt;    /* # of text pages not read. */
+
+/* The zero page.
+ *
+ * Reading an anonymous page that has never been written yields
+ * zeros, which need no frame of their own: a read fault on such a
+ * page maps zero_page, one zeroed page shared by all of them, in
+ * read-only, and leaves the page uninitialized and off the frame
+ * table.  The first write faults on the read-only PTE and only then
+ * claims a frame for the page, as a fault on an unmapped page would.
+ * A large sparse allocation that is mostly read thus costs a PTE per
+ * page read rather than a frame. */
+static void *zero_page;
+static long long zero_map_cnt;      /* # of pages mapped to zero_page. */
+static long long zero_write_cnt;    /* # of them written later. */
+
+/* Fault-around.
+ *
+ * Touching a lazily loaded executable or mapped file page by page
+ * takes a fault per page.  So a fault that reads a page from a file
+ * also loads and maps the neighbouring pages of the same area that
+ * are still to be read from a file, in the aligned window of
+ * vm_fault_around pages that holds the faulting page, as long as
+ * there are free frames to spare: a page that is not read soon is
+ * then only a cheap victim, its accessed bit clear.  A window of one
+ * page, set with -fault-around=1, turns this off. */
+#define FAULT_AROUND_DEFAULT 16
+size_t vm_fault_around = FAULT_AROUND_DEFAULT;
+static long long fault_cnt;         /* # of page faults. */
+static long long file_fault_cnt;    /* # of faults that read a file. */
+static long long around_cnt;        /* # of pages mapped around them. */
+
+/* Eviction.
+ *
+ * When the user pool runs dry, vm_get_frame() takes a frame from a
+ * resident page, chosen by the eviction policy selected with
+ * -evict=POLICY (see evict.c), after writing the page out: anonymous
+ * pages to swap, file pages back to their file if dirty.  A later
+ * fault on such a page reads it back in, which is a major fault;
+ * faults that only zero a page or load it the first time are not.
+ * A frame that processes share is evicted from all of them at once,
+ * through its list of pages. */
+static long long evict_cnt;         /* # of pages evicted. */
+static long long shared_evict_cnt;  /* # of them shared by processes. */
+static long long major_fault_cnt;   /* # of evicted pages read back. */
+
+/* Background reclaim.
+ *
+ * Evicting a page in vm_get_frame() means waiting for it to be
+ * written out in the middle of a fault: direct reclaim.  To keep that
+ * off the fault path, the kswapd thread keeps the number of free user
+ * frames between two watermarks.  An allocation that leaves fewer
+ * than the low watermark free wakes it, and it evicts pages, writing
+ * dirty ones out, and gives their frames back to the user pool until
+ * the high watermark is free.  A fault then only has to take a frame
+ * that is ready, unless the faults outrun the daemon. */
+#define KSWAPD_LOW_DIV 32           /* Low watermark, as a pool fraction. */
+static size_t kswapd_low;           /* Wake kswapd below this many free. */
+static size_t kswapd_high;          /* kswapd stops at this many free. */
+static struct semaphore kswapd_sema;  /* Upped to wake kswapd. */
+static bool kswapd_pending;         /* kswapd_sema already upped? */
+static long long kswapd_wake_cnt;   /* # of times kswapd ran. */
+static long long kswapd_reclaim_cnt;  /* # of frames kswapd freed. */
+static long long direct_reclaim_cnt;  /* # of frames evicted in a fault. */
+
+static void kswapd (void *aux);
+
 /* Initializes the virtual memory subsystem by invoking each subsystem's
  * intialize codes. */
 void
@@ -15,7 +157,19 @@ vm_init (void) {
 #endif
 	register_inspect_intr ();
 	/* DO NOT MODIFY UPPER LINES. */
-	/* TODO: Your code goes here. */
+	frame_table_init ();
+
+	zero_page = palloc_get_page (PAL_ZERO | PAL_TAG (MEM_VM));
+	if (zero_page == NULL)
+		PANIC ("out of memory for the zero page");
+
+	/* A system call writing to a copy-on-write page must fault, too. */
+	lcr0 (rcr0 () | CR0_WP);
+
+	kswapd_low = palloc_free_count (PAL_USER) / KSWAPD_LOW_DIV + 1;
+	kswapd_high = 2 * kswapd_low;
+	sema_init (&kswapd_sema, 0);
+	thread_create ("kswapd", PRI_DEFAULT, kswapd, NULL);
 }
 
 /* Get the type of the page. This function is useful if you want to know the
@@ -35,11 +189,26 @@ page_get_type (struct page *page) {
 /* Helpers */
 static struct frame *vm_get_victim (void);
 static bool vm_do_claim_page (struct page *page);
+static struct frame *vm_claim_pinned (struct page *page, uint64_t *pml4);
 static struct frame *vm_evict_frame (void);
+static void vm_free_frame (struct frame *frame);
+static void vm_free_page (struct page *page);
+static bool is_fresh_anon (const struct page *page);
+static bool is_file_load (const struct page *page);
+static void vm_map_around (struct page *page, struct vma *vma);
+static bool vm_try_huge_fault (struct supplemental_page_table *spt,
+		struct page *page);
+static struct page **spt_slot (struct supplemental_page_table *spt,
+		const void *va, bool create);
+static void spt_prune (struct supplemental_page_table *spt, const void *va);
 
 /* Create the pending page object with initializer. If you want to create a
  * page, do not create it directly and make it through this function or
- * `vm_alloc_page`. */
+ * `vm_alloc_page`.
+ *
+ * AUX, if not null, must be a malloc()'d struct load_info, which the
+ * page takes over on success; on failure it stays with the caller.
+ * A page with no INIT is zero-filled on first use. */
 bool
 vm_alloc_page_with_initializer (enum vm_type type, void *upage, bool writable,
 		vm_initializer *init, void *aux) {
@@ -47,14 +216,35 @@ vm_alloc_page_with_initializer (enum vm_type type, void *upage, bool writable,
 	ASSERT (VM_TYPE(type) != VM_UNINIT)
 
 	struct supplemental_page_table *spt = &thread_current ()->spt;
+	bool (*initializer) (struct page *, enum vm_type, void *);
+	struct page *page;
+
+	upage = pg_round_down (upage);
 
 	/* Check wheter the upage is already occupied or not. */
 	if (spt_find_page (spt, upage) == NULL) {
-		/* TODO: Create the page, fetch the initialier according to the VM type,
-		 * TODO: and then create "uninit" page struct by calling uninit_new. You
-		 * TODO: should modify the field after calling the uninit_new. */
+		switch (VM_TYPE (type)) {
+			case VM_ANON:
+				initializer = anon_initializer;
+				break;
+			case VM_FILE:
+				initializer = file_backed_initializer;
+				break;
+			default:
+				goto err;
+		}
 
-		/* TODO: Insert the page into the spt. */
+		page = malloc (sizeof *page);
+		if (page == NULL)
+			goto err;
+		uninit_new (page, upage, init, type, aux, initializer);
+		page->writable = writable;
+
+		if (!spt_insert_page (spt, page)) {
+			free (page);
+			goto err;
+		}
+		return true;
 	}
 err:
 	return false;
@@ -62,82 +252,561 @@ err:
 
 /* Find VA from spt and return page. On error, return NULL. */
 struct page *
-spt_find_page (struct supplemental_page_table *spt UNUSED, void *va UNUSED) {
-	struct page *page = NULL;
-	/* TODO: Fill this function. */
+spt_find_page (struct supplemental_page_table *spt, void *va) {
+	void **node = spt->root;
+	int level;
 
-	return page;
+	if (!is_user_vaddr (va))
+		return NULL;
+	for (level = 0; node != NULL && level < SPT_LEVELS - 1; level++)
+		node = node[SPT_INDEX (va, level)];
+	return node != NULL ? node[SPT_INDEX (va, SPT_LEVELS - 1)] : NULL;
 }
 
-/* Insert PAGE into spt with validation. */
+/* Insert PAGE into spt with validation.  Returns false if a page is
+ * already at PAGE's address or memory for the SPT runs out. */
 bool
-spt_insert_page (struct supplemental_page_table *spt UNUSED,
-		struct page *page UNUSED) {
-	int succ = false;
-	/* TODO: Fill this function. */
+spt_insert_page (struct supplemental_page_table *spt, struct page *page) {
+	struct page **slot;
 
-	return succ;
+	ASSERT (pg_ofs (page->va) == 0);
+
+	if (!is_user_vaddr (page->va))
+		return false;
+	slot = spt_slot (spt, page->va, true);
+	if (slot == NULL) {
+		spt_prune (spt, page->va);
+		return false;
+	}
+	if (*slot != NULL)
+		return false;
+	*slot = page;
+	spt->page_cnt++;
+	return true;
 }
 
+/* Removes PAGE from SPT, unmaps it and frees it along with its
+ * frame.  If PAGE is part of a huge page, that must have been split
+ * with vm_split_huge_page() first. */
 void
 spt_remove_page (struct supplemental_page_table *spt, struct page *page) {
-	vm_dealloc_page (page);
+	struct page **slot = spt_slot (spt, page->va, false);
+	uint64_t size = PGSIZE;
+
+	ASSERT (slot != NULL && *slot == page);
+	ASSERT (page->frame == NULL || pml4_lookup (thread_current ()->pml4,
+				(uint64_t) page->va, &size) == NULL || size == PGSIZE);
+
+	*slot = NULL;
+	spt->page_cnt--;
+	spt_prune (spt, page->va);
+	vm_free_page (page);
+}
+
+/* Calls ACTION on each page below NODE, which is at LEVEL of an
+ * SPT, as spt_for_each() does. */
+static bool
+spt_walk (void **node, int level, spt_action_func *action, void *aux) {
+	for (size_t i = 0; i < SPT_FANOUT; i++) {
+		if (node[i] == NULL)
+			continue;
+		if (level == SPT_LEVELS - 1 ? !action (node[i], aux)
+				: !spt_walk (node[i], level + 1, action, aux))
+			return false;
+	}
+	return true;
+}
+
+/* Calls ACTION on each page in SPT in ascending address order, with
+ * auxiliary data AUX, until ACTION returns false.  Returns false if
+ * it stopped early, true otherwise.  ACTION must not add pages to
+ * or remove pages from SPT. */
+bool
+spt_for_each (struct supplemental_page_table *spt,
+		spt_action_func *action, void *aux) {
+	return spt->root == NULL || spt_walk (spt->root, 0, action, aux);
+}
+
+/* Returns a new, empty SPT node, or a null pointer if memory runs
+ * out. */
+static void **
+spt_node_alloc (struct supplemental_page_table *spt) {
+	void **node = palloc_get_page (PAL_ZERO | PAL_TAG (MEM_VM));
+
+	if (node != NULL)
+		spt->node_cnt++;
+	return node;
+}
+
+/* Frees SPT node NODE. */
+static void
+spt_node_free (struct supplemental_page_table *spt, void **node) {
+	palloc_free_page (node);
+	spt->node_cnt--;
+}
+
+/* Returns true if NODE has no entries in use. */
+static bool
+spt_node_empty (void **node) {
+	for (size_t i = 0; i < SPT_FANOUT; i++)
+		if (node[i] != NULL)
+			return false;
 	return true;
 }
 
-/* Get the struct frame, that will be evicted. */
+/* Returns the leaf entry for the page at VA in SPT.  Missing nodes
+ * on the way are created if CREATE is true; otherwise, or if memory
+ * runs out, returns a null pointer when one is missing. */
+static struct page **
+spt_slot (struct supplemental_page_table *spt, const void *va, bool create) {
+	void **node;
+	int level;
+
+	if (spt->root == NULL
+			&& (!create || (spt->root = spt_node_alloc (spt)) == NULL))
+		return NULL;
+
+	node = spt->root;
+	for (level = 0; level < SPT_LEVELS - 1; level++) {
+		void **next = node[SPT_INDEX (va, level)];
+
+		if (next == NULL) {
+			if (!create || (next = spt_node_alloc (spt)) == NULL)
+				return NULL;
+			node[SPT_INDEX (va, level)] = next;
+		}
+		node = next;
+	}
+	return (struct page **) &node[SPT_INDEX (va, SPT_LEVELS - 1)];
+}
+
+/* Frees the nodes on the path to VA in SPT that are empty, from the
+ * bottom up. */
+static void
+spt_prune (struct supplemental_page_table *spt, const void *va) {
+	void **path[SPT_LEVELS];
+	void **node = spt->root;
+	int depth = 0;
+
+	while (node != NULL && depth < SPT_LEVELS) {
+		path[depth] = node;
+		node = depth < SPT_LEVELS - 1 ? node[SPT_INDEX (va, depth)] : NULL;
+		depth++;
+	}
+
+	while (depth-- > 0 && spt_node_empty (path[depth])) {
+		spt_node_free (spt, path[depth]);
+		if (depth > 0)
+			path[depth - 1][SPT_INDEX (va, depth - 1)] = NULL;
+		else
+			spt->root = NULL;
+	}
+}
+
+/* Get the struct frame, that will be evicted.  It comes pinned. */
 static struct frame *
 vm_get_victim (void) {
-	struct frame *victim = NULL;
-	 /* TODO: The policy for eviction is up to you. */
+	return frame_pin_victim ();
+}
+
+/* Maps each page pinned FRAME holds back in, with the permissions
+ * and dirty bit that vm_swap_out_frame() left in its PTE. */
+static void
+vm_remap_frame (struct frame *frame) {
+	struct list_elem *e;
+
+	for (e = list_begin (&frame->pages); e != list_end (&frame->pages);
+			e = list_next (e)) {
+		struct page *page = list_entry (e, struct page, frame_elem);
+		uint64_t *pml4 = page->pml4;
+		bool dirty = pml4_is_dirty (pml4, page->va);
 
-	return victim;
+		pml4_set_page (pml4, page->va, frame->kva,
+				pml4_is_writable (pml4, page->va));
+		pml4_set_dirty (pml4, page->va, dirty);
+	}
 }
 
-/* Evict one page and return the corresponding frame.
+/* Writes out the pages in pinned frame FRAME and unlinks them from
+ * it.  Returns false, leaving the pages where they were, if they
+ * cannot be written out right now.
+ *
+ * The pages of a shared frame are copies of one another, one per
+ * process, found through the frame's list of pages.  Anonymous ones
+ * are written out once, to a swap slot that all of them refer to.
+ * Pages of a mapped file are each written back if their own PTE is
+ * dirty. */
+static bool
+vm_swap_out_frame (struct frame *frame) {
+	struct page *first = list_entry (list_front (&frame->pages),
+			struct page, frame_elem);
+	bool anon = VM_TYPE (first->operations->type) == VM_ANON;
+	struct list_elem *e;
+	struct page *page;
+	uint64_t size;
+
+	if (anon && frame->page_cnt > SWAP_REF_MAX)
+		return false;
+	for (e = list_begin (&frame->pages); e != list_end (&frame->pages);
+			e = list_next (e)) {
+		page = list_entry (e, struct page, frame_elem);
+		if (pml4_lookup (page->pml4, (uint64_t) page->va, &size) != NULL
+				&& size != PGSIZE) {
+			if (!pml4_split_huge_page (page->pml4, page->va))
+				return false;
+			thp_split_cnt++;
+		}
+	}
+
+	/* Unmap first, so that no owner can change the page while it is
+	 * written out; a fault on it waits for us.  The dirty bits stay
+	 * behind in the PTEs for swap_out() to look at. */
+	for (e = list_begin (&frame->pages); e != list_end (&frame->pages);
+			e = list_next (e)) {
+		page = list_entry (e, struct page, frame_elem);
+		pml4_clear_page (page->pml4, page->va);
+	}
+
+	if (anon) {
+		if (!swap_out (first))
+			goto fail;
+		for (e = list_next (&first->frame_elem); e != list_end (&frame->pages);
+				e = list_next (e)) {
+			bool ok;
+
+			page = list_entry (e, struct page, frame_elem);
+			page->anon.slot = first->anon.slot;
+			ok = anon_swap_dup (page);
+			ASSERT (ok);
+		}
+	} else {
+		for (e = list_begin (&frame->pages); e != list_end (&frame->pages);
+				e = list_next (e))
+			if (!swap_out (list_entry (e, struct page, frame_elem)))
+				goto fail;
+	}
+	if (frame->page_cnt > 1)
+		shared_evict_cnt++;
+	frame_evicted (frame);
+	return true;
+
+fail:
+	vm_remap_frame (frame);
+	return false;
+}
+
+/* Evict one page and return the corresponding frame, pinned.
  * Return NULL on error.*/
 static struct frame *
 vm_evict_frame (void) {
-	struct frame *victim UNUSED = vm_get_victim ();
-	/* TODO: swap out the victim and return the evicted frame. */
+	size_t tries = frame_table_size ();
 
+	while (tries-- > 0) {
+		struct frame *victim = vm_get_victim ();
+
+		if (victim == NULL)
+			return NULL;
+		if (vm_swap_out_frame (victim)) {
+			evict_cnt++;
+			return victim;
+		}
+		frame_unpin (victim);
+	}
 	return NULL;
 }
 
+/* Wakes up kswapd, unless it is awake already. */
+static void
+kswapd_wake (void) {
+	if (!kswapd_pending) {
+		kswapd_pending = true;
+		sema_up (&kswapd_sema);
+	}
+}
+
+/* Background reclaim daemon.  Sleeps until memory runs low, then
+ * frees frames up to the high watermark or until nothing more can
+ * be evicted. */
+static void
+kswapd (void *aux UNUSED) {
+	for (;;) {
+		size_t free_cnt, want;
+
+		sema_down (&kswapd_sema);
+		kswapd_pending = false;
+		kswapd_wake_cnt++;
+
+		free_cnt = palloc_free_count (PAL_USER);
+		for (want = free_cnt < kswapd_high ? kswapd_high - free_cnt : 0;
+				want > 0; want--) {
+			struct frame *frame = vm_evict_frame ();
+
+			if (frame == NULL)
+				break;
+			vm_free_frame (frame);
+			kswapd_reclaim_cnt++;
+		}
+
+		/* The frames went to our magazine; hand them to the pool. */
+		palloc_magazine_drain ();
+	}
+}
+
 /* palloc() and get frame. If there is no available page, evict the page
- * and return it. This always return valid address. That is, if the user pool
- * memory is full, this function evicts the frame to get the available memory
- * space.*/
+ * and return it. That is, if the user pool memory is full, this function
+ * evicts the frame to get the available memory space.  Returns a null
+ * pointer only if nothing can be evicted either.
+ *
+ * The frame is in the frame table, pinned, with no page. */
 static struct frame *
 vm_get_frame (void) {
-	struct frame *frame = NULL;
-	/* TODO: Fill this function. */
+	void *kva = palloc_get_page (PAL_USER | PAL_TAG (MEM_VM));
+	struct frame *frame;
 
-	ASSERT (frame != NULL);
-	ASSERT (frame->page == NULL);
+	if (kva == NULL || palloc_free_count (PAL_USER) < kswapd_low)
+		kswapd_wake ();
+	if (kva == NULL) {
+		frame = vm_evict_frame ();
+		if (frame == NULL)
+			return NULL;
+		direct_reclaim_cnt++;
+	} else {
+		frame = malloc (sizeof *frame);
+		if (frame == NULL) {
+			palloc_free_page (kva);
+			return NULL;
+		}
+		frame->kva = kva;
+		list_init (&frame->pages);
+		frame->page_cnt = 0;
+		frame_table_add (frame);
+	}
+	frame->queue = 0;
+	frame->age = 0;
 	return frame;
 }
 
+/* Removes pinned FRAME from the frame table and frees it and the
+ * memory it holds. */
+static void
+vm_free_frame (struct frame *frame) {
+	frame_table_remove (frame);
+	palloc_free_page (frame->kva);
+	free (frame);
+}
+
+/* Returns true if PAGE is mapped to the zero page in PML4. */
+static bool
+is_zero_mapped (const struct page *page, uint64_t *pml4) {
+	return (page->frame == NULL && is_fresh_anon (page)
+			&& pml4_get_page (pml4, page->va) == zero_page);
+}
+
+/* Maps the zero page at PAGE, a fresh anonymous page that has taken
+ * a read fault, in the current process.  Returns false if memory
+ * runs out. */
+static bool
+vm_map_zero_page (struct page *page) {
+	if (!pml4_set_page (thread_current ()->pml4, page->va, zero_page, false))
+		return false;
+	zero_map_cnt++;
+	return true;
+}
+
+/* Unmaps PAGE from the current process and frees it and its
+ * frame.  PAGE must already be out of the SPT. */
+static void
+vm_free_page (struct page *page) {
+	struct frame *frame = frame_pin_page (page);
+	uint64_t *pml4 = thread_current ()->pml4;
+	void *va = page->va;
+	size_t left = 0;
+
+	/* Pinning the frame waited out any eviction of PAGE and keeps
+	 * the frame from being chosen now.  Destroying the page may write
+	 * it back, which wants the frame and the PTE's dirty bit.  Then
+	 * the PTE goes before the frame, or pml4_destroy() would free the
+	 * frame again.  The frame goes only with its last page.  A PTE
+	 * to the zero page must go as well, for the same reason. */
+	if (frame != NULL)
+		left = frame_unlink (frame, page);
+	else if (pml4 != NULL && is_zero_mapped (page, pml4))
+		pml4_clear_page (pml4, va);
+	vm_dealloc_page (page);
+	if (frame != NULL) {
+		if (pml4 != NULL)
+			pml4_clear_page (pml4, va);
+		if (left == 0)
+			vm_free_frame (frame);
+		else
+			frame_unpin (frame);
+	}
+}
+
 /* Growing the stack. */
 static void
-vm_stack_growth (void *addr UNUSED) {
+vm_stack_growth (void *addr) {
+	vm_alloc_page (VM_ANON, pg_round_down (addr), true);
+}
+
+/* Returns true if a fault at ADDR in the stack area, with the user
+ * stack pointer at RSP, looks like the stack growing: no further
+ * below RSP than a PUSH writes. */
+static bool
+is_stack_access (const void *addr, const void *rsp) {
+	return addr >= (void *) ((uint8_t *) rsp - 8);
 }
 
-/* Handle the fault on write_protected page */
+/* Handle the fault on write_protected page: a write to PAGE, which
+ * is writable but shares its frame copy-on-write or is mapped to the
+ * zero page.  Copies the frame for PAGE alone, unless the other
+ * pages have let go of it since, in which case PAGE just takes it
+ * over. */
 static bool
-vm_handle_wp (struct page *page UNUSED) {
+vm_handle_wp (struct page *page) {
+	uint64_t *pml4 = thread_current ()->pml4;
+	struct frame *frame, *copy;
+
+	if (!page->writable)
+		return false;
+
+	/* A page mapped to the zero page gets a frame of its own, zeroed,
+	 * which replaces the read-only PTE. */
+	if (is_zero_mapped (page, pml4)) {
+		if (!vm_do_claim_page (page))
+			return false;
+		zero_write_cnt++;
+		return true;
+	}
+
+	/* If PAGE has been evicted meanwhile, the retried write will
+	 * fault it back in, writable. */
+	frame = frame_pin_page (page);
+	if (frame == NULL)
+		return true;
+
+	if (frame->page_cnt > 1) {
+		bool ok;
+
+		copy = vm_get_frame ();
+		if (copy == NULL) {
+			frame_unpin (frame);
+			return false;
+		}
+		memcpy (copy->kva, frame->kva, PGSIZE);
+		frame_unlink (frame, page);
+		frame_link (copy, page, pml4);
+
+		/* The PTE is there already, so this cannot run out of memory. */
+		ok = pml4_set_page (pml4, page->va, copy->kva, true);
+		ASSERT (ok);
+		frame_unpin (frame);
+		cow_copy_cnt++;
+		frame = copy;
+	} else {
+		pml4_set_writable (pml4, page->va, true);
+		cow_reuse_cnt++;
+	}
+	frame_unpin (frame);
+	return true;
 }
 
 /* Return true on success */
 bool
-vm_try_handle_fault (struct intr_frame *f UNUSED, void *addr UNUSED,
-		bool user UNUSED, bool write UNUSED, bool not_present UNUSED) {
-	struct supplemental_page_table *spt UNUSED = &thread_current ()->spt;
+vm_try_handle_fault (struct intr_frame *f, void *addr,
+		bool user, bool write, bool not_present) {
+	struct supplemental_page_table *spt = &thread_current ()->spt;
 	struct page *page = NULL;
-	/* TODO: Validate the fault */
-	/* TODO: Your code goes here */
+	struct vma *vma;
 
-	return vm_do_claim_page (page);
+	fault_cnt++;
+
+	/* Validate the fault against the areas first: most bad accesses
+	 * end here without a page lookup. */
+	if (addr == NULL || !is_user_vaddr (addr))
+		return false;
+	vma = vma_find (&spt->vmas, addr);
+	if (vma == NULL || (write && !vma->writable))
+		return false;
+
+	page = spt_find_page (spt, addr);
+	if (!not_present)
+		return page != NULL && write && vm_handle_wp (page);
+	if (page != NULL && frame_wait_page (page))
+		return true;
+
+	if (page == NULL) {
+		/* In a system call, F holds the kernel's rsp; the user's was
+		 * saved on entry. */
+		void *rsp = user ? (void *) f->rsp : thread_current ()->user_rsp;
+
+		if (vma->type != VMA_STACK || !is_stack_access (addr, rsp))
+			return false;
+		vm_stack_growth (addr);
+		page = spt_find_page (spt, addr);
+		if (page == NULL)
+			return false;
+	}
+
+	/* Reading a page that was never written needs no frame, nor does
+	 * it warrant a huge one. */
+	if (!write && is_fresh_anon (page))
+		return vm_map_zero_page (page);
+	if (vm_try_huge_fault (spt, page))
+		return true;
+	if (!is_file_load (page))
+		return vm_do_claim_page (page);
+	if (!vm_do_claim_page (page))
+		return false;
+	file_fault_cnt++;
+	vm_map_around (page, vma);
+	return true;
+}
+
+/* Returns true if claiming PAGE, which is not resident, reads it
+ * from a file: the executable or a mapped file. */
+static bool
+is_file_load (const struct page *page) {
+	switch (VM_TYPE (page->operations->type)) {
+		case VM_UNINIT:
+			return page->uninit.init != NULL;
+		case VM_FILE:
+			return true;
+		default:
+			return false;
+	}
+}
+
+/* Loads and maps the pages around PAGE, which has just been read
+ * from a file, in the window of vm_fault_around pages that holds it
+ * and within VMA, that are also still to be read from a file.  Stops
+ * short rather than take a frame that would have to be reclaimed. */
+static void
+vm_map_around (struct page *page, struct vma *vma) {
+	struct supplemental_page_table *spt = &thread_current ()->spt;
+	uint64_t window = vm_fault_around * PGSIZE;
+	uint8_t *start, *end, *va;
+
+	if (vm_fault_around <= 1)
+		return;
+	start = (uint8_t *) page->va - pg_no (page->va) % vm_fault_around * PGSIZE;
+	end = start + window;
+	if (start < (uint8_t *) vma->start)
+		start = vma->start;
+	if (end > (uint8_t *) vma->end)
+		end = vma->end;
+
+	for (va = start; va < end; va += PGSIZE) {
+		struct page *near = spt_find_page (spt, va);
+
+		if (near == NULL || near == page || near->frame != NULL
+				|| !is_file_load (near))
+			continue;
+		if (palloc_free_count (PAL_USER) <= kswapd_low
+				|| !vm_do_claim_page (near))
+			break;
+		around_cnt++;
+	}
 }
 
 /* Free the page.
@@ -150,41 +819,401 @@ vm_dealloc_page (struct page *page) {
 
 /* Claim the page that allocate on VA. */
 bool
-vm_claim_page (void *va UNUSED) {
-	struct page *page = NULL;
-	/* TODO: Fill this function */
+vm_claim_page (void *va) {
+	struct page *page = spt_find_page (&thread_current ()->spt, va);
 
+	if (page == NULL)
+		return false;
 	return vm_do_claim_page (page);
 }
 
 /* Claim the PAGE and set up the mmu. */
 static bool
 vm_do_claim_page (struct page *page) {
-	struct frame *frame = vm_get_frame ();
+	struct frame *frame = vm_claim_pinned (page, thread_current ()->pml4);
+
+	if (frame == NULL)
+		return false;
+	frame_unpin (frame);
+	return true;
+}
+
+/* Returns the load information of PAGE if it is a page of the
+ * current process's executable text that has not been loaded yet,
+ * or a null pointer otherwise.  Its contents are those of every such
+ * page with the same load information. */
+static const struct load_info *
+text_info (const struct page *page) {
+	const struct uninit_page *uninit = &page->uninit;
+	const struct load_info *info = uninit->aux;
+
+	if (VM_TYPE (page->operations->type) != VM_UNINIT
+			|| VM_TYPE (uninit->type) != VM_ANON || page->writable
+			|| uninit->init == NULL || info == NULL || info->file != NULL)
+		return NULL;
+	return info;
+}
+
+/* Maps FRAME, which is pinned and holds the text PAGE is to be
+ * loaded with, at PAGE in PML4, and initializes PAGE without reading
+ * anything.  Returns false if memory runs out. */
+static bool
+vm_share_text (struct page *page, struct frame *frame, uint64_t *pml4) {
+	struct uninit_page *uninit = &page->uninit;
+	void *aux = uninit->aux;
+	bool ok;
+
+	if (!pml4_set_page (pml4, page->va, frame->kva, false))
+		return false;
+	ok = uninit->page_initializer (page, uninit->type, frame->kva);
+	ASSERT (ok);
+	free (aux);
+	frame_link (frame, page, pml4);
+	text_share_cnt++;
+	return true;
+}
+
+/* Claims PAGE, which is not resident, maps it in PML4 and returns
+ * its frame, still pinned.  Returns a null pointer on failure. */
+static struct frame *
+vm_claim_pinned (struct page *page, uint64_t *pml4) {
+	const struct load_info *text = text_info (page);
+	struct inode *inode = NULL;
+	off_t ofs = 0;
+	size_t read_bytes = 0;
+	struct frame *frame;
+
+	/* Text that another process has loaded already is shared. */
+	if (text != NULL) {
+		inode = file_get_inode (thread_current ()->fp);
+		ofs = text->ofs;
+		read_bytes = text->read_bytes;
+		frame = frame_pin_text (inode, ofs, read_bytes);
+		if (frame != NULL) {
+			if (vm_share_text (page, frame, pml4))
+				return frame;
+			frame_unpin (frame);
+			return NULL;
+		}
+	}
+
+	frame = vm_get_frame ();
+	if (frame == NULL)
+		return NULL;
 
 	/* Set links */
-	frame->page = page;
-	page->frame = frame;
+	frame_link (frame, page, pml4);
 
-	/* TODO: Insert page table entry to map page's VA to frame's PA. */
+	if (!pml4_set_page (pml4, page->va, frame->kva, page->writable))
+		goto fail;
+	if (VM_TYPE (page->operations->type) != VM_UNINIT)
+		major_fault_cnt++;
+	if (!swap_in (page, frame->kva)) {
+		pml4_clear_page (pml4, page->va);
+		goto fail;
+	}
+	if (text != NULL)
+		frame_index_text (frame, inode, ofs, read_bytes);
+	return frame;
+
+fail:
+	frame_unlink (frame, page);
+	page->frame = NULL;
+	vm_free_frame (frame);
+	return NULL;
+}
 
-	return swap_in (page, frame->kva);
+/* Returns true if PAGE has never been touched and is to be
+ * zero-filled: an anonymous page with no initializer. */
+static bool
+is_fresh_anon (const struct page *page) {
+	return (page != NULL
+			&& VM_TYPE (page->operations->type) == VM_UNINIT
+			&& VM_TYPE (page->uninit.type) == VM_ANON
+			&& page->uninit.init == NULL);
+}
+
+/* Tries to back the whole HPAGE_SIZE region around PAGE, which has
+ * just faulted, with one huge page.  That is possible only if the
+ * region's SPT leaf is full of fresh anonymous pages with PAGE's
+ * permissions, none of them mapped yet.  A read fault leaves the
+ * zero page mapped, and the page table that holds it would keep
+ * the huge page from being installed, so such a leaf is turned
+ * down before anything is allocated.  Returns true if it did so,
+ * false if PAGE must be claimed alone. */
+static bool
+vm_try_huge_fault (struct supplemental_page_table *spt, struct page *page) {
+	void *base = (void *) ((uint64_t) page->va & ~(HPAGE_SIZE - 1));
+	uint64_t *pml4 = thread_current ()->pml4;
+	struct page **leaf;
+	uint8_t *kpage;
+	size_t i;
+
+	if (!is_fresh_anon (page))
+		return false;
+	leaf = spt_slot (spt, base, false);
+	for (i = 0; i < HPAGE_PAGES; i++)
+		if (!is_fresh_anon (leaf[i]) || leaf[i]->writable != page->writable
+				|| pml4_get_page (pml4, leaf[i]->va) != NULL)
+			return false;
+
+	kpage = vm_get_huge_frame ();
+	if (kpage == NULL)
+		return false;
+	for (i = 0; i < HPAGE_PAGES; i++) {
+		struct frame *frame = malloc (sizeof *frame);
+
+		if (frame == NULL)
+			goto fail;
+		frame->kva = kpage + i * PGSIZE;
+		list_init (&frame->pages);
+		list_push_back (&frame->pages, &leaf[i]->frame_elem);
+		frame->page_cnt = 1;
+		frame->queue = 0;
+		frame->age = 0;
+		leaf[i]->frame = frame;
+		leaf[i]->pml4 = pml4;
+	}
+	if (!vm_map_huge_page (base, kpage, page->writable))
+		goto fail;
+
+	/* Fresh anonymous pages cannot fail to initialize.  Each 4 kB
+	 * part is a frame of its own as far as eviction goes. */
+	for (i = 0; i < HPAGE_PAGES; i++) {
+		struct frame *frame = leaf[i]->frame;
+		bool ok;
+
+		frame_table_add (frame);
+		ok = swap_in (leaf[i], frame->kva);
+		ASSERT (ok);
+		frame_unpin (frame);
+	}
+	return true;
+
+fail:
+	for (i = 0; i < HPAGE_PAGES && leaf[i]->frame != NULL; i++) {
+		free (leaf[i]->frame);
+		leaf[i]->frame = NULL;
+	}
+	palloc_free_multiple (kpage, HPAGE_PAGES);
+	return false;
 }
 
 /* Initialize new supplemental page table */
 void
-supplemental_page_table_init (struct supplemental_page_table *spt UNUSED) {
+supplemental_page_table_init (struct supplemental_page_table *spt) {
+	spt->root = NULL;
+	spt->page_cnt = 0;
+	spt->node_cnt = 0;
+	vma_tree_init (&spt->vmas);
 }
 
-/* Copy supplemental page table from src to dst */
+/* Makes DST a copy of SRC, a page of the parent that is not
+ * resident in DST, for the child, whose area VMA contains it. */
+static void
+clone_page (struct page *dst, const struct page *src,
+		const struct vma *vma) {
+	*dst = *src;
+	dst->frame = NULL;
+	if (page_get_type (dst) == VM_FILE)
+		dst->file.file = vma->file;
+}
+
+/* Copies SRC_PAGE into the current process's SPT, which is DST
+ * and already has its areas.  Pages that have not been loaded yet
+ * are copied as such, with their own copy of the load information.
+ * Others are shared copy-on-write: the new page is a clone of
+ * SRC_PAGE that holds the same frame, and both are mapped read-only
+ * until one is written to, or that refers to the same place on disk
+ * if SRC_PAGE is not resident.  Either way, a page of a mapped file
+ * refers to DST's handle on the file. */
+static bool
+copy_page (struct page *src_page, void *dst_) {
+	struct supplemental_page_table *dst = dst_;
+	struct vma *vma = vma_find (&dst->vmas, src_page->va);
+	uint64_t *src_pml4 = thread_current ()->parent_process->pml4;
+	uint64_t *dst_pml4 = thread_current ()->pml4;
+	struct frame *frame;
+	struct page *dst_page;
+	uint64_t size;
+
+	ASSERT (dst == &thread_current ()->spt);
+	ASSERT (vma != NULL);
+
+	if (VM_TYPE (src_page->operations->type) == VM_UNINIT) {
+		struct uninit_page *uninit = &src_page->uninit;
+		struct load_info *aux = NULL;
+
+		if (uninit->aux != NULL) {
+			aux = malloc (sizeof *aux);
+			if (aux == NULL)
+				return false;
+			memcpy (aux, uninit->aux, sizeof *aux);
+			if (aux->file != NULL)
+				aux->file = vma->file;
+		}
+		if (!vm_alloc_page_with_initializer (uninit->type, src_page->va,
+					src_page->writable, uninit->init, aux)) {
+			free (aux);
+			return false;
+		}
+		return true;
+	}
+
+	dst_page = malloc (sizeof *dst_page);
+	if (dst_page == NULL)
+		return false;
+
+	/* A page that has been evicted is shared where it was written
+	 * out: a file page is in its file, and an anonymous page's swap
+	 * slot counts one more reference.  Neither is read in. */
+	frame = frame_pin_page (src_page);
+	if (frame == NULL && (page_get_type (src_page) == VM_FILE
+				|| anon_swap_dup (src_page))) {
+		clone_page (dst_page, src_page, vma);
+		if (!spt_insert_page (dst, dst_page)) {
+			vm_dealloc_page (dst_page);
+			return false;
+		}
+		cow_swap_share_cnt++;
+		return true;
+	}
+
+	/* Otherwise the two share the frame, and the parent's page must
+	 * not be evicted meanwhile.  A page whose slot cannot count any
+	 * more references is read back in for the parent, which is
+	 * waiting for us. */
+	if (frame == NULL)
+		frame = vm_claim_pinned (src_page, src_pml4);
+	if (frame == NULL) {
+		free (dst_page);
+		return false;
+	}
+	clone_page (dst_page, src_page, vma);
+	if (!spt_insert_page (dst, dst_page)) {
+		free (dst_page);
+		goto fail;
+	}
+
+	/* Write-protect the parent's mapping, which cannot be part of a
+	 * huge page any more, and map the frame read-only in the child. */
+	if (pml4_lookup (src_pml4, (uint64_t) src_page->va, &size) != NULL
+			&& size != PGSIZE) {
+		if (!pml4_split_huge_page (src_pml4, src_page->va))
+			goto fail_remove;
+		thp_split_cnt++;
+	}
+	if (!pml4_set_page (dst_pml4, dst_page->va, frame->kva, false))
+		goto fail_remove;
+	pml4_set_writable (src_pml4, src_page->va, false);
+	frame_link (frame, dst_page, dst_pml4);
+	frame_unpin (frame);
+	cow_share_cnt++;
+	return true;
+
+fail_remove:
+	spt_remove_page (dst, dst_page);
+fail:
+	frame_unpin (frame);
+	return false;
+}
+
+/* Copy supplemental page table from src to dst.  DST must be the
+ * current process's and SRC its parent's. */
+bool
+supplemental_page_table_copy (struct supplemental_page_table *dst,
+		struct supplemental_page_table *src) {
+	return (vma_tree_copy (&dst->vmas, &src->vmas)
+			&& spt_for_each (src, copy_page, dst));
+}
+
+/* Frees the subtree of SPT at NODE, which is at LEVEL, together with
+ * its pages. */
+static void
+spt_destroy (struct supplemental_page_table *spt, void **node, int level) {
+	for (size_t i = 0; i < SPT_FANOUT; i++) {
+		if (node[i] == NULL)
+			continue;
+		if (level == SPT_LEVELS - 1)
+			vm_free_page (node[i]);
+		else
+			spt_destroy (spt, node[i], level + 1);
+	}
+	spt_node_free (spt, node);
+}
+
+/* Free the resource hold by the supplemental page table, leaving it
+ * empty. */
+void
+supplemental_page_table_kill (struct supplemental_page_table *spt) {
+	if (spt->root != NULL)
+		spt_destroy (spt, spt->root, 0);
+	spt->root = NULL;
+	spt->page_cnt = 0;
+	ASSERT (spt->node_cnt == 0);
+	vma_tree_kill (&spt->vmas);
+}
+
+/* Returns an HPAGE_SIZE-aligned block of HPAGE_PAGES user frames,
+ * or a null pointer if there is none, in which case the caller falls
+ * back to 4 kB frames.  The block is not zeroed: the pages mapped
+ * into it zero themselves when they are initialized. */
+void *
+vm_get_huge_frame (void) {
+	void *kpage = palloc_get_aligned (PAL_USER | PAL_TAG (MEM_VM),
+			HPAGE_PAGES, HPAGE_PAGES);
+	if (kpage == NULL)
+		thp_fallback_cnt++;
+	return kpage;
+}
+
+/* Maps the huge page at UPAGE in the current process to the block
+ * KPAGE obtained from vm_get_huge_frame().  Returns false if some of
+ * the region is already mapped or memory runs out. */
 bool
-supplemental_page_table_copy (struct supplemental_page_table *dst UNUSED,
-		struct supplemental_page_table *src UNUSED) {
+vm_map_huge_page (void *upage, void *kpage, bool writable) {
+	if (!pml4_set_huge_page (thread_current ()->pml4, upage, kpage, writable))
+		return false;
+	thp_fault_cnt++;
+	return true;
+}
+
+/* Splits the huge page containing UADDR in the current process, if
+ * any, into 4 kB pages.  Returns false if memory runs out. */
+bool
+vm_split_huge_page (void *uaddr) {
+	uint64_t *pml4 = thread_current ()->pml4;
+	uint64_t size;
+
+	if (pml4_lookup (pml4, (uint64_t) uaddr, &size) == NULL || size == PGSIZE)
+		return true;
+	if (!pml4_split_huge_page (pml4, uaddr))
+		return false;
+	thp_split_cnt++;
+	return true;
 }
 
-/* Free the resource hold by the supplemental page table */
+/* Prints virtual memory statistics. */
 void
-supplemental_page_table_kill (struct supplemental_page_table *spt UNUSED) {
-	/* TODO: Destroy all the supplemental_page_table hold by thread and
-	 * TODO: writeback all the modified contents to the storage. */
+vm_print_stats (void) {
+	printf ("THP: %lld huge pages mapped, %lld fallbacks, %lld splits\n",
+			thp_fault_cnt, thp_fallback_cnt, thp_split_cnt);
+	printf ("Frames: %zu in use, %s eviction, %lld evictions "
+			"(%lld of shared frames), %lld major faults\n", frame_table_size (),
+			frame_policy_name (), evict_cnt, shared_evict_cnt, major_fault_cnt);
+	printf ("Reclaim: %lld frames by faulting threads, %lld by kswapd "
+			"in %lld wakeups, watermarks %zu/%zu\n", direct_reclaim_cnt,
+			kswapd_reclaim_cnt, kswapd_wake_cnt, kswapd_low, kswapd_high);
+	printf ("COW: %lld pages shared by fork, %lld of them evicted, "
+			"%lld copied, %lld reused\n", cow_share_cnt + cow_swap_share_cnt,
+			cow_swap_share_cnt, cow_copy_cnt, cow_reuse_cnt);
+	printf ("Faults: %lld page faults, %lld read a file page, "
+			"%lld more pages read around them in windows of %zu\n",
+			fault_cnt, file_fault_cnt, around_cnt, vm_fault_around);
+	printf ("Text: %lld pages shared instead of read, %zu frames "
+			"indexed\n", text_share_cnt, frame_text_size ());
+	printf ("Zero page: %lld pages mapped, %lld written later, "
+			"%lld frames saved\n", zero_map_cnt, zero_write_cnt,
+			zero_map_cnt - zero_write_cnt);
+	vm_anon_print_stats ();
 }
@@ -0,0 +1,133 @@
+/* vma.c: Virtual memory areas.
+ *
+ * Each process keeps its areas in a red-black tree ordered by start
+ * address.  Areas never overlap, so they are in end address order
+ * too: the only area that can contain ADDR is the last one starting
+ * at or below it, and a range [START, END) overlaps some area exactly
+ * when the last area starting below END ends after START.  Either
+ * question takes one O(log n) descent, so mmap() checks a mapping of
+ * any length without looking at its pages, and the fault handler
+ * turns away an address outside every area before it touches the
+ * supplemental page table. */
+
+#include "vm/vma.h"
+#include <debug.h>
+#include "filesys/file.h"
+#include "threads/malloc.h"
+
+/* Orders areas by start address. */
+static bool
+vma_less (const struct rb_node *a, const struct rb_node *b,
+		void *aux UNUSED) {
+	return (rb_entry (a, struct vma, node)->start
+			< rb_entry (b, struct vma, node)->start);
+}
+
+/* Initializes VT as an empty set of areas. */
+void
+vma_tree_init (struct vma_tree *vt) {
+	rb_init (&vt->tree, vma_less, NULL, NULL);
+}
+
+/* Returns the last area in VT that starts at or below ADDR, or a
+ * null pointer if there is none. */
+static struct vma *
+floor_vma (struct vma_tree *vt, const void *addr) {
+	struct vma key;
+	struct rb_node *n;
+
+	key.start = (void *) addr;
+	n = rb_upper_bound (&vt->tree, &key.node);
+	n = n != NULL ? rb_prev (n) : rb_last (&vt->tree);
+	return n != NULL ? rb_entry (n, struct vma, node) : NULL;
+}
+
+/* Returns the area in VT that contains ADDR, or a null pointer if
+ * ADDR is in none. */
+struct vma *
+vma_find (struct vma_tree *vt, const void *addr) {
+	struct vma *vma = floor_vma (vt, addr);
+
+	return vma != NULL && addr < vma->end ? vma : NULL;
+}
+
+/* Returns true if any part of [START, END) lies in an area of VT. */
+bool
+vma_overlaps (struct vma_tree *vt, const void *start, const void *end) {
+	struct vma *vma;
+
+	ASSERT (start < end);
+
+	vma = floor_vma (vt, (const uint8_t *) end - 1);
+	return vma != NULL && vma->end > start;
+}
+
+/* Adds an area of type TYPE covering [START, END) to VT and returns
+ * it.  Returns a null pointer if the range is empty, overlaps an
+ * existing area or memory runs out. */
+struct vma *
+vma_create (struct vma_tree *vt, void *start, void *end,
+		enum vma_type type, bool writable) {
+	struct vma *vma;
+
+	if (start >= end || vma_overlaps (vt, start, end))
+		return NULL;
+	vma = malloc (sizeof *vma);
+	if (vma == NULL)
+		return NULL;
+
+	vma->start = start;
+	vma->end = end;
+	vma->type = type;
+	vma->writable = writable;
+	vma->file = NULL;
+	vma->offset = 0;
+	vma->length = 0;
+	rb_insert (&vt->tree, &vma->node);
+	return vma;
+}
+
+/* Removes VMA from VT and frees it, closing its file if any.  The
+ * pages in it must already be gone. */
+void
+vma_destroy (struct vma_tree *vt, struct vma *vma) {
+	rb_erase (&vt->tree, &vma->node);
+	file_close (vma->file);
+	free (vma);
+}
+
+/* Copies the areas of SRC into DST, which must be empty, each with
+ * its own handle on its file.  Returns false if memory runs out. */
+bool
+vma_tree_copy (struct vma_tree *dst, struct vma_tree *src) {
+	struct rb_node *n;
+
+	for (n = rb_first (&src->tree); n != NULL; n = rb_next (n)) {
+		struct vma *s = rb_entry (n, struct vma, node);
+		struct vma *d = vma_create (dst, s->start, s->end, s->type,
+				s->writable);
+
+		if (d == NULL)
+			return false;
+		if (s->file != NULL && (d->file = file_reopen (s->file)) == NULL)
+			return false;
+		d->offset = s->offset;
+		d->length = s->length;
+	}
+	return true;
+}
+
+/* rb_clear() destructor: frees the area at N. */
+static void
+vma_free (struct rb_node *n, void *aux UNUSED) {
+	struct vma *vma = rb_entry (n, struct vma, node);
+
+	file_close (vma->file);
+	free (vma);
+}
+
+/* Frees all the areas in VT, leaving it empty. */
+void
+vma_tree_kill (struct vma_tree *vt) {
+	rb_clear (&vt->tree, vma_free);
+}